@@ -1,5 +1,6 @@
 #pragma once
 #include <bts/bitname/name_block.hpp>
+#include <bts/mining_pool.hpp>
 
 namespace bts { namespace bitname {
 
@@ -11,6 +12,25 @@ namespace bts { namespace bitname {
          
     };
 
+    /**
+     *  Snapshot of the miner's progress on the current block, see
+     *  name_miner::status().
+     */
+    struct name_miner_status
+    {
+       name_miner_status()
+       :effort(0),utilization(0),hashes_per_sec(0),total_hashes(0),est_seconds_to_target(0){}
+
+       float                effort;                ///< requested fraction of each core
+       double               utilization;           ///< measured fraction of each core, averaged over threads
+       double               hashes_per_sec;        ///< all threads combined
+       std::vector<double>  thread_hashes_per_sec;
+       uint64_t             total_hashes;          ///< since the current block was started
+       mini_pow             best_hash;             ///< lowest hash found for the current block
+       mini_pow             target;
+       double               est_seconds_to_target; ///< expected time to find a block at the current rate, 0 if not mining
+    };
+
     namespace detail { class name_miner_impl; }
 
     /**
@@ -24,7 +44,12 @@ namespace bts { namespace bitname {
     class name_miner
     {
        public:
-          name_miner();
+          /**
+           *  @param pool threads to mine on, may be shared with the block
+           *         miner; a pool with the default configuration is created
+           *         if none is given.
+           */
+          name_miner( const mining_pool_ptr& pool = mining_pool_ptr() );
           ~name_miner();
 
           void set_delegate( name_miner_delegate* d );
@@ -37,9 +62,25 @@ namespace bts { namespace bitname {
 
           void set_name( const std::string& name, const fc::ecc::public_key& k );
 
+          /**
+           *  @param effort fraction of each mining thread's core to use,
+           *         enforced as a duty cycle over MINING_WINDOW_USEC
+           */
           void start( float effort = 1 );
           void stop();
 
+          name_miner_status status()const;
+
+          /**
+           *  Resizes the mining pool, if mining the search for the current
+           *  block is restarted across the new set of threads.
+           *
+           *  @param n 0 for one thread per core
+           */
+          void              set_thread_count( uint32_t n );
+          uint32_t          thread_count()const;
+          mining_pool_ptr   get_mining_pool()const;
+
           /**
            *  This will clear all all names from the merkle tree that
            *  don't share the same prev pow.
@@ -57,3 +98,5 @@ namespace bts { namespace bitname {
     };
 
 } }  // namespace bts
+
+FC_REFLECT( bts::bitname::name_miner_status, (effort)(utilization)(hashes_per_sec)(thread_hashes_per_sec)(total_hashes)(best_hash)(target)(est_seconds_to_target) )
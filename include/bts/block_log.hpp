@@ -0,0 +1,78 @@
+#pragma once
+#include <bts/proof_of_work.hpp>
+#include <fc/filesystem.hpp>
+#include <fc/optional.hpp>
+#include <memory>
+#include <vector>
+
+namespace bts {
+
+  namespace detail { class block_log_impl; }
+
+  /**
+   *  @brief Append-only file of serialized blocks with an in memory index.
+   *
+   *  Every record is a fixed size header (id, previous id, height and size
+   *  of the block) followed by the packed block and a checksum of it.  The
+   *  log never rewrites a record, side chains are appended like any other
+   *  block, so a crash can only ever damage the last record.
+   *
+   *  open() reads just the record headers to rebuild the index by id and by
+   *  height and truncates a tail record that was not completely written.
+   *  Blocks are read back on demand with pread(), so memory use is bounded
+   *  by the index rather than by the size of the chain.
+   *
+   *  All methods must be called from the same thread.
+   */
+  class block_log
+  {
+     public:
+        struct entry
+        {
+           entry():height(0),offset(0),size(0){}
+
+           pow_hash id;
+           pow_hash prev;
+           uint32_t height;
+           uint64_t offset; ///< of the record header
+           uint32_t size;   ///< of the packed block
+        };
+
+        block_log();
+        ~block_log();
+
+        void open( const fc::path& file );
+        void close();
+        bool is_open()const;
+
+        /**
+         *  Appends the packed block and syncs it to disk, does nothing if a
+         *  block with the same id is already in the log.
+         *
+         *  @return the index entry of the block
+         */
+        entry                           append( const pow_hash& id, const pow_hash& prev, uint32_t height,
+                                                const std::vector<char>& packed_block );
+
+        fc::optional<entry>             find( const pow_hash& id )const;
+        /** @return every block at height h, in the order they were appended */
+        std::vector<entry>              at_height( uint32_t h )const;
+
+        /**
+         *  Reads the packed block back from disk.
+         *
+         *  @throw if the record does not match its checksum
+         */
+        fc::optional<std::vector<char>> fetch( const pow_hash& id )const;
+
+        /** @return the number of blocks in the log */
+        uint64_t                        size()const;
+
+     private:
+        std::unique_ptr<detail::block_log_impl> my;
+  };
+
+} // namespace bts
+
+#include <fc/reflect/reflect.hpp>
+FC_REFLECT( bts::block_log::entry, (id)(prev)(height)(offset)(size) )
@@ -1,5 +1,5 @@
 #pragma once
-#include <bts/proof.hpp>
+#include <bts/blockchain/proof.hpp>
 #include <bts/blockchain/transaction.hpp>
 
 namespace bts
@@ -10,14 +10,19 @@ namespace bts
     *  the nonce because that information is provided by
     *  the block_proof struct which is a header plus 
     *  proof of work.   
+    *
+    *  A block is identified by its proof of work, so prev is a
+    *  pow_hash rather than the sha224 of the previous header.  That
+    *  changed the packed header from 66 to 48 bytes and every block
+    *  id, blocks packed with a sha224 prev can not be read.
     */
    struct block_header
    {
       block_header()
-      :version(0),block_num(0),timestamp(0){}
+      :version(0),prev(),block_num(0),timestamp(0){}
 
       uint16_t   version;
-      fc::sha224 prev;
+      pow_hash   prev;        ///< proof of work of the previous block, which is its id
       uint32_t   block_num;
       uint32_t   timestamp;   ///< seconds from 1970
       fc::sha224 state_hash;  ///< hash of the block state.
@@ -63,7 +68,7 @@ namespace bts
        */
       std::vector<std::string>        miner_features;
 
-      std::vector<signed_transaction> transactions;
+      std::vector<cached_transaction> transactions;
       /**
        *  Ordered in the same manner as transactions and their
        *  outputs Trx#.OUT#.  Ie:  
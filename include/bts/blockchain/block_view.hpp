@@ -0,0 +1,76 @@
+#pragma once
+#include <bts/blockchain/block.hpp>
+#include <bts/blockchain/transaction_view.hpp>
+
+namespace bts {
+
+  /** forward iterator over packed signed_transactions that were bounds checked */
+  class packed_transaction_iterator : public std::iterator<std::forward_iterator_tag,const transaction_view>
+  {
+     public:
+        packed_transaction_iterator():_pos(nullptr),_end(nullptr){}
+        packed_transaction_iterator( const char* pos, const char* end )
+        :_pos(pos),_end(end){ parse(); }
+
+        const transaction_view& operator*()const  { return _trx; }
+        const transaction_view* operator->()const { return &_trx; }
+
+        packed_transaction_iterator& operator++()
+        {
+           _pos += _trx.bytes().size;
+           parse();
+           return *this;
+        }
+
+        bool operator==( const packed_transaction_iterator& o )const { return _pos == o._pos; }
+        bool operator!=( const packed_transaction_iterator& o )const { return _pos != o._pos; }
+
+     private:
+        void parse()
+        {
+           if( _pos != _end ) _trx = transaction_view( _pos, _end - _pos );
+        }
+
+        const char*      _pos;
+        const char*      _end;
+        transaction_view _trx;
+  };
+
+  /**
+   *  @brief Read only access to a packed block in place.
+   *
+   *  The block_proof is small and is unpacked on demand, the block_state is
+   *  walked once on construction to bounds check every transaction and the
+   *  sections after them.  Transactions are then visited as transaction_views
+   *  over the same buffer, so validating or relaying a block does not
+   *  allocate per input, output or signature.
+   */
+  class block_view
+  {
+     public:
+        block_view();
+
+        /** @throw if data does not start with a complete packed block */
+        block_view( const char* data, size_t size );
+
+        block_proof                 header()const;
+        /** the packed block_proof */
+        packed_range                header_bytes()const;
+
+        uint32_t                    num_transactions()const;
+        packed_transaction_iterator transactions_begin()const;
+        packed_transaction_iterator transactions_end()const;
+
+        /** the whole packed block */
+        packed_range                bytes()const;
+
+     private:
+        const char* _begin;
+        const char* _header_end;
+        uint32_t    _num_trxs;
+        const char* _trxs;
+        const char* _trxs_end;
+        const char* _end;
+  };
+
+} // namespace bts
@@ -0,0 +1,169 @@
+#pragma once
+#include <bts/blockchain/transaction.hpp>
+#include <bts/config.hpp>
+#include <fc/exception/exception.hpp>
+#include <algorithm>
+#include <memory>
+#include <vector>
+
+namespace bts {
+
+  struct trx_output_view;
+
+  /**
+   *  @brief Fixed size outputs of one claim type, packed densely in slabs.
+   *
+   *  Records live in slabs of OUTPUT_POOL_SLAB_BYTES that are never moved
+   *  or reallocated.  Erasing a record moves the last record into its place
+   *  so the records stay dense, a scan over every output of a type (all
+   *  open bids, all transfers to an address) reads contiguous memory with
+   *  no holes and no per-record allocation.
+   *
+   *  Records are addressed by a handle that stays valid until the record is
+   *  erased, the handles of erased records are reused.
+   */
+  template<typename T>
+  class output_pool
+  {
+     public:
+        typedef T value_type;
+        enum { slab_records = sizeof(T) < OUTPUT_POOL_SLAB_BYTES ? OUTPUT_POOL_SLAB_BYTES / sizeof(T) : 1 };
+
+        output_pool():_size(0){}
+
+        /** @return the handle of the new record */
+        uint32_t insert( const T& v )
+        {
+           uint32_t h;
+           if( _free.size() )
+           {
+              h = _free.back();
+              _free.pop_back();
+           }
+           else
+           {
+              h = _position.size();
+              _position.push_back( 0 );
+           }
+
+           if( _size == _slabs.size() * slab_records )
+           {
+              _slabs.push_back( std::unique_ptr<T[]>( new T[slab_records] ) );
+           }
+           record( _size ) = v;
+           _handle.push_back( h );
+           _position[h] = _size++;
+           return h;
+        }
+
+        void erase( uint32_t h )
+        {
+           FC_ASSERT( contains( h ), "no output with handle ${h}", ("h",h) );
+           const uint32_t pos  = _position[h];
+           const uint32_t last = _size - 1;
+           if( pos != last )
+           {
+              record( pos )          = record( last );
+              _handle[pos]           = _handle[last];
+              _position[_handle[pos]] = pos;
+           }
+           _handle.pop_back();
+           --_size;
+           _position[h] = npos;
+           _free.push_back( h );
+
+           // keep one empty slab so a record erased and inserted at a slab boundary does not thrash
+           if( _slabs.size() * slab_records >= _size + 2 * slab_records ) _slabs.pop_back();
+        }
+
+        bool     contains( uint32_t h )const { return h < _position.size() && _position[h] != npos; }
+        uint32_t size()const                 { return _size; }
+
+        const T& get( uint32_t h )const
+        {
+           FC_ASSERT( contains( h ), "no output with handle ${h}", ("h",h) );
+           return record( _position[h] );
+        }
+
+        void set( uint32_t h, const T& v )
+        {
+           FC_ASSERT( contains( h ), "no output with handle ${h}", ("h",h) );
+           record( _position[h] ) = v;
+        }
+
+        /** calls f( handle, record ) for every record, in storage order */
+        template<typename Functor>
+        void for_each( Functor&& f )const
+        {
+           for( uint32_t s = 0; s * slab_records < _size; ++s )
+           {
+              const T*       slab = _slabs[s].get();
+              const uint32_t base = s * slab_records;
+              const uint32_t n    = std::min<uint32_t>( slab_records, _size - base );
+              for( uint32_t i = 0; i < n; ++i ) f( _handle[base + i], slab[i] );
+           }
+        }
+
+        void clear()
+        {
+           _slabs.clear();
+           _position.clear();
+           _handle.clear();
+           _free.clear();
+           _size = 0;
+        }
+
+     private:
+        static const uint32_t npos = uint32_t(-1);
+
+        T&       record( uint32_t pos )       { return _slabs[pos / slab_records][pos % slab_records]; }
+        const T& record( uint32_t pos )const { return _slabs[pos / slab_records][pos % slab_records]; }
+
+        std::vector< std::unique_ptr<T[]> > _slabs;
+        std::vector<uint32_t>               _position; ///< by handle, npos once erased
+        std::vector<uint32_t>               _handle;   ///< by position
+        std::vector<uint32_t>               _free;     ///< erased handles
+        uint32_t                            _size;
+  };
+
+  /**
+   *  @brief One output_pool per claim_type.
+   *
+   *  Outputs are stored decoded as their fixed size type rather than as
+   *  generic_trx_out blobs.  A new output type gets a pool here and a case
+   *  in store(), erase() and get().
+   */
+  class output_pools
+  {
+     public:
+        struct handle
+        {
+           handle():type(null_claim_type),index(0){}
+           handle( claim_type t, uint32_t i ):type(t),index(i){}
+
+           claim_type type;
+           uint32_t   index;
+        };
+
+        /** @throw if out is not of a known claim type */
+        handle          store( const generic_trx_out& out );
+        /** decodes the output straight from the packed bytes of a transaction */
+        handle          store( const trx_output_view& out );
+        void            erase( const handle& h );
+        generic_trx_out get( const handle& h )const;
+        bool            contains( const handle& h )const;
+
+        /** outputs that can be claimed by the signature of an address */
+        const output_pool<trx_output_by_address>& by_address()const { return _by_address; }
+
+        uint32_t        size()const;
+        void            clear();
+
+     private:
+        output_pool<trx_output_by_address> _by_address;
+  };
+
+} // namespace bts
+
+#include <fc/reflect/reflect.hpp>
+FC_REFLECT( bts::output_pools::handle, (type)(index) )
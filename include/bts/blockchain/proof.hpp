@@ -1,7 +1,7 @@
 #pragma once
 #include <fc/crypto/sha224.hpp>
 #include <fc/reflect/reflect.hpp>
-#include <bts/merkel_tree.hpp>
+#include <bts/merkle_tree.hpp>
 
 namespace bts
 {
@@ -12,7 +12,7 @@ namespace bts
   struct proof
   {
      proof()
-     :branch_path(-1),nonce(0){}
+     :nonce(0){}
 
      /**
       *  Does not include the leaf_hash which must be passed to the
@@ -24,7 +24,7 @@ namespace bts
       *
       *  Includes the full merkel branch to the hash of the header.
       */
-     merkel_branch           header_branch;
+     merkle_branch           header_branch;
      uint64_t                nonce;
   };
 
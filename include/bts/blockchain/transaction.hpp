@@ -2,6 +2,7 @@
 #include <bts/units.hpp>
 #include <bts/address.hpp>
 #include <bts/proof_of_work.hpp>
+#include <bts/flat_hash.hpp>
 #include <fc/crypto/elliptic.hpp>
 #include <fc/crypto/sha224.hpp>
 #include <fc/io/varint.hpp>
@@ -28,6 +29,21 @@ struct output_reference
   }
 };
 
+/**
+ *  Hashes the fields of an output_reference rather than its bytes, which
+ *  include padding.  The outputs of one transaction share trx_hash so the
+ *  index is folded in.
+ */
+struct output_reference_hash
+{
+   size_t operator()( const output_reference& r )const
+   {
+      uint64_t w;
+      memcpy( &w, &r.trx_hash, sizeof(w) );
+      return size_t( mix_hash_word( (w + r.output_idx) ^ hash_seed() ) );
+   }
+};
+
 enum claim_type
 {
    /** basic claim by single address */
@@ -131,11 +147,17 @@ struct generic_trx_out
 
 /**
  *  @brief maps inputs to outputs.
+ *
+ *  expire_block is packed right after version and is part of the id, so
+ *  the signatures cover it and a relay can not extend a transaction past
+ *  its expiration, and two coinbases paying the same address in different
+ *  blocks have different ids.  transaction_view reads it at that fixed
+ *  offset.
  */
 struct transaction
 {
    uint16_t                     version;
-   uint32_t                     expire_block;
+   uint32_t                     expire_block;  ///< last block this transaction may be included in, 0 for none
    std::vector<generic_trx_in>  inputs;
    std::vector<generic_trx_out> outputs;
 };
@@ -145,6 +167,49 @@ struct signed_transaction : public transaction
     std::vector<fc::ecc::compact_signature> sigs;
 };
 
+/**
+ *  A signed_transaction that carries its id, calculated once when it is
+ *  constructed or unpacked instead of re-packing the transaction every
+ *  time the id is needed.
+ *
+ *  The id covers the transaction but not the signatures, so signatures
+ *  can be added without invalidating it.  Any other change goes through
+ *  mutate(), which recalculates the id, so id() is a plain read that is
+ *  safe to call from several threads.
+ *
+ *  Packs exactly like a signed_transaction.
+ */
+class transaction_view;
+
+class cached_transaction
+{
+   public:
+     cached_transaction();
+     cached_transaction( signed_transaction trx );
+     /** hashes the packed bytes of the view instead of packing the transaction again */
+     explicit cached_transaction( const transaction_view& trx );
+
+     const signed_transaction& trx()const { return _trx; }
+     operator const signed_transaction&()const { return _trx; }
+     const fc::sha224&         id()const  { return _id; }
+
+     void add_signature( const fc::ecc::compact_signature& sig ) { _trx.sigs.push_back( sig ); }
+
+     /** calls f with the transaction to modify and recalculates the id */
+     template<typename Functor>
+     void mutate( Functor&& f )
+     {
+        f( _trx );
+        _id = calculate_id( _trx );
+     }
+
+     static fc::sha224 calculate_id( const transaction& trx );
+
+   private:
+     signed_transaction _trx;
+     fc::sha224         _id;
+};
+
 } // namespace bts
 
 namespace fc
@@ -164,7 +229,24 @@ namespace fc
        v = bts::claim_type(o);
        FC_ASSERT( o < bts::num_claim_types )
     }
+
+    template<typename Stream> 
+    inline void pack( Stream& s, const bts::cached_transaction& v )
+    {
+       pack( s, v.trx() );
+    }
+    template<typename Stream> 
+    inline void unpack( Stream& s, bts::cached_transaction& v )
+    {
+       bts::signed_transaction trx;
+       unpack( s, trx );
+       v = bts::cached_transaction( std::move(trx) );
+    }
   }
+
+  class variant;
+  void to_variant( const bts::cached_transaction& t, variant& v );
+  void from_variant( const variant& v, bts::cached_transaction& t );
 }
 
 FC_REFLECT( bts::output_reference, (trx_hash)(output_idx) )
@@ -175,7 +257,7 @@ FC_REFLECT( bts::trx_output, (amount)(unit)(claim_func) )
 FC_REFLECT_DERIVED( bts::trx_output_by_address, (bts::trx_output), (claim_address)(lock_time) )
 FC_REFLECT( bts::generic_trx_in, (in_type)(data) )
 FC_REFLECT( bts::generic_trx_out, (out_type)(data) )
-FC_REFLECT( bts::transaction, (version)(inputs)(outputs) )
+FC_REFLECT( bts::transaction, (version)(expire_block)(inputs)(outputs) )
 FC_REFLECT_DERIVED( bts::signed_transaction, (bts::transaction), (sigs) )
 
 namespace std
@@ -0,0 +1,84 @@
+#pragma once
+#include <bts/blockchain/transaction.hpp>
+#include <bts/config.hpp>
+#include <fc/optional.hpp>
+#include <memory>
+
+namespace bts {
+
+  namespace detail { class transaction_pool_impl; }
+
+  /**
+   *  @brief Validated transactions waiting to be included in a block.
+   *
+   *  Transactions are indexed by fee per byte, by the outputs they spend and
+   *  by expire_block.  The pool never holds two transactions that spend the
+   *  same output: a newcomer replaces every transaction it conflicts with if
+   *  it pays a higher fee per byte than each of them and more fees than all
+   *  of them together, otherwise it is rejected.  This is what lets a bid or
+   *  ask be retracted by re-broadcasting it with a higher fee.
+   *
+   *  Once the packed transactions exceed max_bytes the lowest fee per byte
+   *  transactions are evicted.
+   *
+   *  A transaction that is replaced, evicted, expired or removed takes its
+   *  descendants, the pooled transactions that spend its outputs directly
+   *  or indirectly, with it because their inputs will never exist.
+   *
+   *  The pool does not validate transactions, callers add them with the fee
+   *  computed while checking them against the chain state.
+   */
+  class transaction_pool
+  {
+     public:
+        transaction_pool( uint64_t max_bytes = MAX_TRANSACTION_POOL_BYTES );
+        ~transaction_pool();
+
+        /**
+         *  @return false if trx is already in the pool, loses to a
+         *          conflicting transaction or does not pay enough to stay
+         *          in a full pool.
+         */
+        bool                              add( const cached_transaction& trx, uint64_t fee );
+        /** removes trx_id and its descendants */
+        void                              remove( const fc::sha224& trx_id );
+
+        /**
+         *  Removes the transactions of a new block and every pooled
+         *  transaction, with its descendants, that spends an output they
+         *  spent.  Children of the included transactions stay.
+         */
+        void                              remove_included( const std::vector<cached_transaction>& trxs );
+
+        /**
+         *  Removes transactions that can no longer be included in block
+         *  block_num and their descendants.
+         *
+         *  @return the number of transactions removed
+         */
+        uint32_t                          expire( uint32_t block_num );
+
+        /**
+         *  Picks transactions for a new block in order of decreasing fee per
+         *  byte, skipping those that do not fit in max_bytes.  A transaction
+         *  that spends outputs of pooled transactions becomes a candidate
+         *  once all of them were picked.  Candidates come from a sorted index
+         *  of transactions without pooled parents merged with a heap of
+         *  unlocked children, so examining k transactions costs O(k log n).
+         */
+        std::vector<cached_transaction>   select( uint64_t max_bytes )const;
+
+        fc::optional<cached_transaction>  get( const fc::sha224& trx_id )const;
+        bool                              contains( const fc::sha224& trx_id )const;
+        /** @return the id of the pooled transaction spending out, if any */
+        fc::optional<fc::sha224>          get_spender( const output_reference& out )const;
+
+        uint32_t                          size()const;
+        /** @return the packed size of all pooled transactions */
+        uint64_t                          bytes()const;
+
+     private:
+        std::unique_ptr<detail::transaction_pool_impl> my;
+  };
+
+} // namespace bts
@@ -0,0 +1,173 @@
+#pragma once
+#include <bts/blockchain/transaction.hpp>
+#include <fc/io/raw.hpp>
+#include <iterator>
+
+namespace bts {
+
+  /** bytes inside the buffer a view was parsed from */
+  struct packed_range
+  {
+     packed_range():data(nullptr),size(0){}
+     packed_range( const char* d, uint32_t s ):data(d),size(s){}
+
+     const char* data;
+     uint32_t    size;
+  };
+
+  namespace detail
+  {
+     /**
+      *  Reads an fc::unsigned_int and advances pos past it.
+      *
+      *  @throw if it runs past end or does not fit in 32 bits
+      */
+     uint32_t     read_packed_size( const char*& pos, const char* end );
+
+     /** reads a packed std::vector<char> and advances pos past it */
+     packed_range read_packed_bytes( const char*& pos, const char* end );
+  }
+
+  /**
+   *  A generic_trx_in or generic_trx_out inside a packed transaction: its
+   *  type and the packed bytes of the derived input or output.
+   */
+  struct packed_trx_field
+  {
+     packed_trx_field():type(0){}
+
+     uint8_t      type;
+     packed_range data;
+
+     /**
+      *  Unpacks the derived type, such as trx_input_by_address.  The input
+      *  and output types are fixed size so this does not allocate.
+      */
+     template<typename T>
+     T as()const
+     {
+        FC_ASSERT( type == T::type, "field of type ${t} is not a ${T}", ("t",type)("T",int(T::type)) );
+        fc::datastream<const char*> ds( data.data, data.size );
+        T t;
+        fc::raw::unpack( ds, t );
+        return t;
+     }
+  };
+
+  struct trx_input_view : public packed_trx_field
+  {
+     /** every input type starts with the trx_input it derives from */
+     output_reference output_ref()const;
+  };
+
+  struct trx_output_view : public packed_trx_field
+  {
+     /** every output type starts with the trx_output it derives from */
+     uint64_t         amount()const;
+  };
+
+  /**
+   *  Forward iterator over the fields of a section that was bounds checked
+   *  when the view was parsed.
+   */
+  template<typename Field>
+  class packed_field_iterator : public std::iterator<std::forward_iterator_tag,const Field>
+  {
+     public:
+        packed_field_iterator():_pos(nullptr),_end(nullptr){}
+        packed_field_iterator( const char* pos, const char* end )
+        :_pos(pos),_end(end){ parse(); }
+
+        const Field& operator*()const  { return _field; }
+        const Field* operator->()const { return &_field; }
+
+        packed_field_iterator& operator++()
+        {
+           _pos = _field.data.data + _field.data.size;
+           parse();
+           return *this;
+        }
+        packed_field_iterator operator++(int) { auto tmp = *this; ++*this; return tmp; }
+
+        bool operator==( const packed_field_iterator& o )const { return _pos == o._pos; }
+        bool operator!=( const packed_field_iterator& o )const { return _pos != o._pos; }
+
+     private:
+        void parse()
+        {
+           if( _pos == _end ) return;
+           const char* p = _pos;
+           _field.type   = uint8_t(*p++);
+           _field.data   = detail::read_packed_bytes( p, _end );
+        }
+
+        const char* _pos;
+        const char* _end;
+        Field       _field;
+  };
+
+  template<typename Field>
+  struct packed_fields
+  {
+     packed_fields():count(0),first(nullptr),last(nullptr){}
+     packed_fields( uint32_t c, const char* f, const char* l ):count(c),first(f),last(l){}
+
+     packed_field_iterator<Field> begin()const { return packed_field_iterator<Field>( first, last ); }
+     packed_field_iterator<Field> end()const   { return packed_field_iterator<Field>( last, last ); }
+     uint32_t                     size()const  { return count; }
+
+     uint32_t    count;
+     const char* first;
+     const char* last;
+  };
+
+  /**
+   *  @brief Read only access to a packed signed_transaction in place.
+   *
+   *  Construction walks the packed bytes once to find and bounds check the
+   *  inputs, outputs and signatures, nothing is copied or allocated.  The
+   *  view points into the buffer it was parsed from, which must outlive it.
+   *
+   *  A signed_transaction packs as the transaction followed by the
+   *  signatures, so the id is a hash of unsigned_bytes().
+   */
+  class transaction_view
+  {
+     public:
+        transaction_view();
+
+        /** @throw if data does not start with a complete packed signed_transaction */
+        transaction_view( const char* data, size_t size );
+
+        uint16_t                        version()const;
+        /** packed right after version() */
+        uint32_t                        expire_block()const;
+        packed_fields<trx_input_view>   inputs()const;
+        packed_fields<trx_output_view>  outputs()const;
+
+        uint32_t                        num_signatures()const;
+        fc::ecc::compact_signature      signature( uint32_t i )const;
+
+        /** the whole packed signed_transaction */
+        packed_range                    bytes()const;
+        /** the packed transaction without its signatures */
+        packed_range                    unsigned_bytes()const;
+        /** @return cached_transaction::calculate_id() without unpacking */
+        fc::sha224                      calculate_id()const;
+
+        signed_transaction              unpack()const;
+
+     private:
+        const char* _begin;
+        uint32_t    _num_inputs;
+        const char* _inputs;
+        const char* _inputs_end;
+        uint32_t    _num_outputs;
+        const char* _outputs;
+        const char* _outputs_end; ///< also the end of the unsigned transaction
+        uint32_t    _num_sigs;
+        const char* _sigs;
+        const char* _end;
+  };
+
+} // namespace bts
@@ -6,14 +6,26 @@
 #define BLOCKS_PER_HOUR               (60/BLOCK_INTERVAL)           
 #define BLOCKS_PER_DAY                (BLOCKS_PER_HOUR*24)
 #define BLOCKS_PER_YEAR               (BLOCKS_PER_DAY*365)
+#define REWARD_ADJUSTMENT_INTERVAL    (BLOCKS_PER_YEAR)   // blocks over which the block reward falls by half
 #define COINBASE_WAIT_PERIOD          (BLOCKS_PER_HOUR*8) // blocks before a coinbase can be spent
+#define MAX_BLOCK_SIZE                (1024*1024)         // bytes, larger blocks are rejected before checking proof of work
+#define MAX_BLOCK_CLOCK_DRIFT_SEC     (5*60)              // blocks more than this far in the future are rejected
+#define CHAIN_STATE_SNAPSHOT_INTERVAL (BLOCKS_PER_HOUR)   // blocks between chain state snapshots, bounds the replay on startup
+#define MAX_ORPHAN_BLOCKS             (BLOCKS_PER_HOUR*2) // blocks kept while waiting for an unknown previous block
+#define SIGNATURE_CACHE_SIZE          (64*1024)           // recovered signers remembered between relaying and including a transaction
+#define MAX_TRANSACTION_POOL_BYTES    (64*1024*1024)      // packed size of pending transactions kept, lowest fees are evicted first
+#define OUTPUT_POOL_SLAB_BYTES        (64*1024)           // outputs of one claim type are packed densely in slabs of this size
 #define DEFAULT_SERVER_PORT           (9876)
 #define DESIRED_PEER_COUNT            (8)                 // number of nodes to connect to
 #define BITCHAT_TARGET_BPS            (128*1024)          // 128 kbit / sec target data rate
 #define BITCHAT_BANDWIDTH_WINDOW_US   (5*60*1000*1000ll)  // 5 minutes
 #define BITCHAT_INVENTORY_WINDOW_SEC  (60)                // seconds to keep inventory items around
 #define DEFAULT_MINING_EFFORT_PERCENT (50)                // percent of CPU to use for mining
-#define DEFAULT_MINING_THREADS        (4)                 // number of mining threads to use
+#define DEFAULT_MINING_THREADS        (0)                 // number of mining threads to use, 0 for one per core
+#define MINING_SLICE_USEC             (5000)              // length of one uninterrupted burst of mining
+#define MINING_WINDOW_USEC            (2000000)           // window over which mining effort is enforced
+#define DEFAULT_MAX_POW_BUFFERS       (4)                 // number of 128 MB proof-of-work buffers kept resident
+#define DEFAULT_POW_MEMORY_BUDGET_MB  (512)               // scratch memory the proof-of-work service may use
 #define MIN_NAME_DIFFICULTY           (24)                // number if leeding 0 bits in double sha512 required to register a name
 #define PEER_HOST_CACHE_QUERY_LIMIT   (1000)              // number of ip/ports that we will cache
 #define MAX_CHANNELS_PER_CONNECTION   (32)
@@ -0,0 +1,67 @@
+#pragma once
+#include <bts/config.hpp>
+#include <fc/time.hpp>
+#include <deque>
+
+namespace bts {
+
+  /**
+   *  @brief Holds a thread to a fraction of wall clock time over a sliding window.
+   *
+   *  The worker records each slice of work it performs, after every slice
+   *  idle_time() reports how long it must sleep so that busy time divided by
+   *  elapsed time over the last window does not exceed the requested effort.
+   *  Keeping slices short (a few ms) and the window long (seconds) gives an
+   *  accurate average without the bursts of a fixed work/sleep split.
+   *
+   *  The same samples give the rate of work, in whatever unit the caller
+   *  counts, over the window.
+   *
+   *  Not thread safe, a worker thread usually owns one and a monitor reads it
+   *  under a lock.
+   */
+  class duty_cycle
+  {
+     public:
+        duty_cycle( fc::microseconds window = fc::microseconds(MINING_WINDOW_USEC) );
+
+        /** forgets all samples */
+        void             reset();
+
+        /**
+         *  Records that the thread was busy from start to end and completed
+         *  count units of work in that time.
+         */
+        void             record( const fc::time_point& start, const fc::time_point& end, uint64_t count );
+
+        /**
+         *  @param effort fraction of time the thread may be busy, values at or
+         *                above 1 never idle
+         *  @return how long to sleep before the next slice
+         */
+        fc::microseconds idle_time( float effort, const fc::time_point& now );
+
+        /** @return units of work per second of wall time over the window */
+        double           rate( const fc::time_point& now );
+
+        /** @return fraction of wall time spent busy over the window */
+        double           utilization( const fc::time_point& now );
+
+     private:
+        struct sample
+        {
+           fc::time_point start;
+           fc::time_point end;
+           uint64_t       count;
+        };
+
+        /** drops samples that ended before the window */
+        void             trim( const fc::time_point& now );
+
+        fc::microseconds    _window;
+        std::deque<sample>  _samples;
+        int64_t             _busy_us;
+        uint64_t            _count;
+  };
+
+} // namespace bts
@@ -0,0 +1,304 @@
+#pragma once
+#include <algorithm>
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <iterator>
+#include <random>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace bts
+{
+  /** finalizer of murmur3, spreads every input bit over the whole word */
+  inline uint64_t mix_hash_word( uint64_t h )
+  {
+     h ^= h >> 33;
+     h *= 0xff51afd7ed558ccdULL;
+     h ^= h >> 33;
+     h *= 0xc4ceb9fe1a85ec53ULL;
+     h ^= h >> 33;
+     return h;
+  }
+
+  /**
+   *  Random per process and mixed into every digest hash.  Message ids and
+   *  transaction ids are chosen by peers, without a secret seed they could
+   *  grind ids that land on one probe sequence of our tables.
+   */
+  inline uint64_t hash_seed()
+  {
+     static const uint64_t seed = []()
+     {
+        std::random_device rd;
+        return (uint64_t(rd()) << 32) | rd();
+     }();
+     return seed;
+  }
+
+  /**
+   *  Hashes a digest (sha224, sha256, mini_pow, ...) by reading its first 8
+   *  bytes.  Digests are already uniformly distributed so there is no need to
+   *  run them through CityHash again, the mix only makes up for the leading
+   *  byte of a mini_pow which counts leading zeros and spreads hash_seed().
+   */
+  template<typename K>
+  struct digest_hash
+  {
+     static_assert( std::is_trivially_copyable<K>::value, "digest keys are read as raw bytes" );
+     static_assert( sizeof(K) >= sizeof(uint64_t), "digest keys must be at least 8 bytes" );
+
+     size_t operator()( const K& k )const
+     {
+        uint64_t w;
+        memcpy( &w, &k, sizeof(w) );
+        return size_t( mix_hash_word( w ^ hash_seed() ) );
+     }
+  };
+
+  namespace detail
+  {
+     template<typename V>
+     struct flat_set_traits
+     {
+        typedef V key_type;
+        static const key_type& key( const V& v ) { return v; }
+     };
+
+     template<typename V>
+     struct flat_map_traits
+     {
+        typedef typename std::remove_const<typename V::first_type>::type key_type;
+        static const key_type& key( const V& v ) { return v.first; }
+     };
+
+     /**
+      *  Open addressing table with linear probing.  Slots live in one array
+      *  next to an array of one byte tags, the top 7 bits of the hash of a
+      *  full slot or one of the markers below, so a probe compares keys only
+      *  when the tags match and a miss usually stops at the first empty tag
+      *  without touching the slot array.
+      *
+      *  Erasing leaves a tombstone that is reused by the next insert along
+      *  the probe and dropped when the table is rehashed.  The table grows
+      *  once full slots plus tombstones pass 7/8 of the capacity.
+      */
+     template<typename V, typename Traits, typename Hash>
+     class flat_hash_table
+     {
+        public:
+          typedef typename Traits::key_type key_type;
+          typedef V                         value_type;
+
+          enum { empty_tag = 0, tombstone_tag = 1, min_capacity = 16 };
+
+          template<bool Const>
+          class iterator_base
+          {
+             public:
+               typedef std::forward_iterator_tag                                                        iterator_category;
+               typedef V                                                                                value_type;
+               typedef ptrdiff_t                                                                        difference_type;
+               typedef typename std::conditional<Const, const flat_hash_table*, flat_hash_table*>::type table_ptr;
+               typedef typename std::conditional<Const, const V&, V&>::type                           reference;
+               typedef typename std::conditional<Const, const V*, V*>::type                           pointer;
+
+               iterator_base():_table(nullptr),_pos(0){}
+               iterator_base( table_ptr t, size_t p ):_table(t),_pos(p){}
+
+               /** non const to const conversion */
+               template<bool C, typename = typename std::enable_if<Const && !C>::type>
+               iterator_base( const iterator_base<C>& i ):_table(i._table),_pos(i._pos){}
+
+               reference operator*()const  { return _table->_slots[_pos];  }
+               pointer   operator->()const { return &_table->_slots[_pos]; }
+
+               iterator_base& operator++()
+               {
+                  _pos = _table->next_full( _pos + 1 );
+                  return *this;
+               }
+               iterator_base operator++(int) { iterator_base tmp(*this); ++*this; return tmp; }
+
+               friend bool operator==( const iterator_base& a, const iterator_base& b ) { return a._pos == b._pos; }
+               friend bool operator!=( const iterator_base& a, const iterator_base& b ) { return a._pos != b._pos; }
+
+             private:
+               template<bool> friend class iterator_base;
+               friend class flat_hash_table;
+
+               table_ptr _table;
+               size_t    _pos;
+          };
+
+          typedef iterator_base<false> iterator;
+          typedef iterator_base<true>  const_iterator;
+
+          flat_hash_table():_size(0),_tombstones(0){}
+
+          size_t size()const  { return _size;      }
+          bool   empty()const { return _size == 0; }
+
+          iterator       begin()       { return iterator( this, next_full(0) );       }
+          const_iterator begin()const  { return const_iterator( this, next_full(0) ); }
+          iterator       end()         { return iterator( this, _tags.size() );       }
+          const_iterator end()const    { return const_iterator( this, _tags.size() ); }
+
+          iterator find( const key_type& k )
+          {
+             return iterator( this, find_pos( k ) );
+          }
+          const_iterator find( const key_type& k )const
+          {
+             return const_iterator( this, find_pos( k ) );
+          }
+          size_t count( const key_type& k )const { return find_pos( k ) != _tags.size(); }
+
+          std::pair<iterator,bool> insert( const V& v ) { return emplace_value( V(v) );         }
+          std::pair<iterator,bool> insert( V&& v )      { return emplace_value( std::move(v) ); }
+
+          size_t erase( const key_type& k )
+          {
+             size_t p = find_pos( k );
+             if( p == _tags.size() ) return 0;
+             erase_pos( p );
+             return 1;
+          }
+          iterator erase( const_iterator itr )
+          {
+             erase_pos( itr._pos );
+             return iterator( this, next_full( itr._pos + 1 ) );
+          }
+
+          void clear()
+          {
+             _tags.clear();
+             _slots.clear();
+             _size = _tombstones = 0;
+          }
+
+          /** makes room for n elements without rehashing */
+          void reserve( size_t n )
+          {
+             size_t cap = min_capacity;
+             while( cap - cap / 8 <= n ) cap *= 2;
+             if( cap > _tags.size() ) rehash( cap );
+          }
+
+        protected:
+          static uint8_t tag_of( size_t h ) { return uint8_t( 0x80 | (uint64_t(h) >> 57) ); }
+
+          size_t next_full( size_t p )const
+          {
+             while( p < _tags.size() && _tags[p] < 0x80 ) ++p;
+             return p;
+          }
+
+          /** @return the slot holding k or _tags.size() */
+          size_t find_pos( const key_type& k )const
+          {
+             if( _size == 0 ) return _tags.size();
+             const size_t  h    = _hash( k );
+             const uint8_t tag  = tag_of( h );
+             const size_t  mask = _tags.size() - 1;
+             for( size_t p = h & mask; ; p = (p + 1) & mask )
+             {
+                if( _tags[p] == tag && Traits::key( _slots[p] ) == k ) return p;
+                if( _tags[p] == empty_tag ) return _tags.size();
+             }
+          }
+
+          std::pair<iterator,bool> emplace_value( V&& v )
+          {
+             size_t p = find_pos( Traits::key(v) );
+             if( p != _tags.size() ) return std::make_pair( iterator( this, p ), false );
+
+             if( _tags.empty() || (_size + _tombstones + 1) > _tags.size() - _tags.size() / 8 )
+             {
+                // only grow when the tombstones are not what fills the table
+                rehash( _size + 1 > _tags.size() / 2 || _tags.empty() ? std::max<size_t>( min_capacity, _tags.size() * 2 )
+                                                                     : _tags.size() );
+             }
+             p = place( std::move(v) );
+             return std::make_pair( iterator( this, p ), true );
+          }
+
+          /** @pre the key of v is not in the table and there is a free slot */
+          size_t place( V&& v )
+          {
+             const size_t h    = _hash( Traits::key(v) );
+             const size_t mask = _tags.size() - 1;
+             size_t p = h & mask;
+             while( _tags[p] >= 0x80 ) p = (p + 1) & mask;
+             if( _tags[p] == tombstone_tag ) --_tombstones;
+             _tags[p]  = tag_of( h );
+             _slots[p] = std::move(v);
+             ++_size;
+             return p;
+          }
+
+          void erase_pos( size_t p )
+          {
+             _tags[p]  = tombstone_tag;
+             _slots[p] = V(); // release whatever the value owns now
+             --_size;
+             ++_tombstones;
+          }
+
+          void rehash( size_t cap )
+          {
+             std::vector<uint8_t> old_tags( cap, uint8_t(empty_tag) );
+             std::vector<V>       old_slots( cap );
+             old_tags.swap( _tags );
+             old_slots.swap( _slots );
+             _size = _tombstones = 0;
+             for( size_t i = 0; i < old_tags.size(); ++i )
+             {
+                if( old_tags[i] >= 0x80 ) place( std::move( old_slots[i] ) );
+             }
+          }
+
+          std::vector<uint8_t> _tags;
+          std::vector<V>       _slots;
+          size_t               _size;
+          size_t               _tombstones;
+          Hash                 _hash;
+     };
+  } // namespace detail
+
+  /**
+   *  @brief Drop in replacement for std::unordered_set keyed by a digest.
+   *
+   *  Keeps the keys in one flat array instead of one heap node per key,
+   *  which matters for the inventories of every connection.  Iterators and
+   *  references are invalidated by any insert.
+   */
+  template<typename K, typename Hash = digest_hash<K> >
+  class flat_hash_set : public detail::flat_hash_table<K, detail::flat_set_traits<K>, Hash>
+  {
+  };
+
+  /**
+   *  @brief Drop in replacement for std::unordered_map keyed by a digest.
+   *
+   *  Unlike std::unordered_map the value_type is std::pair<K,T> with a non
+   *  const key, the key must not be modified through an iterator.  T must be
+   *  default constructible.  Iterators and references are invalidated by any
+   *  insert, including operator[] on a missing key.
+   */
+  template<typename K, typename T, typename Hash = digest_hash<K> >
+  class flat_hash_map : public detail::flat_hash_table<std::pair<K,T>, detail::flat_map_traits<std::pair<K,T> >, Hash>
+  {
+     public:
+       typedef T mapped_type;
+
+       T& operator[]( const K& k )
+       {
+          auto itr = this->find( k );
+          if( itr != this->end() ) return itr->second;
+          return this->emplace_value( std::pair<K,T>( k, T() ) ).first->second;
+       }
+  };
+
+} // namespace bts
@@ -7,6 +7,10 @@ namespace bts {
   /**
    *  Provides a merkle branch that proves a hash was
    *  included in the root.
+   *
+   *  mid_states[0] is the leaf, followed by its sibling on every level
+   *  up to the root, bit i of branch is set if the node on level i is a
+   *  right child.
    */
   struct merkle_branch
   {
@@ -22,38 +26,53 @@ namespace bts {
   /**
    *  Maintains a merkle tree as updates are made via
    *  get/set.
+   *
+   *  set() only marks the leaf dirty, update_root() then rehashes the
+   *  paths from every dirty leaf to the root once, so a batch of k changes
+   *  costs O(k log n) hashes and changes that share a path share the work.
+   *
+   *  An odd node at the end of a level is paired with a null hash.
    */
   struct merkle_tree
   {
        void     resize( uint64_t s );
-       uint64_t size();
+       uint64_t size()const;
 
        /** 
-        *  Updates all hashes in the merkle branch to index.
-        *  @throw out_of_range_exception if index > size
+        *  Marks the branch to index as dirty.
+        *  @throw out_of_range_exception if index >= size
         */
        void       set( uint64_t index, const fc::sha224& val );
 
        /**
-        *  @throw out_of_range_exception if index > size
+        *  @throw out_of_range_exception if index >= size
         */
-       fc::sha224 get( uint32_t index );
+       fc::sha224 get( uint64_t index )const;
 
        /**
+        *  Rehashes every branch changed since the last call.
+        *
+        *  @return mroot
+        */
+       const fc::sha224& update_root();
+
+       /**
+        *  @pre update_root() was called after the last change
         *  @return the full merkle branch for the tree.
         */
        merkle_branch get_branch( uint32_t index )const;
+
+       static fc::sha224 hash_pair( const fc::sha224& left, const fc::sha224& right );
     
        /**
         *  @note do not modify this field directly, it will
-        *        automatically be updated after every call to
-        *        set / get.
+        *        automatically be updated by update_root()
         */
        fc::sha224                                mroot;
 
        /**
         *  mtree[0] is the leef layer of the tree
-        *  mtree[mtree.size()-1].size() should always be 2
+        *  mtree[mtree.size()-1].size() is always 1, the root
         *
         *  @note only modify this via get/set to keep the
         *        struture accurate.  This is public for
@@ -63,6 +82,9 @@ namespace bts {
         *              members.
         */
        std::vector< std::vector < fc::sha224 > > mtree;
+
+       /** leaves changed since the last update_root(), not serialized */
+       std::vector<uint64_t>                     dirty;
   };
 
 } 
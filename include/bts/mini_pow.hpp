@@ -1,6 +1,7 @@
 #pragma once
 #include <fc/array.hpp>
 #include <fc/crypto/bigint.hpp>
+#include <stdint.h>
 
 namespace fc { class sha512; }
 
@@ -63,6 +64,13 @@ namespace bts
   mini_pow   mini_pow_hash( const char* data, size_t len );
   mini_pow   mini_pow_hash( const fc::sha512& seed );
 
+  /**
+   *  Calculates mini_pow_hash() of n messages of the same length at once
+   *  with the multi-buffer sha512 kernel, n may be at most sha512_max_lanes.
+   *  Used by miners to test a batch of nonces per call.
+   */
+  void       mini_pow_hash( const char* const* data, size_t len, uint32_t n, mini_pow* out );
+
   /**
    *  Converts the POW to a bigint so that operations may
    *  be performed on it.
@@ -0,0 +1,64 @@
+#pragma once
+#include <bts/config.hpp>
+#include <fc/thread/thread.hpp>
+#include <memory>
+
+namespace bts {
+
+  namespace detail { class mining_pool_impl; }
+
+  /**
+   *  @brief Threads dedicated to mining, optionally pinned one per core.
+   *
+   *  The pool only owns the threads, each miner schedules its own long
+   *  running search on at(i) for every i below size() and stops it by its
+   *  own means (usually by bumping a version number the search checks).
+   *
+   *  Shrinking the pool never destroys a thread, threads beyond size() are
+   *  parked and reused when the pool grows again, so a resize is safe even
+   *  while work started before it is still winding down.  Miners should
+   *  read size() each time they start work.
+   *
+   *  A pool may be shared between the name miner and the block miner, the
+   *  searches then take turns on each thread whenever one of them idles.
+   *
+   *  All methods must be called from the same thread.
+   */
+  class mining_pool
+  {
+     public:
+        struct config
+        {
+           config()
+           :threads(DEFAULT_MINING_THREADS),pin_threads(false){}
+
+           /** 0 for default_thread_count() */
+           uint32_t threads;
+           /** pins thread i to cpu i modulo the number of cpus, linux only */
+           bool     pin_threads;
+        };
+
+        mining_pool( const config& c = config() );
+        ~mining_pool();
+
+        /** @return std::thread::hardware_concurrency(), or 1 if unknown */
+        static uint32_t default_thread_count();
+
+        /** @param n 0 for default_thread_count() */
+        void        resize( uint32_t n );
+        uint32_t    size()const;
+        bool        pinned()const;
+
+        /** @pre i < size() */
+        fc::thread& at( uint32_t i );
+
+     private:
+        std::unique_ptr<detail::mining_pool_impl> my;
+  };
+
+  typedef std::shared_ptr<mining_pool> mining_pool_ptr;
+
+} // namespace bts
+
+#include <fc/reflect/reflect.hpp>
+FC_REFLECT( bts::mining_pool::config, (threads)(pin_threads) )
@@ -1,5 +1,6 @@
 #pragma once
 #include <bts/mini_pow.hpp>
+#include <fc/time.hpp>
 
 namespace bts { namespace network {
   
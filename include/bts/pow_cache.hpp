@@ -0,0 +1,41 @@
+#pragma once
+#include <bts/proof_of_work.hpp>
+#include <fc/filesystem.hpp>
+#include <fc/optional.hpp>
+
+namespace bts {
+
+  namespace detail { class pow_cache_impl; }
+
+  /**
+   *  Remembers the result of proof_of_work() for inputs that have already
+   *  been verified so that duplicate announcements of a block and blocks
+   *  reloaded after a restart cost a database lookup rather than another
+   *  pass over 128 MB of scratch memory.
+   *
+   *  Entries are keyed by the proof_of_work() input (the digest of the block
+   *  header) and are only ever stored after the hash has been computed
+   *  locally, met the target and the block was linked into the chain, so
+   *  the cache grows with the block log rather than with what peers send.
+   */
+  class pow_cache
+  {
+     public:
+        pow_cache();
+        ~pow_cache();
+
+        void open( const fc::path& db_dir, bool create = true );
+        void close();
+
+        /**
+         *  @return the cached result for in, or an empty optional if it
+         *          is not known.
+         */
+        fc::optional<pow_hash> fetch( const fc::sha256& in )const;
+        void                   store( const fc::sha256& in, const pow_hash& out );
+
+     private:
+        std::unique_ptr<detail::pow_cache_impl> my;
+  };
+
+} // namespace bts
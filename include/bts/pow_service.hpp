@@ -0,0 +1,73 @@
+#pragma once
+#include <bts/proof_of_work.hpp>
+#include <bts/config.hpp>
+#include <fc/thread/future.hpp>
+#include <memory>
+
+namespace bts {
+
+  namespace detail { class pow_service_impl; }
+
+  /**
+   *  Requests with a lower value are always started before requests with
+   *  a higher value, requests of the same priority are started in the order
+   *  they were submitted.
+   *
+   *  Only main chain blocks use proof_of_work(), the name chain and
+   *  bitchat use the much cheaper mini_pow_hash() and do not go through
+   *  the service.
+   */
+  enum pow_priority
+  {
+     chain_block_priority  = 0  ///< blocks on the main chain
+  };
+
+  /**
+   *  @brief Evaluates proof_of_work() on a bounded set of worker threads.
+   *
+   *  Each worker owns one 128 MB scratch buffer leased from the pow_buffer
+   *  pool, so the number of workers (and therefore the number of hashes that
+   *  can be in flight at once) is derived from the configured memory budget.
+   *  Requests that arrive while every worker is busy wait in a queue ordered
+   *  by pow_priority.
+   *
+   *  The memory-hard hash never runs on the calling thread, a caller on the
+   *  network thread only blocks its own task while waiting on the result.
+   *
+   *  All methods must be called from the thread that created the service,
+   *  calls from other threads are forwarded to it.
+   */
+  class pow_service
+  {
+     public:
+        struct config
+        {
+           config()
+           :memory_budget_mb(DEFAULT_POW_MEMORY_BUDGET_MB){}
+
+           /** at least one worker is always created */
+           uint64_t memory_budget_mb;
+        };
+
+        pow_service( const config& c = config() );
+        ~pow_service();
+
+        fc::future<mini_pow> submit( const fc::sha256& in, pow_priority p );
+
+        /** @return the number of hashes that may be evaluated at once */
+        uint32_t             worker_count()const;
+
+        /** @return the number of requests waiting for a free worker */
+        uint32_t             pending_count()const;
+
+     private:
+        std::unique_ptr<detail::pow_service_impl> my;
+  };
+
+  typedef std::shared_ptr<pow_service> pow_service_ptr;
+
+} // namespace bts
+
+#include <fc/reflect/reflect.hpp>
+FC_REFLECT( bts::pow_service::config, (memory_budget_mb) )
+FC_REFLECT_ENUM( bts::pow_priority, (chain_block_priority) )
@@ -1,22 +1,111 @@
 #pragma once
 #include <fc/crypto/sha256.hpp>
 #include <bts/mini_pow.hpp>
+#include <fc/time.hpp>
+#include <functional>
 
 namespace bts {
 
     /** typedef to the same size */
     typedef mini_pow pow_hash;
 
+    /**
+     *  A lease on one of the 128 MB scratch buffers required by proof_of_work().
+     *
+     *  Buffers are drawn from a process wide pool and returned to it when the
+     *  lease is destroyed so that the pages remain resident (already faulted in)
+     *  for the next caller.  If the pool is empty a new buffer is allocated, and
+     *  if more than get_max_pow_buffers() buffers are idle when a lease is
+     *  released the extra memory is freed.
+     *
+     *  A lease may be moved but not copied.
+     */
+    class pow_buffer
+    {
+       public:
+          pow_buffer();
+          pow_buffer( pow_buffer&& b );
+          ~pow_buffer();
+
+          pow_buffer& operator=( pow_buffer&& b );
+
+          unsigned char* data()const { return _data; }
+
+       private:
+          pow_buffer( const pow_buffer& );
+          pow_buffer& operator=( const pow_buffer& );
+
+          unsigned char* _data;
+    };
+
+    /**
+     *  Sets the maximum number of idle 128 MB buffers that the pool will keep
+     *  resident, defaults to DEFAULT_MAX_POW_BUFFERS.  Reducing the limit frees
+     *  any idle buffers above the new limit immediately.
+     */
+    void     set_max_pow_buffers( uint32_t max_idle );
+    uint32_t get_max_pow_buffers();
+
+    /**
+     *  Describes the kind of pages backing the proof-of-work scratch buffers.
+     */
+    enum pow_memory_mode
+    {
+       standard_pages,         ///< regular 4 KB pages
+       transparent_huge_pages, ///< regular pages with an madvise(MADV_HUGEPAGE) hint
+       explicit_huge_pages     ///< reserved huge pages via MAP_HUGETLB
+    };
+
+    /**
+     *  Probes the system the first time it is called and logs which mode
+     *  is active, call this at startup to report the mode early.
+     */
+    pow_memory_mode get_pow_memory_mode();
+
     /**
      *  The purpose of this method is to generate a determinstic proof-of-work
-     *  that cannot be optimized via ASIC or extreme parallelism. 
+     *  that cannot be optimized via ASIC or extreme parallelism.
      *
      *  @param in           - initial hash
      *  @param buffer_128m  - 128 MB buffer used for scratch space.
      *  @return processed hash after doing proof of work.
      */
     mini_pow proof_of_work( const fc::sha256& in, unsigned char* buffer_128m );
+
+    /**
+     *  Leases a buffer from the pool for the duration of the call.
+     */
     mini_pow proof_of_work( const fc::sha256& in );
 
+    /**
+     *  Wall time spent in each phase of one proof_of_work() evaluation.
+     */
+    struct pow_timings
+    {
+       fc::microseconds sfmt_fill;    ///< seeding and filling the buffer
+       fc::microseconds random_swaps; ///< the 1024 data dependent swaps
+       fc::microseconds city_hash;    ///< city_hash_crc_128 over the buffer
+       fc::microseconds final_hash;   ///< mini_pow_hash of the city hash
+    };
+
+    /**
+     *  Same result as proof_of_work( in, buffer_128m ), additionally timing
+     *  each phase for benchmarks.
+     */
+    mini_pow proof_of_work( const fc::sha256& in, unsigned char* buffer_128m, pow_timings& t );
+
+    /**
+     *  Same result as proof_of_work( in, buffer_128m ) unless canceled()
+     *  returns true between two phases, in which case the evaluation is
+     *  abandoned.  Lets a miner drop a stale block without finishing the
+     *  remaining passes over the buffer.
+     *
+     *  @return false if canceled, otherwise true with the result in out
+     */
+    bool     proof_of_work( const fc::sha256& in, unsigned char* buffer_128m,
+                            const std::function<bool()>& canceled, mini_pow& out );
+
 }
 
+#include <fc/reflect/reflect.hpp>
+FC_REFLECT_ENUM( bts::pow_memory_mode, (standard_pages)(transparent_huge_pages)(explicit_huge_pages) )
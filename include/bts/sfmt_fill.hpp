@@ -0,0 +1,39 @@
+#pragma once
+#include <SFMT.h>
+
+namespace bts {
+
+    /**
+     *  Identifies the implementation used by sfmt_fill().
+     */
+    enum sfmt_fill_kernel
+    {
+       sfmt_reference_kernel, ///< vendor sfmt_fill_array64()
+       sfmt_sse2_kernel,      ///< 128 bit recursion with streaming stores
+       sfmt_avx2_kernel       ///< two recursions per 256 bit step with streaming stores
+    };
+
+    /**
+     *  Produces exactly the same output and final generator state as
+     *  sfmt_fill_array64() from the vendor library using the fastest kernel
+     *  supported by the CPU.
+     *
+     *  The first call probes the CPU and runs each candidate kernel against
+     *  the reference generator, a kernel that does not reproduce the reference
+     *  output bit for bit is never selected.
+     *
+     *  @param size number of 64 bit words to generate, must be even and
+     *              at least SFMT_N64
+     */
+    void             sfmt_fill( sfmt_t* gen, uint64_t* array, uint64_t size );
+
+    /**
+     *  Selects and self-tests the kernel if that has not happened yet, call
+     *  this at startup to report the kernel early.
+     */
+    sfmt_fill_kernel get_sfmt_fill_kernel();
+
+}
+
+#include <fc/reflect/reflect.hpp>
+FC_REFLECT_ENUM( bts::sfmt_fill_kernel, (sfmt_reference_kernel)(sfmt_sse2_kernel)(sfmt_avx2_kernel) )
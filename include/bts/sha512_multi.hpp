@@ -0,0 +1,43 @@
+#pragma once
+#include <fc/crypto/sha512.hpp>
+#include <stdint.h>
+
+namespace bts {
+
+    /**
+     *  Identifies the implementation used by sha512_multi().
+     */
+    enum sha512_multi_kernel
+    {
+       sha512_scalar_kernel, ///< one fc::sha512::hash() per message
+       sha512_avx2_kernel,   ///< four messages per 256 bit lane group
+       sha512_avx512_kernel  ///< eight messages per 512 bit lane group
+    };
+
+    enum { sha512_max_lanes = 8 };
+
+    /**
+     *  Hashes n messages of the same length at once, out[i] is identical to
+     *  fc::sha512::hash( msgs[i], len ).
+     *
+     *  Used where many short messages that differ only in a few bytes (such
+     *  as consecutive nonces of a header being mined) need to be hashed, the
+     *  vector kernels run one message per 64 bit lane.
+     *
+     *  The first call probes the CPU and checks each candidate kernel against
+     *  fc::sha512, a kernel that does not reproduce it is never selected.
+     *
+     *  @param n must be between 1 and sha512_max_lanes, calls with fewer than
+     *           sha512_multi_lanes() messages cost as much as a full batch.
+     */
+    void                sha512_multi( const char* const* msgs, size_t len, uint32_t n, fc::sha512* out );
+
+    /** @return the number of messages hashed in parallel by the selected kernel */
+    uint32_t            sha512_multi_lanes();
+
+    sha512_multi_kernel get_sha512_multi_kernel();
+
+}
+
+#include <fc/reflect/reflect.hpp>
+FC_REFLECT_ENUM( bts::sha512_multi_kernel, (sha512_scalar_kernel)(sha512_avx2_kernel)(sha512_avx512_kernel) )
@@ -0,0 +1,52 @@
+#pragma once
+#include <bts/address.hpp>
+#include <bts/config.hpp>
+#include <fc/crypto/elliptic.hpp>
+#include <fc/crypto/sha256.hpp>
+#include <fc/optional.hpp>
+#include <memory>
+
+namespace bts {
+
+  namespace detail { class signature_cache_impl; }
+
+  /**
+   *  @brief Remembers the address recovered from (digest, signature) pairs.
+   *
+   *  A transaction is verified when it is first relayed and again when it
+   *  is included in a block, with the cache the second check costs a hash
+   *  lookup instead of a public key recovery.
+   *
+   *  Entries are keyed by a hash of a random per-process salt, the digest
+   *  and the signature so that peers cannot craft collisions or predict
+   *  which entries evict each other.  Once max_entries is reached the
+   *  oldest entry is evicted first.
+   *
+   *  All methods are thread safe.
+   */
+  class signature_cache
+  {
+     public:
+        signature_cache( uint32_t max_entries = SIGNATURE_CACHE_SIZE );
+        ~signature_cache();
+
+        fc::optional<address> fetch( const fc::sha256& digest, const fc::ecc::compact_signature& sig )const;
+        void                  store( const fc::sha256& digest, const fc::ecc::compact_signature& sig, const address& a );
+
+        /**
+         *  @return the cached signer or recovers and caches it
+         *  @throw  if public key recovery fails, failures are not cached
+         */
+        address               recover( const fc::sha256& digest, const fc::ecc::compact_signature& sig );
+
+        uint32_t              size()const;
+        void                  clear();
+
+     private:
+        std::unique_ptr<detail::signature_cache_impl> my;
+  };
+
+  /** @return the cache shared by transaction and block validation */
+  signature_cache& get_signature_cache();
+
+} // namespace bts
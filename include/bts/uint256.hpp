@@ -0,0 +1,231 @@
+#pragma once
+#include <bts/mini_pow.hpp>
+#include <fc/exception/exception.hpp>
+#include <stdint.h>
+#include <string.h>
+
+namespace bts
+{
+  /**
+   *  @brief Fixed width 256 bit unsigned integer for difficulty math.
+   *
+   *  A mini_pow is an 80 bit big endian number, averaging, scaling and
+   *  weighting them never needs more than 256 bits so there is no reason to
+   *  pay for the heap allocations of fc::bigint.  Values are stored on the
+   *  stack as eight 32 bit limbs, least significant limb first.  Addition,
+   *  subtraction and multiplication wrap modulo 2^256.
+   *
+   *  Division by a value that fits in 32 bits (the common case of dividing by
+   *  a count, a time window or a fixed point scale) takes a single pass over
+   *  the limbs, other divisors fall back to shift and subtract.
+   */
+  class uint256
+  {
+     public:
+       enum { num_limbs = 8 };
+
+       uint256( uint64_t v = 0 )
+       {
+          memset( limbs, 0, sizeof(limbs) );
+          limbs[0] = uint32_t(v);
+          limbs[1] = uint32_t(v >> 32);
+       }
+
+       bool is_zero()const
+       {
+          for( uint32_t i = 0; i < num_limbs; ++i ) if( limbs[i] ) return false;
+          return true;
+       }
+
+       /** @return the number of significant bits, 0 for 0 */
+       uint32_t bits()const
+       {
+          for( int32_t i = num_limbs - 1; i >= 0; --i )
+          {
+             if( limbs[i] )
+             {
+                uint32_t b = 32;
+                while( !(limbs[i] & (1u << (b-1))) ) --b;
+                return 32*i + b;
+             }
+          }
+          return 0;
+       }
+
+       uint256& operator += ( const uint256& b )
+       {
+          uint64_t carry = 0;
+          for( uint32_t i = 0; i < num_limbs; ++i )
+          {
+             carry   += uint64_t(limbs[i]) + b.limbs[i];
+             limbs[i] = uint32_t(carry);
+             carry  >>= 32;
+          }
+          return *this;
+       }
+
+       uint256& operator -= ( const uint256& b )
+       {
+          int64_t borrow = 0;
+          for( uint32_t i = 0; i < num_limbs; ++i )
+          {
+             int64_t d = int64_t(limbs[i]) - b.limbs[i] - borrow;
+             borrow    = d < 0;
+             limbs[i]  = uint32_t(d);
+          }
+          return *this;
+       }
+
+       uint256& operator *= ( const uint256& b )
+       {
+          uint32_t r[num_limbs];
+          memset( r, 0, sizeof(r) );
+          for( uint32_t i = 0; i < num_limbs; ++i )
+          {
+             if( !limbs[i] ) continue;
+             uint64_t carry = 0;
+             for( uint32_t j = 0; i + j < num_limbs; ++j )
+             {
+                carry   += uint64_t(limbs[i]) * b.limbs[j] + r[i+j];
+                r[i+j]   = uint32_t(carry);
+                carry  >>= 32;
+             }
+          }
+          memcpy( limbs, r, sizeof(limbs) );
+          return *this;
+       }
+
+       /**
+        *  @throw if d is 0
+        */
+       uint256& operator /= ( const uint256& d )
+       {
+          FC_ASSERT( !d.is_zero(), "division by zero" );
+          if( d.bits() <= 32 )
+          {
+             uint64_t rem = 0;
+             for( int32_t i = num_limbs - 1; i >= 0; --i )
+             {
+                uint64_t cur = (rem << 32) | limbs[i];
+                limbs[i] = uint32_t( cur / d.limbs[0] );
+                rem      = cur % d.limbs[0];
+             }
+             return *this;
+          }
+
+          uint256 q, r;
+          for( int32_t i = bits() - 1; i >= 0; --i )
+          {
+             r <<= 1;
+             r.limbs[0] |= (limbs[i/32] >> (i%32)) & 1;
+             if( !(r < d) )
+             {
+                r -= d;
+                q.limbs[i/32] |= 1u << (i%32);
+             }
+          }
+          return *this = q;
+       }
+
+       uint256& operator <<= ( uint32_t s )
+       {
+          if( s >= 32*num_limbs ) return *this = uint256();
+          uint32_t limb_shift = s / 32;
+          uint32_t bit_shift  = s % 32;
+          for( int32_t i = num_limbs - 1; i >= 0; --i )
+          {
+             uint64_t v = 0;
+             if( i - int32_t(limb_shift) >= 0 )
+             {
+                v = uint64_t(limbs[i-limb_shift]) << bit_shift;
+                if( bit_shift && i - int32_t(limb_shift) - 1 >= 0 )
+                   v |= limbs[i-limb_shift-1] >> (32 - bit_shift);
+             }
+             limbs[i] = uint32_t(v);
+          }
+          return *this;
+       }
+
+       uint256& operator >>= ( uint32_t s )
+       {
+          if( s >= 32*num_limbs ) return *this = uint256();
+          uint32_t limb_shift = s / 32;
+          uint32_t bit_shift  = s % 32;
+          for( uint32_t i = 0; i < num_limbs; ++i )
+          {
+             uint64_t v = 0;
+             if( i + limb_shift < num_limbs )
+             {
+                v = limbs[i+limb_shift] >> bit_shift;
+                if( bit_shift && i + limb_shift + 1 < num_limbs )
+                   v |= uint64_t(limbs[i+limb_shift+1]) << (32 - bit_shift);
+             }
+             limbs[i] = uint32_t(v);
+          }
+          return *this;
+       }
+
+       friend uint256 operator + ( uint256 a, const uint256& b ) { return a += b; }
+       friend uint256 operator - ( uint256 a, const uint256& b ) { return a -= b; }
+       friend uint256 operator * ( uint256 a, const uint256& b ) { return a *= b; }
+       friend uint256 operator / ( uint256 a, const uint256& b ) { return a /= b; }
+       friend uint256 operator << ( uint256 a, uint32_t s )      { return a <<= s; }
+       friend uint256 operator >> ( uint256 a, uint32_t s )      { return a >>= s; }
+
+       friend bool operator < ( const uint256& a, const uint256& b )
+       {
+          for( int32_t i = num_limbs - 1; i >= 0; --i )
+          {
+             if( a.limbs[i] != b.limbs[i] ) return a.limbs[i] < b.limbs[i];
+          }
+          return false;
+       }
+       friend bool operator >  ( const uint256& a, const uint256& b ) { return b < a;    }
+       friend bool operator <= ( const uint256& a, const uint256& b ) { return !(b < a); }
+       friend bool operator >= ( const uint256& a, const uint256& b ) { return !(a < b); }
+       friend bool operator == ( const uint256& a, const uint256& b )
+       {
+          return memcmp( a.limbs, b.limbs, sizeof(a.limbs) ) == 0;
+       }
+       friend bool operator != ( const uint256& a, const uint256& b ) { return !(a == b); }
+
+       uint32_t limbs[num_limbs];
+  };
+
+  /**
+   *  Interprets p as an 80 bit big endian number.
+   */
+  inline uint256 to_uint256( const mini_pow& p )
+  {
+     uint256 r;
+     const unsigned char* d = (const unsigned char*)p.data;
+     for( uint32_t i = 0; i < sizeof(p); ++i )
+     {
+        uint32_t bit = 8 * (sizeof(p) - 1 - i);
+        r.limbs[bit/32] |= uint32_t(d[i]) << (bit%32);
+     }
+     return r;
+  }
+
+  /**
+   *  Converts i back to an 80 bit big endian number, values too large to be
+   *  represented saturate to the largest (easiest) mini_pow.
+   */
+  inline mini_pow to_mini_pow( const uint256& i )
+  {
+     mini_pow p;
+     if( i.bits() > 8*sizeof(p) )
+     {
+        memset( p.data, 0xff, sizeof(p) );
+        return p;
+     }
+     unsigned char* d = (unsigned char*)p.data;
+     for( uint32_t b = 0; b < sizeof(p); ++b )
+     {
+        uint32_t bit = 8 * (sizeof(p) - 1 - b);
+        d[b] = uint8_t( i.limbs[bit/32] >> (bit%32) );
+     }
+     return p;
+  }
+
+} // namespace bts
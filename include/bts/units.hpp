@@ -28,6 +28,16 @@ struct bond_type
    unit_type  backing_type;
 };
 
+inline bool operator==( const bond_type& a, const bond_type& b )
+{
+   return a.issue_type == b.issue_type && a.backing_type == b.backing_type;
+}
+inline bool operator!=( const bond_type& a, const bond_type& b ) { return !(a==b); }
+inline bool operator<( const bond_type& a, const bond_type& b )
+{
+   return a.issue_type < b.issue_type || (a.issue_type == b.issue_type && a.backing_type < b.backing_type);
+}
+
 } // namespace bts
 
 FC_REFLECT_ENUM( bts::unit_type, 
@@ -1,6 +1,4 @@
 #include "account.hpp"
-#include "wallet.hpp"
-#include "meta.hpp"
 #include <fc/io/json.hpp>
 #include <fc/io/fstream.hpp>
 #include <fc/filesystem.hpp>
@@ -15,12 +13,16 @@
  */
 struct account_file
 {
-   fc::string                      name;
-   std::vector<address>            free_addresses;
-   std::unordered_set<address>     used_addresses;
+   account_file():next_key(0){}
+
+   fc::string                          name;
+   fc::optional<fc::ecc::public_key>   master_key;
+   uint32_t                            next_key;   ///< index of the next wallet key to reserve
+   std::vector<bts::address>           free_addresses;
+   std::unordered_set<bts::address>    used_addresses;
 };
 
-FC_REFLECT( account_file, (name)(free_addresses)(used_addresses) )
+FC_REFLECT( account_file, (name)(master_key)(next_key)(free_addresses)(used_addresses) )
 
 namespace detail 
 {
@@ -29,9 +31,8 @@ namespace detail
    {
       public:
          fc::path                                          _account_dir;
-         fc::path                                          _wallet_file;
          fc::path                                          _account_file;
-         wallet                                            _wallet;
+         bts::wallet                                       _wallet;
          account_file                                      _account;
    };
 
@@ -49,7 +50,6 @@ account::~account(){}
 void account::load( const fc::path& account_dir, account::open_mode m )
 {
     my->_account_file = account_dir / "account.bsaj";
-    my->_wallet_file  = account_dir / "wallet.dat";
     if( !fc::exists( account_dir )  ) 
     {
        if( m != create )
@@ -60,6 +60,8 @@ void account::load( const fc::path& account_dir, account::open_mode m )
     }
     if( fc::exists( my->_account_file ) ) 
        my->_account = fc::json::from_file<account_file>( my->_account_file );
+    if( my->_account.master_key )
+       my->_wallet.set_master_public_key( *my->_account.master_key );
 }
 
 void account::set_name( const std::string& name )
@@ -90,41 +92,43 @@ void account::save()
 }
 
 
-wallet& account::get_wallet() 
+bts::wallet& account::get_wallet() 
 { 
     return my->_wallet; 
 }
 
-wallet& account::load_wallet(const std::string& pass ) 
+bts::wallet& account::load_wallet(const std::string& pass ) 
 { 
-    if( fc::exists( my->_wallet_file ) )
+    my->_wallet.set_seed( fc::sha256::hash( pass.c_str(), pass.size() ) );
+
+    auto master = my->_wallet.get_master_public_key();
+    if( my->_account.master_key && my->_account.master_key->serialize() != master.serialize() )
     {
-        my->_wallet.load( my->_wallet_file, pass );
+       FC_THROW_EXCEPTION( exception, "the pass phrase does not match the wallet of account ${name}", ("name",name()) );
     }
+    my->_account.master_key = master;
     return my->_wallet; 
 }
-void account::save_wallet( const std::string& pass )
-{
-     my->_wallet.save( my->_wallet_file, pass );
-}
 
-void account::add_address( const address& a )
+void account::add_address( const bts::address& a )
 {
     my->_account.used_addresses.insert(a);
 }
 
-address account::get_new_address()
+bts::address account::get_new_address()
 {
    if( !my->_account.free_addresses.size() )
    {
-      if( !get_wallet().is_locked() )
+      if( !my->_account.master_key )
       {
-         my->_account.free_addresses = get_wallet().reserve( 100 );
+         FC_THROW_EXCEPTION( exception, "no addresses available and the wallet has no master key" );
       }
-      else
+      // handed out from the back, so the lowest key index goes first
+      for( uint32_t i = 100; i > 0; --i )
       {
-         FC_THROW_EXCEPTION( exception, "no addresses available and the wallet is locked" );
+         my->_account.free_addresses.push_back( bts::address( get_wallet().get_public_key( my->_account.next_key + i - 1 ) ) );
       }
+      my->_account.next_key += 100;
    }
    auto naddr = my->_account.free_addresses.back();
    my->_account.used_addresses.insert( naddr );
@@ -132,12 +136,12 @@ address account::get_new_address()
    return naddr;
 }
 
-const std::unordered_set<address>& account::get_addresses()const
+const std::unordered_set<bts::address>& account::get_addresses()const
 {
     return my->_account.used_addresses;
 }
 
-bool account::contains( const address& addr ) 
+bool account::contains( const bts::address& addr ) 
 {
   return my->_account.used_addresses.find(addr) != my->_account.used_addresses.end();
 }
@@ -1,8 +1,7 @@
 #pragma once
-#include "address.hpp"
-#include "blockchain.hpp"
-#include "wallet.hpp"
-#include "meta.hpp"
+#include <bts/address.hpp>
+#include <bts/wallet.hpp>
+#include <fc/filesystem.hpp>
 #include <vector>
 #include <memory>
 #include <unordered_set>
@@ -22,9 +21,10 @@ namespace detail { class account_impl; }
  *  thus can be used to monitor a group of
  *  addresses and to calculate a balance.
  *
- *  Each account has its own wallet which may
- *  optionally contain the private keys used
- *  for the account.
+ *  Each account has its own deterministic wallet,
+ *  new addresses only require its master public
+ *  key which is saved with the account, the
+ *  private keys require the pass phrase.
  *
  *  An account can be managed entirely independantly
  *  from the blockchain.  When an account is first
@@ -48,9 +48,9 @@ class account
       * that it may be used to sign transactions that
       * spend from this account.
       */
-     wallet&                           get_wallet();
-     wallet&                           load_wallet( const std::string& pass );
-     void                              save_wallet( const std::string& pass );
+     bts::wallet&                      get_wallet();
+     /** seeds the wallet with the hash of pass and records its master public key */
+     bts::wallet&                      load_wallet( const std::string& pass );
 
      void                              load( const fc::path& account_dir, open_mode m = create );
      void                              save();
@@ -58,20 +58,22 @@ class account
      void                              set_name( const std::string& name );
      std::string                       name()const;
                                        
-     void                              add_address( const address& a );
+     void                              add_address( const bts::address& a );
 
      /** Gets the next new address that hasn't been used by this account,
       *  yet exists in the wallet.
+      *
+      *  @throw if the wallet has no master public key
       **/
-     address                           get_new_address();
+     bts::address                      get_new_address();
 
      /** Gets all addresses associated with this account regardless
       *  of whether or not we have the private key
       */
-     const std::unordered_set<address>& get_addresses()const;
+     const std::unordered_set<bts::address>& get_addresses()const;
 
      /** helper method for searching get_addresses() for addr */
-     bool contains( const address& addr );
+     bool contains( const bts::address& addr );
 
   private:
      std::unique_ptr<detail::account_impl> my;
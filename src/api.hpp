@@ -1,7 +1,10 @@
 #pragma once
 #include <fc/signal.hpp>
 #include <fc/filesystem.hpp>
-#include "blockchain.hpp"
+#include <fc/optional.hpp>
+#include <bts/blockchain/block.hpp>
+#include <bts/pow_service.hpp>
+#include "chain_state.hpp"
 #include <vector>
 #include <memory>
 #include <map>
@@ -12,7 +15,21 @@ namespace detail
 }
 
 
-class meta_output_cache;
+/**
+ *  Counts blocks passed to block_chain::add_block by the stage that
+ *  rejected them.
+ */
+struct block_validation_stats
+{
+   block_validation_stats()
+   :accepted(0),rejected_header(0),rejected_pow(0),rejected_transactions(0){}
+
+   uint64_t accepted;
+   uint64_t rejected_header;       ///< size, height, previous block or timestamp, no proof of work was computed
+   uint64_t rejected_pow;          ///< did not meet the target difficulty
+   uint64_t rejected_transactions; ///< could not be applied to the chain state
+};
+FC_REFLECT( block_validation_stats, (accepted)(rejected_header)(rejected_pow)(rejected_transactions) )
 
 /**
  *  @class block_chain
@@ -35,75 +52,97 @@ class block_chain
        *  Emitted anytime the a new output is added to the chain state.
        *  Accounts can 'observe' these changes to  update their balances.
        */
-      fc::signal<void(const output_cache&)> output_added;
+      fc::signal<void(const unspent_output&)> output_added;
 
       /**
        *  Emitted anytime an output is 'spent' or otherwise removed from
        *  the chain state.  Accounts can 'observe' these changes to 
        *  update their balances.
        */
-      fc::signal<void(const output_cache&)> output_removed;
-      std::vector<output_cache> get_outputs_for_address( const address& a )const;
+      fc::signal<void(const unspent_output&)> output_removed;
+
+      /**
+       *  Returns all outputs spendable by a particular address, this includes
+       *  orders that could be canceled.
+       */
+      std::vector<unspent_output> get_outputs_for_address( const bts::address& a )const;
 
       void                    load( const fc::path& data_dir );
 
+      /**
+       *  Replaces the default proof-of-work service so that its memory budget
+       *  can be shared with other chains on this node.
+       */
+      void                    set_pow_service( const bts::pow_service_ptr& s );
+
       /**
        *  Adds a new transaction to the chain 'free pool'
+       *
+       *  @return false if it is already pooled or the pool rejected it
+       *          in favor of a conflicting transaction
+       *  @throw  if trx is not valid on top of the head
        */
-      void                    add_transaction( const transaction& trx );
-      transaction             get_transaction( const fc::sha256& trx_id );
+      bool                    add_transaction( const bts::signed_transaction& trx );
+      /** @return the pooled transaction with trx_id, if any */
+      fc::optional<bts::cached_transaction> get_transaction( const fc::sha224& trx_id )const;
 
       /**
-       *  Returns any transactions referenced by a block in the database for
-       *  which we do not have the trx ID.
+       *  Returns the ids in trx_ids, as announced by a peer, that are not
+       *  in the pool and so should be requested from it.
        */
-      std::vector<fc::sha256> get_missing_transactions( const fc::sha256& trx );
+      std::vector<fc::sha224> get_missing_transactions( const std::vector<fc::sha224>& trx_ids )const;
 
       /**
        *  Adds the block to the database, doesn't mean it goes in the head.
+       *
+       *  @throw if the block fails validation, see get_validation_stats()
        */
-      void                    add_block( const block& b );
+      void                    add_block( const bts::block& b );
+      block_validation_stats  get_validation_stats()const;
 
       /**
        *  Returns the most recent block with all 'unconfirmed' transactions.
        *
        *  @param new_chain will start a new block-chain if there is no chain
        */
-      const block&            get_unconfirmed_head();
+      const bts::block&       get_unconfirmed_head();
 
-      block                   get_block( const pow_hash& h );
-      block                   generate_next_block( const address& a );
+      bts::block              get_block( const bts::pow_hash& h );
+      bts::block              generate_next_block( const bts::address& a );
       void                    generate_gensis_block();
 
       /**
        *  @return a human-readable, well-formated view of the transaction.
        */
-      std::string             pretty_print_transaction( const signed_transaction& trx );
-      std::string             pretty_print_output( const trx_output& out );
-      std::string             pretty_print_output( const output_cache& out );
-      std::string             pretty_print_output( const fc::sha224& out );
-      std::string             pretty_print_block( const pow_hash& block_id );
+      std::string             pretty_print_transaction( const bts::cached_transaction& trx );
+      std::string             pretty_print_output( const bts::generic_trx_out& out );
+      std::string             pretty_print_output( const unspent_output& out );
+      std::string             pretty_print_output( const bts::output_reference& out );
+      std::string             pretty_print_block( const bts::pow_hash& block_id );
       void                    pretty_print_chain();
 
-      /**
-       *  Returns all balances for a particular address based upon confirmation status.
-       */
-      std::map<unit,int64_t>  get_balances( const address& a, int confirmations = -1 );
-      share_state             get_share_info( uint64_t unit_id );
       uint64_t                current_difficulty();
 
+      /** @return the largest pow_hash that satisfies difficulty */
+      static bts::pow_hash    target_for_difficulty( uint64_t difficulty );
+
       /**
-       *  @return the current exchange state for 
+       *  The input to the proof of work of b: the merkle root of the hash
+       *  of its header and b.pow.header_branch, hashed with the nonce.
+       *  The proof of work of the seed is the id of the block.
        */
-      exchange_state          get_exchange_info( uint64_t sell_unit, uint64_t buy_unit = 0);
+      static fc::sha256       pow_seed( const bts::block_proof& b );
 
       static int64_t          get_reward_for_height( int64_t h );
 
       /**
-       *  Returns all outputs spendable by a particular address, this includes
-       *  orders that could be canceled.
+       *  The addresses whose signatures are in trx.sigs, in the same order.
+       *  Each signature signs the sha256 of trx.id() and is recovered
+       *  through bts::get_signature_cache() so that a transaction checked
+       *  by add_transaction() is only a lookup when it arrives in a block.
+       *  A signature that can not be recovered is skipped.
        */
-      std::vector<output_cache> get_outputs( const address& a );
+      static std::vector<bts::address> get_signed_addresses( const bts::cached_transaction& trx );
 
    private:
       std::unique_ptr<detail::block_chain_impl> my; 
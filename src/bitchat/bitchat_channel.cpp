@@ -4,6 +4,7 @@
 #include <fc/reflect/variant.hpp>
 #include <fc/thread/thread.hpp>
 #include <fc/log/logger.hpp>
+#include <bts/flat_hash.hpp>
 #include <unordered_map>
 #include <map>
 
@@ -17,7 +18,7 @@ namespace bts { namespace bitchat {
      class bitchat_chan_data : public network::channel_data
      {
         public:
-          std::unordered_set<mini_pow> known_inv;
+          bts::flat_hash_set<mini_pow> known_inv;
      };
 
 
@@ -29,10 +30,10 @@ namespace bts { namespace bitchat {
           peer::peer_channel_ptr   peers;
 
           std::map<fc::time_point, mini_pow>            msg_time_index;
-          std::unordered_map<mini_pow,encrypted_message>  priv_msgs;
+          bts::flat_hash_map<mini_pow,encrypted_message> priv_msgs;
 
           /// messages that we have recieved inv for, but have not requested the data for
-          std::unordered_set<mini_pow>                  unknown_msgs; 
+          bts::flat_hash_set<mini_pow>                  unknown_msgs;
           std::unordered_map<mini_pow,fc::time_point>   requested_msgs; // messages that we have requested but not yet received
 
           std::vector<mini_pow>                         new_msgs;  // messages received since last inv broadcast
@@ -217,8 +218,10 @@ namespace bts { namespace bitchat {
               {
                  new_msgs.push_back( mid );
                  msg_time_index[fc::time_point::now()] = mid;
-                 const encrypted_message& m = (priv_msgs[mid] = std::move(msg));
-                 del->handle_message( m, chan_id );
+                 // the delegate may add messages and rehash priv_msgs, so it
+                 // gets our copy rather than a reference into the table
+                 priv_msgs[mid] = msg;
+                 del->handle_message( msg, chan_id );
               }
               else
               {
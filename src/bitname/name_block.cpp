@@ -1,4 +1,5 @@
 #include <bts/bitname/name_block.hpp>
+#include <bts/uint256.hpp>
 #include <fc/io/raw.hpp>
 
 namespace bts { namespace bitname {
@@ -11,13 +12,13 @@ namespace bts { namespace bitname {
 
   mini_pow name_block::calc_difficulty()const
   {
-     fc::bigint total;
+     uint256 total;
      for( auto itr = registered_names.begin(); itr != registered_names.end(); ++itr )
      {
-        total += to_bigint( itr->id(prev) );
+        total += to_uint256( itr->id(prev) );
      }
-     total /= registered_names.size(); // calculate the average
-     total /= registered_names.size(); // divided it by the number of names
+     total /= uint64_t(registered_names.size()); // calculate the average
+     total /= uint64_t(registered_names.size()); // divided it by the number of names
      return to_mini_pow( total );
   }
 
@@ -1,69 +1,174 @@
 #include <bts/bitname/name_miner.hpp>
 #include <bts/bitname/name_hash.hpp>
+#include <bts/uint256.hpp>
+#include <bts/sha512_multi.hpp>
+#include <bts/duty_cycle.hpp>
+#include <bts/mining_pool.hpp>
 #include <bts/config.hpp>
 #include <fc/thread/thread.hpp>
 #include <fc/io/raw.hpp>
+#include <math.h>
+#include <atomic>
+#include <mutex>
 
 namespace bts { namespace bitname {
 
   namespace detail 
   {
+    /**
+     *  A hash with k leading zeros and the remaining bits r is below a
+     *  target with the same k if r is below the target's remaining bits,
+     *  and always below it if it has more leading zeros, so the chance of
+     *  meeting the target with one hash is 2^-(k+1) * (1 + frac).
+     *
+     *  @return the expected number of hashes needed to meet target
+     */
+    double expected_hashes( const mini_pow& target )
+    {
+       const unsigned char* d = (const unsigned char*)target.data;
+       uint32_t k = 255 - d[0];
+       uint64_t rest = 0;
+       for( uint32_t i = 1; i < 9; ++i ) rest = (rest << 8) | d[i];
+       double frac = ldexp( double(rest), -64 );
+       return ldexp( 1.0, k + 1 ) / (1 + frac);
+    }
+
+    struct mining_thread_stats
+    {
+       mining_thread_stats():total_hashes(0){}
+
+       duty_cycle  duty;
+       uint64_t    total_hashes;
+    };
+
     class name_miner_impl
     {
       public:
-        name_miner_impl()
+        name_miner_impl( const mining_pool_ptr& pool )
         :_callback_thread( fc::thread::current() ),
+         _pool(pool),
          _del(nullptr),
-         _cur_effort(DEFAULT_MINING_EFFORT_PERCENT/100.0)
+         _cur_effort(DEFAULT_MINING_EFFORT_PERCENT/100.0),
+         _block_ver(0)
          {
             memset( min_name_pow.data, 0xff, sizeof(min_name_pow) );
             min_name_pow.data[0] = 255 - MIN_NAME_DIFFICULTY;
+            memset( name_pow_target.data, 0, sizeof(name_pow_target) );
+            memset( _best_hash.data, 0xff, sizeof(_best_hash) );
          }
 
         fc::thread&           _callback_thread;
 
+        mining_pool_ptr       _pool;
         name_miner_delegate*  _del;
-        fc::thread            _threads[DEFAULT_MINING_THREADS];
 
-        fc::future<void>      _mining_complete[DEFAULT_MINING_THREADS];
+        /** one per pool thread that has ever been used, never shrinks */
+        std::vector<fc::future<void> > _mining_complete;
 
-        float                 _cur_effort;
+        /** read by every mining thread between slices */
+        std::atomic<float>    _cur_effort;
         name_block            _cur_block;
 
-        uint64_t              _block_ver;
+        /** incremented to stop every thread searching an older block */
+        std::atomic<uint64_t> _block_ver;
 
+        /** only touched by the owning thread, each search gets a copy */
         mini_pow              name_pow_target;
         mini_pow              min_name_pow;
 
+        /** guards _stats and _best_hash which are read by name_miner::status() */
+        std::mutex                        _stats_mutex;
+        std::vector<mining_thread_stats>  _stats;
+        mini_pow                          _best_hash;
+
         /**
          *  Called from mining thread
+         *
+         *  Each pass tests one nonce per lane of the multi-buffer sha512
+         *  kernel, thread i tests nonces congruent to i modulo the number of
+         *  mining threads (stride).  Passes are grouped into slices of about
+         *  MINING_SLICE_USEC, after each slice the thread idles for as long as
+         *  its duty_cycle requires to stay at _cur_effort.
          */
-        void start_mining( name_block b, uint32_t thread_num, uint64_t ver )
+        void start_mining( name_block b, uint32_t thread_num, uint32_t stride, uint64_t ver, mini_pow target )
         {
-            // calculate temp buffer
-            std::vector<char> buf = fc::raw::pack( (const name_header&)b );
-            uint32_t* nonce = (uint32_t*)buf.data();
-            uint32_t* ts    = nonce + 1;
-            *nonce = thread_num;
-            *ts    = fc::time_point::now().time_since_epoch().count() / 1000000;
+            // calculate temp buffer, one copy of the header per lane
+            const uint32_t    lanes = sha512_multi_lanes();
+            std::vector<char> buf   = fc::raw::pack( (const name_header&)b );
+            std::vector<char> batch( buf.size() * lanes );
+            char*             msgs[sha512_max_lanes];
+            mini_pow          results[sha512_max_lanes];
+
+            uint32_t nonce = thread_num;
+            uint32_t ts    = fc::time_point::now().time_since_epoch().count() / 1000000;
+            memcpy( buf.data() + sizeof(nonce), &ts, sizeof(ts) );
+            for( uint32_t l = 0; l < lanes; ++l )
+            {
+               msgs[l] = batch.data() + l * buf.size();
+               memcpy( msgs[l], buf.data(), buf.size() );
+            }
 
+            const fc::microseconds slice( MINING_SLICE_USEC );
             while( ver >= _block_ver )
             {
-                for( uint32_t cnt = 0; cnt < 10000*(_cur_effort); ++cnt ) 
+                auto     slice_start = fc::time_point::now();
+                auto     slice_end   = slice_start;
+                uint64_t hashes      = 0;
+                bool     found       = false;
+                mini_pow best;
+                memset( best.data, 0xff, sizeof(best) );
+
+                do
                 {
-                    nonce += DEFAULT_MINING_THREADS;
-                    auto test_result = mini_pow_hash( buf.data(), buf.size() );
+                    for( uint32_t l = 0; l < lanes; ++l )
+                    {
+                       uint32_t n = nonce + l * stride;
+                       memcpy( msgs[l], &n, sizeof(n) );
+                    }
+                    mini_pow_hash( msgs, buf.size(), lanes, results );
+                    hashes += lanes;
 
-                    if( test_result < name_pow_target )
+                    for( uint32_t l = 0; l < lanes && !found; ++l )
                     {
-                       ++_block_ver; // signal other threads to stop
-                       b.nonce   = *nonce;
-                       b.utc_sec = *ts;
-                       _callback_thread.async( [=](){ _del->found_name_block( b ); } );
+                       if( results[l] < best ) best = results[l];
+                       if( results[l] < target )
+                       {
+                          found     = true;
+                          b.nonce   = nonce + l * stride;
+                          b.utc_sec = ts;
+                       }
                     }
-                    if( ver < _block_ver ) return;
+                    nonce += lanes * stride;
+                    slice_end = fc::time_point::now();
+                } while( !found && ver >= _block_ver && slice_end - slice_start < slice );
+
+                fc::microseconds idle;
+                { // report the slice, the pool may have shrunk since this block was started
+                   std::unique_lock<std::mutex> lock( _stats_mutex );
+                   if( thread_num < _stats.size() )
+                   {
+                      mining_thread_stats& stats = _stats[thread_num];
+                      stats.duty.record( slice_start, slice_end, hashes );
+                      stats.total_hashes += hashes;
+                      if( best < _best_hash ) _best_hash = best;
+                      idle = stats.duty.idle_time( _cur_effort, slice_end );
+                   }
+                }
+
+                if( found )
+                {
+                   ++_block_ver; // signal other threads to stop
+                   _callback_thread.async( [=](){ _del->found_name_block( b ); } );
+                   return;
+                }
+
+                // sleep in slices so a new block or stop() is noticed promptly
+                while( idle.count() > 0 && ver >= _block_ver )
+                {
+                   auto nap = idle < slice ? idle : slice;
+                   fc::usleep( nap );
+                   idle -= nap;
                 }
-                fc::usleep( fc::microseconds( 1000000 * (1-_cur_effort) ) );
             }
         }
 
@@ -73,23 +178,34 @@ namespace bts { namespace bitname {
 
            _cur_block.mroot = _cur_block.calc_merkle_root();
 
-           name_pow_target = to_mini_pow( to_bigint( _cur_block.calc_difficulty() ) / fc::bigint(10000) );
+           name_pow_target = to_mini_pow( to_uint256( _cur_block.calc_difficulty() ) / 10000 );
            if( name_pow_target < min_name_pow )
            {
               name_pow_target = min_name_pow;
            }
 
+           const uint32_t n = _pool->size();
+           {
+              std::unique_lock<std::mutex> lock( _stats_mutex );
+              _stats.resize( n );
+              for( uint32_t i = 0; i < n; ++i ) _stats[i].total_hashes = 0;
+              memset( _best_hash.data, 0xff, sizeof(_best_hash) );
+           }
+           if( _mining_complete.size() < n ) _mining_complete.resize( n );
+
            auto next_blk = ++_block_ver;
-           for( uint32_t i = 0; i < DEFAULT_MINING_THREADS; ++i )
+           auto target   = name_pow_target;
+           for( uint32_t i = 0; i < n; ++i )
            {
               auto b = _cur_block; // create a copy to pass to thread
-              _mining_complete[i] = _threads[i].async( [b,i,this,next_blk](){ start_mining(b,i,next_blk); } );
+              _mining_complete[i] = _pool->at(i).async( [b,i,n,this,next_blk,target](){ start_mining(b,i,n,next_blk,target); } );
            }
         }
     };
   }
 
-  name_miner::name_miner() :my( new detail::name_miner_impl() ) {}
+  name_miner::name_miner( const mining_pool_ptr& pool )
+  :my( new detail::name_miner_impl( pool ? pool : std::make_shared<mining_pool>() ) ) {}
   name_miner::~name_miner(){}
 
   void name_miner::set_delegate(  name_miner_delegate* d )
@@ -100,6 +216,7 @@ namespace bts { namespace bitname {
 
   void name_miner::start( float effort )
   {
+    FC_ASSERT( effort > 0 && effort <= 1, "effort must be a fraction of a core", ("effort",effort) );
     bool kickoff = my->_cur_effort <= 0;
     my->_cur_effort = effort;
     if( kickoff )
@@ -116,14 +233,57 @@ namespace bts { namespace bitname {
 
     if( wait_stop )
     {
-       for( uint32_t i = 0; i < DEFAULT_MINING_THREADS; ++i )
+       for( uint32_t i = 0; i < my->_mining_complete.size(); ++i )
        {
-          my->_mining_complete[i].wait();
+          if( my->_mining_complete[i].valid() ) my->_mining_complete[i].wait();
        }
     }
   }
 
 
+  name_miner_status name_miner::status()const
+  {
+    name_miner_status s;
+    s.effort = my->_cur_effort;
+    s.target = my->name_pow_target;
+
+    auto now = fc::time_point::now();
+    std::unique_lock<std::mutex> lock( my->_stats_mutex );
+    s.best_hash = my->_best_hash;
+    for( uint32_t i = 0; i < my->_stats.size(); ++i )
+    {
+       double rate = my->_stats[i].duty.rate( now );
+       s.thread_hashes_per_sec.push_back( rate );
+       s.hashes_per_sec += rate;
+       s.utilization    += my->_stats[i].duty.utilization( now ) / my->_stats.size();
+       s.total_hashes   += my->_stats[i].total_hashes;
+    }
+    if( s.effort > 0 && s.hashes_per_sec > 0 )
+    {
+       s.est_seconds_to_target = detail::expected_hashes( s.target ) / s.hashes_per_sec;
+    }
+    return s;
+  }
+
+  void name_miner::set_thread_count( uint32_t n )
+  {
+    my->_pool->resize( n );
+    if( my->_cur_effort > 0 && my->_del != nullptr )
+    {
+       my->start_new_block(); // restart the search spread over the new set of threads
+    }
+  }
+
+  uint32_t name_miner::thread_count()const
+  {
+    return my->_pool->size();
+  }
+
+  mining_pool_ptr name_miner::get_mining_pool()const
+  {
+    return my->_pool;
+  }
+
   void name_miner::set_prev( const mini_pow& p )
   {
       my->_cur_block.registered_names.clear();
@@ -1,81 +1,320 @@
 #include "api.hpp"
-#include "config.hpp"
 #include "meta.hpp"
-#include "proof_of_work.hpp"
 #include "chain_state.hpp"
+#include <bts/config.hpp>
+#include <bts/proof_of_work.hpp>
+#include <bts/pow_service.hpp>
+#include <bts/pow_cache.hpp>
+#include <bts/uint256.hpp>
+#include <bts/block_log.hpp>
+#include <bts/signature_cache.hpp>
+#include <bts/blockchain/transaction_pool.hpp>
+#include <fc/crypto/hex.hpp>
+#include <fc/io/raw.hpp>
 #include <fc/io/json.hpp>
-#include <list>
-#include <unordered_set>
-#include <assert.h>
+#include <fc/log/logger.hpp>
+#include <fc/thread/thread.hpp>
+#include <algorithm>
+#include <deque>
+#include <map>
+#include <set>
 #include <sstream>
 #include <iostream>
+#include <thread>
 
 namespace detail
 {
     class block_chain_impl
     {
        public:
+         /** the active chain, _chain[h] is the block at height h */
          std::vector<meta_block_header> _chain;
-         block                          _unconfirmed_head;
-         unsigned char*                 _pow_buffer;
+         bts::block                     _unconfirmed_head;
+         bts::pow_service_ptr           _pow_service;
+         bts::pow_cache                 _pow_cache;
          chain_state                    _state;
+         /** validated transactions waiting for the next block */
+         bts::transaction_pool          _pool;
+
+
+         bts::block_log                 _block_log;
+         /** the chain_state_transaction journal of every applied block, keyed like _block_log */
+         bts::block_log                 _undo_log;
+         /** every block marked invalid, so a restart does not apply them again */
+         bts::block_log                 _invalid_log;
+         fc::path                       _data_dir;
+         block_validation_stats         _validation_stats;
+
+         /** every block in the log whose previous block is also in it */
+         struct block_node
+         {
+            block_node():height(0),work(0),invalid(false){}
+
+            bts::pow_hash prev;
+            uint32_t      height;
+            uint64_t      work;    ///< difficulty of this block and all of its ancestors
+            bool          invalid; ///< this block or an ancestor failed to apply
+         };
+         bts::flat_hash_map<bts::pow_hash,block_node> _block_tree;
+         /** (work, id) of every block in _block_tree that is not invalid, so best_tip() is O(log n) */
+         std::set< std::pair<uint64_t,bts::pow_hash> > _valid_by_work;
+
+         struct orphan_block
+         {
+            bts::pow_hash id;
+            bts::block    blk;
+         };
+         /** blocks with a valid proof of work whose previous block is unknown, by prev */
+         bts::flat_hash_map<bts::pow_hash,std::vector<orphan_block> > _orphans;
+         /** (prev, id) of every orphan, oldest first */
+         std::deque< std::pair<bts::pow_hash,bts::pow_hash> >         _orphan_order;
+         /** recover transaction signers in parallel, created on first use */
+         std::vector<std::unique_ptr<fc::thread> > _verify_threads;
+
+         typedef std::map<bts::bond_type,uint64_t> unit_totals;
+
+         void validate_exchange( const unit_totals& in_value, const unit_totals& out_value,
+                                 const bts::cached_transaction& trx );
+
+         bts::pow_hash calculate_pow( const fc::sha256& seed );
+         void store_block( const bts::pow_hash& id, const bts::block& b, uint64_t difficulty );
+         void index_block( const bts::pow_hash& id, const bts::pow_hash& prev, uint32_t height, uint64_t difficulty );
+         void index_block_log( uint64_t difficulty );
+         void mark_invalid( const bts::pow_hash& id );
+         bts::pow_hash best_tip( const bts::pow_hash& preferred )const;
+         void switch_to_best_tip( const bts::pow_hash& preferred );
+         void replay_chain();
+         void load_snapshot( const fc::path& snapshot );
+         void check_block_header( const bts::block& b );
+         void check_block_parent( const bts::block& b );
+         void add_orphan( const bts::pow_hash& id, const bts::block& b );
+         std::vector<orphan_block> take_orphans( const bts::pow_hash& prev );
+         void accept_block( const bts::pow_hash& id, const bts::block& b, uint64_t difficulty );
+         void switch_to( const bts::pow_hash& tip );
+         void apply_block( const bts::pow_hash& id, const bts::block& b );
+         void undo_head();
+         void recover_signers( const bts::block& b );
+         uint64_t apply_transactions( const bts::block& b, chain_state_transaction& state );
+         uint64_t apply_transaction( const bts::cached_transaction& trx, uint32_t block_num, chain_state_transaction& state );
+         uint64_t check_pending( const bts::cached_transaction& trx );
+         void check_block_dividends( const bts::block& b, uint64_t total_fees );
+         bts::trx_output_by_address claim_output( const unspent_output& out, const fc::sha256& digest,
+                                                  const std::vector<fc::ecc::compact_signature>& sigs );
+    };
 
+    /**
+     *  The coinbase has no inputs, the block number in expire_block keeps
+     *  the ids of coinbases paying the same address apart.
+     */
+    bts::cached_transaction coinbase_transaction( const bts::address& a, uint64_t amount, uint32_t block_num )
+    {
+       bts::trx_output_by_address out;
+       out.amount        = amount;
+       out.claim_address = a;
+
+       bts::signed_transaction trx;
+       trx.version      = 0;
+       trx.expire_block = block_num;
+       trx.outputs.resize(1);
+       trx.outputs.back().out_type = bts::claim_by_address;
+       trx.outputs.back().data     = fc::raw::pack( out );
+       return trx;
+    }
 
-         std::unordered_map<pow_hash,block> _block_db;
+    void add_amount( block_chain_impl::unit_totals& totals, const bts::bond_type& unit, uint64_t amount )
+    {
+       uint64_t& total = totals[unit];
+       if( total + amount < total )
+       {
+          FC_THROW_EXCEPTION( exception, "amounts overflow" );
+       }
+       total += amount;
+    }
+}
 
-         void validate_exchange( const std::map<unit,uint64_t>& in_value, 
-                                 const std::map<unit,uint64_t>& out_value,
-                                 const std::vector<output_cache>& inputs,
-                                 const signed_transaction& trx );
 
-         uint64_t apply_transactions( const block& b );
-         uint64_t apply_transaction( const signed_transaction& trx );
-         void check_block_dividends( const block& b, uint64_t total_fees );
-         void claim_output( const trx_output& out, const std::vector<char>& in, const signed_transaction& trx );
-         uint64_t calculate_dividends( const output_cache& out );
-         uint64_t calculate_dividend_fee( const output_cache& out );
-    };
+block_chain::block_chain()
+:my( new detail::block_chain_impl() )
+{
+   my->_pow_service = std::make_shared<bts::pow_service>();
 }
 
-fc::sha224 transaction::calculate_id()const
+void block_chain::set_pow_service( const bts::pow_service_ptr& s )
 {
-  fc::sha224::encoder enc;
-  fc::raw::pack( enc, *this );
-  return enc.result();
+   my->_pow_service = s;
 }
 
-output_cache::output_cache( const fc::sha224& trx_id, uint32_t idx, const trx_output& out )
-:output_state(out)
+
+block_chain::~block_chain()
 {
-  fc::sha224::encoder enc;
-  fc::raw::pack( enc, trx_id );
-  fc::raw::pack( enc, idx );
-  fc::raw::pack( enc, out );
-  output_id = enc.result();
 }
 
+void block_chain::load( const fc::path& data_dir )
+{
+   if( !fc::exists( data_dir ) )
+      fc::create_directories(data_dir);
+
+   my->_data_dir = data_dir;
+   my->_pow_cache.open( data_dir / "pow_cache" );
+   my->_block_log.open( data_dir / "blocks.log" );
+   my->_undo_log.open( data_dir / "undo.log" );
+   my->_invalid_log.open( data_dir / "invalid.log" );
 
-block_chain::block_chain()
-:my( new detail::block_chain_impl() )
+   // the gensis block is deterministic, it is only appended to a new log
+   generate_gensis_block();
+   my->index_block_log( current_difficulty() );
+   if( fc::exists( data_dir / "chain_state" ) )
+   {
+      try
+      {
+         my->load_snapshot( data_dir / "chain_state" );
+      }
+      catch ( const fc::exception& e )
+      {
+         wlog( "ignoring chain state snapshot, replaying the whole chain: ${e}", ("e",e.to_detail_string()) );
+      }
+   }
+   my->replay_chain();
+}
+
+/**
+ *  Loads the chain state saved by add_block() and rebuilds _chain up to
+ *  the block it was saved at from the block log, reading the header of
+ *  each block without applying it.  replay_chain() then only has to apply
+ *  the blocks after it.
+ */
+void detail::block_chain_impl::load_snapshot( const fc::path& snapshot )
 {
+   std::vector<bts::block_log::entry> path;
+   chain_state s;
+   auto head = s.load( snapshot );
+   for( auto e = _block_log.find( head ); e && e->id != _chain.front().id; e = _block_log.find( e->prev ) )
+   {
+      path.push_back( *e );
+   }
+   if( path.empty() || path.back().prev != _chain.front().id )
+   {
+      FC_THROW_EXCEPTION( exception, "snapshot head ${head} is not on a chain in the block log", ("head",head) );
+   }
+
+   _state = std::move(s);
+   _chain.resize( 1 );
+   _chain.back().next_blocks.clear();
+   for( auto itr = path.rbegin(); itr != path.rend(); ++itr )
+   {
+      _chain.back().next_blocks.push_back( itr->id );
+      _chain.push_back( meta_block_header() );
+      _chain.back().id = itr->id;
+
+      // a packed block starts with its header, the transactions are not parsed
+      auto data = _block_log.fetch( itr->id );
+      fc::datastream<const char*> ds( data->data(), data->size() );
+      fc::raw::unpack( ds, _chain.back().header );
+   }
 }
 
+/**
+ *  Switches from the gensis block (or the snapshot head) to the block in
+ *  the log with the most work.  A block that fails to apply is marked
+ *  invalid along with its descendants and the next best tip is tried.
+ */
+void detail::block_chain_impl::replay_chain()
+{
+   const bts::pow_hash start = _chain.back().id; // _chain changes under a reference
+   switch_to_best_tip( start );
+   ilog( "loaded ${n} blocks, ${s} in the log", ("n",_chain.size())("s",_block_log.size()) );
+}
 
-block_chain::~block_chain()
+/**
+ *  Switches to best_tip( preferred ) until the head is the best valid tip.
+ *  A branch that fails to apply is marked invalid and leaves the head on
+ *  its valid prefix, from where the next best tip is tried.
+ *
+ *  @throw if a tip fails for any reason other than an invalid block
+ */
+void detail::block_chain_impl::switch_to_best_tip( const bts::pow_hash& preferred )
 {
+   for( auto tip = best_tip( preferred ); tip != _chain.back().id; tip = best_tip( preferred ) )
+   {
+      try
+      {
+         switch_to( tip );
+      }
+      catch ( const fc::exception& e )
+      {
+         if( !_block_tree.find( tip )->second.invalid ) throw;
+         wlog( "skipping an invalid branch: ${e}", ("e",e.to_detail_string()) );
+      }
+   }
 }
 
-void block_chain::load( const fc::path& data_dir )
+void detail::block_chain_impl::store_block( const bts::pow_hash& id, const bts::block& b, uint64_t difficulty )
 {
-   if( !fc::exists( data_dir ) ) 
-      fc::create_directories(data_dir);
-   
-   // if there is no chain... generate the gensis block
-   generate_gensis_block();
+   _block_log.append( id, b.prev, b.block_num, fc::raw::pack( b ) );
+   index_block( id, b.prev, b.block_num, difficulty );
 }
 
+void detail::block_chain_impl::index_block( const bts::pow_hash& id, const bts::pow_hash& prev, uint32_t height, uint64_t difficulty )
+{
+   block_node n;
+   n.prev   = prev;
+   n.height = height;
+   n.work   = difficulty;
+   auto parent = _block_tree.find( prev );
+   if( parent != _block_tree.end() )
+   {
+      n.work   += parent->second.work;
+      n.invalid = parent->second.invalid;
+   }
+   n.invalid |= !!_invalid_log.find( id );
+   _block_tree[id] = n;
+   if( !n.invalid ) _valid_by_work.insert( std::make_pair( n.work, id ) );
+}
+
+void detail::block_chain_impl::mark_invalid( const bts::pow_hash& id )
+{
+   block_node& n = _block_tree[id];
+   if( n.invalid ) return;
+   n.invalid = true;
+   _valid_by_work.erase( std::make_pair( n.work, id ) );
+   _invalid_log.append( id, n.prev, n.height, std::vector<char>() );
+}
+
+/**
+ *  Builds _block_tree from the headers in the block log index, a block is
+ *  only ever appended after its previous block so heights are contiguous.
+ *  Every block counts difficulty towards the work of its branch, which is
+ *  what add_block() checked it against since current_difficulty() is fixed.
+ */
+void detail::block_chain_impl::index_block_log( uint64_t difficulty )
+{
+   for( uint32_t h = 1; ; ++h )
+   {
+      auto entries = _block_log.at_height( h );
+      if( entries.empty() ) break;
+      for( auto itr = entries.begin(); itr != entries.end(); ++itr )
+      {
+         index_block( itr->id, itr->prev, itr->height, difficulty );
+      }
+   }
+}
+
+/**
+ *  @return the valid block with the most work, preferred wins ties if it is
+ *          valid so that a node stays on the first chain it saw.
+ */
+bts::pow_hash detail::block_chain_impl::best_tip( const bts::pow_hash& preferred )const
+{
+   const block_node& n = _block_tree.find( preferred )->second;
+   auto best = _valid_by_work.rbegin(); // never empty, the gensis block is valid
+   if( !n.invalid && !(n.work < best->first) )
+   {
+      return preferred;
+   }
+   return best->second;
+}
 
-const block& block_chain::get_unconfirmed_head()
+const bts::block& block_chain::get_unconfirmed_head()
 {
     return my->_unconfirmed_head;
 }
@@ -83,140 +322,495 @@ const block& block_chain::get_unconfirmed_head()
 void  block_chain::generate_gensis_block()
 {
    // generate gensis block and add it
+   bts::block b;
+   b.version   = 0;
+   b.timestamp = fc::time_point_sec( fc::time_point::from_iso_string("20130608T002349") ).sec_since_epoch();
+   b.block_num = my->_chain.size();
+   b.prev      = bts::pow_hash(); // null
+
+   // TODO: define a real address here!
+   b.state.transactions.push_back( detail::coinbase_transaction( bts::address(), get_reward_for_height(0), b.block_num ) );
+
+   chain_state_transaction trx( my->_state );
+   my->check_block_dividends( b, my->apply_transactions( b, trx ) );
+   trx.commit();
+   b.state_hash = trx.final_condition();
 
-   block b;
-   b.header.version.value         = 0;
-   b.header.miner_version.value   = 0;
-   b.header.timestamp             = fc::time_point::from_iso_string("20130608T002349");
-   b.header.height                = my->_chain.size();
-   b.header.prev_block            = pow_hash(); // null
-   b.header.nonce                 = 0;
-   b.header.dividends             = 0;
-
-   b.header.dividends += get_reward_for_height(0);
-
-   // generate coin-base transaction
-
-   signed_transaction coinbase_trx;
-   coinbase_trx.outputs.push_back( trx_output( b.header.dividends, unit() ) );
-   coinbase_trx.outputs.back().set_claim_function( claim_with_coinbase_address( address("abcd") ) ); // TODO: define a real address here!
-   b.trxs.emplace_back(std::move(coinbase_trx));
-
-   output_cache oc( b.trxs.back().calculate_id(), 0, b.trxs.back().outputs.back() );
-   my->_state.addOutput( oc );
-   my->_state.commit();
-   b.header.block_state = my->_state.root;
-    
    // store transaction in TRX DB
    my->_chain.push_back( meta_block_header() );
-   my->_chain.back().header = b.header;
-   my->_chain.back().id = proof_of_work( my->_chain.back().header, my->_pow_buffer );
-
-   my->_block_db[my->_chain.back().id] = b;
-}
-
-
-block  block_chain::generate_next_block( const address& a )
-{
-   block b;
-   b.header.version.value         = 0;
-   b.header.miner_version.value   = 0;
-   b.header.timestamp             = fc::time_point::now();
-   b.header.height                = my->_chain.size();
-   b.header.prev_block            = my->_chain.back().id;
-   b.header.nonce                 = 0;
-   b.header.dividends             = 0;
-
-   // apply all non-market transactions
-
-   // perform market calculations
-   
-   // calculate dividends and updated shares.
-
-   b.header.dividends += get_reward_for_height(b.header.height) / 2;
-   // generate coin-base transaction
-   signed_transaction coinbase_trx;
-   coinbase_trx.outputs.push_back( trx_output( b.header.dividends, unit() ) );
-   // TODO: validate all 'coinbase transactions' use claim_with_coinbase flag
-   ilog( "claim_with_coinbase_address ${address}", ("address",a) );
-   coinbase_trx.outputs.back().set_claim_function( claim_with_coinbase_address( a ) );
-   ilog( "   check: ${address}", ("address", coinbase_trx.outputs.back().get_claim_address() ) );
-   b.trxs.emplace_back(std::move(coinbase_trx));
-   ilog( "   block check: ${address}", ("address", b.trxs.back().outputs.back().get_claim_address() ) );
-   ilog( "..............................\n");
-   
-
-   // TODO: temp commit changes to find the state...
-   output_cache oc( b.trxs.back().calculate_id(), 0, b.trxs.back().outputs.back() );
-   my->_state.addOutput( oc );
-   ilog( "..............................\n");
-
-   // save the state..
-   auto undo_state = my->_state.commit();
-   wlog( "   commit block check: ${address}", ("address", b.trxs.back().outputs.back().get_claim_address() ) );
-   b.header.block_state = my->_state.root;
-   // go back to prior state... 
-   my->_state.undo(undo_state);
-   wlog( "   undo block check: ${address}", ("address", b.trxs.back().outputs.back().get_claim_address() ) );
-
-   
+   my->_chain.back().header    = b;
+   my->_chain.back().id        = my->calculate_pow( pow_seed( b ) );
+   my->_chain.back().undo_data = trx.pack();
+
+   my->store_block( my->_chain.back().id, b, current_difficulty() );
+}
+
+
+/**
+ *  Builds a block on top of the head with the pooled transactions that pay
+ *  the most per byte, see transaction_pool::select(), and a coinbase paying
+ *  the block reward and their fees to a.  The block is applied to find the
+ *  state hash and then undone, so the chain state is left as it was.
+ */
+bts::block  block_chain::generate_next_block( const bts::address& a )
+{
+   bts::block b;
+   b.version   = 0;
+   b.timestamp = fc::time_point_sec( fc::time_point::now() ).sec_since_epoch();
+   b.block_num = my->_chain.size();
+   b.prev      = my->_chain.back().id;
+   if( b.timestamp <= my->_chain.back().header.timestamp )
+   {
+      b.timestamp = my->_chain.back().header.timestamp + 1;
+   }
+
+   b.state.transactions.push_back( detail::coinbase_transaction( a, get_reward_for_height(b.block_num), b.block_num ) );
+
+   // fill the rest of the block from the pool, the transaction count may grow by up to 4 bytes
+   uint64_t fees    = 0;
+   auto     pending = my->_pool.select( MAX_BLOCK_SIZE - fc::raw::pack_size( b ) - 4 );
+   {
+      chain_state_transaction trx( my->_state ); // only finds the fees, never committed
+      for( auto itr = pending.begin(); itr != pending.end(); ++itr )
+      {
+         try
+         {
+            uint64_t fee = my->apply_transaction( *itr, b.block_num, trx );
+            if( fees + fee < fees ) break;
+            fees += fee;
+            b.state.transactions.push_back( *itr );
+         }
+         catch ( const fc::exception& e )
+         {
+            wlog( "dropping pending transaction ${id}: ${e}", ("id",itr->id())("e",e.to_detail_string()) );
+            my->_pool.remove( itr->id() );
+         }
+      }
+   }
+   b.state.transactions.front() = detail::coinbase_transaction( a, get_reward_for_height(b.block_num) + fees, b.block_num );
+
+   chain_state_transaction trx( my->_state );
+   my->check_block_dividends( b, my->apply_transactions( b, trx ) );
+   trx.commit();
+   b.state_hash = trx.final_condition();
+   // go back to prior state...
+   trx.undo();
+
+   my->_unconfirmed_head = b;
    return b;
 }
 
-void  block_chain::add_block( const block& b )
+/**
+ *  Blocks are validated in order of increasing cost so that junk costs as
+ *  little as possible: first the header and size checks which only need
+ *  the block itself, then the proof of work (a pass over 128 MB of
+ *  memory), and only then the transactions.  Each stage counts its
+ *  rejections in get_validation_stats().
+ *
+ *  A block whose previous block is unknown waits in the orphan pool until
+ *  it arrives.  Every other block with a valid proof of work is appended to
+ *  the block log and becomes the head once its branch has more work than
+ *  the active chain, see switch_to().
+ *
+ *  @throw if the block is invalid
+ */
+void  block_chain::add_block( const bts::block& b )
 {
-  ilog( "...... " );
-   // no matter what we need to know the hash of the block.
-   auto pow     = proof_of_work( b.header, my->_pow_buffer ); 
-   my->_block_db[pow] = b;
+   const bool linked = my->_block_tree.find( b.prev ) != my->_block_tree.end();
+   try
+   {
+      my->check_block_header( b );
+      if( linked ) my->check_block_parent( b ); // an orphan is checked once its parent arrives
+   }
+   catch ( ... )
+   {
+      ++my->_validation_stats.rejected_header;
+      throw;
+   }
+
+   auto pow = my->calculate_pow( pow_seed( b ) );
+   if( !(pow < target_for_difficulty( current_difficulty() )) )
+   {
+      ++my->_validation_stats.rejected_pow;
+      FC_THROW_EXCEPTION( exception, "block ${pow} does not meet the target difficulty", ("pow",pow) );
+   }
+
+   auto known = my->_block_tree.find( pow );
+   if( known != my->_block_tree.end() )
+   {
+      if( known->second.invalid )
+      {
+         FC_THROW_EXCEPTION( exception, "block ${id} is invalid", ("id",pow) );
+      }
+      return;
+   }
+   if( !linked )
+   {
+      my->add_orphan( pow, b );
+      return;
+   }
+
+   const bts::pow_hash old_head = my->_chain.back().id;
+   fc::exception_ptr   failed;
+   try
+   {
+      my->accept_block( pow, b, current_difficulty() );
+   }
+   catch ( const fc::exception& e )
+   {
+      failed = e.dynamic_copy_exception();
+   }
 
-   // is this a fork of an earlier point in the chain or another chain all togeher?
-   if( b.header.height <  my->_chain.size() )
+   // connect the orphans that were waiting for this block, and theirs, whether or not it applied
+   std::vector<bts::pow_hash> parents( 1, pow );
+   while( parents.size() )
    {
-       wlog( "not next in the chain..." );
-       return;
+      auto children = my->take_orphans( parents.back() );
+      parents.pop_back();
+      for( auto itr = children.begin(); itr != children.end(); ++itr )
+      {
+         try
+         {
+            my->check_block_parent( itr->blk );
+         }
+         catch ( const fc::exception& e )
+         {
+            ++my->_validation_stats.rejected_header;
+            wlog( "dropping orphan block ${id}: ${e}", ("id",itr->id)("e",e.to_detail_string()) );
+            continue;
+         }
+
+         try
+         {
+            my->accept_block( itr->id, itr->blk, current_difficulty() );
+            parents.push_back( itr->id );
+         }
+         catch ( const fc::exception& e )
+         {
+            wlog( "dropping orphan block ${id}: ${e}", ("id",itr->id)("e",e.to_detail_string()) );
+         }
+      }
    }
 
-   if( b.header.height > my->_chain.size() )
+   if( my->_chain.back().id != old_head )
    {
-       wlog( "we appear to have missed something\n" );
-       return;
+      changed(); // new head, miners restart on top of it
    }
+   if( failed ) failed->dynamic_rethrow_exception();
+}
 
-   if( my->_chain.back().id != b.header.prev_block )
+/**
+ *  Stores a block that passed check_block_parent() and switches to it if
+ *  its branch now has more work than the active chain.  If the branch
+ *  fails to apply switch_to() restores the old head before rethrowing.
+ */
+void detail::block_chain_impl::accept_block( const bts::pow_hash& id, const bts::block& b, uint64_t difficulty )
+{
+   store_block( id, b, difficulty );
+   _pow_cache.store( block_chain::pow_seed( b ), id ); // duplicate announcements of b are a lookup
+   const block_node& n = _block_tree.find( id )->second;
+   if( n.invalid )
    {
-      // TODO: un-hinged... perhaps part of a forked-chain
-      //       
+      ++_validation_stats.rejected_transactions;
+      FC_THROW_EXCEPTION( exception, "block ${id} builds on an invalid block", ("id",id) );
+   }
+
+   const bts::pow_hash old_head = _chain.back().id;
+   if( n.work > _block_tree.find( old_head )->second.work )
+   {
+      try
+      {
+         switch_to( id );
+      }
+      catch ( ... )
+      {
+         switch_to_best_tip( old_head ); // the head may be left on the valid prefix of id
+         throw;
+      }
    }
    else
    {
-       try
-       {
-          int64_t total_fees = 0;
-          //my->check_block_coinbase( b );            // verify only one coinbase transaction
-          //my->check_block_inputs_unique( b );       // verify all inputs all unique
-          total_fees += my->apply_transactions( b );  // make sure all transfers are valid
-          my->check_block_dividends( b, total_fees ); // verify fees + reward == dividends / 2
-          
-          // attempt to apply all transactions... 
-          // if successful commit those transactions to the state
-          auto undo = my->_state.commit();
-          // should I store this someplace... I think I will 
-       } 
-       catch ( ... )
-       {
-          my->_state.rollback(); // toss all unapplied changes
-       }
+      ilog( "block ${id} at height ${h} extends a side chain", ("id",id)("h",b.block_num) );
+   }
+   ++_validation_stats.accepted;
+}
+
+/**
+ *  Makes tip the head: undoes the active chain back to the fork point with
+ *  the journals in the undo log, then applies the blocks of the new branch
+ *  from the block log.  A reorg of depth d costs d journal replays plus
+ *  the validation of the new branch.
+ *
+ *  If a block of the branch fails it and the rest of the branch are marked
+ *  invalid and the exception is rethrown with the head on the valid prefix
+ *  of the branch, switch_to_best_tip() then picks the best valid tip which
+ *  may be that prefix, the old head or another branch.
+ */
+void detail::block_chain_impl::switch_to( const bts::pow_hash& tip )
+{
+   std::vector<bts::pow_hash> branch;
+   uint32_t                   fork_height = 0;
+   bool                       invalid     = false;
+   for( bts::pow_hash id = tip; ; )
+   {
+      auto node = _block_tree.find( id );
+      FC_ASSERT( node != _block_tree.end(), "block ${id} is not connected to the gensis block", ("id",id) );
+      const block_node& n = node->second;
+      if( n.height < _chain.size() && _chain[n.height].id == id )
+      {
+         fork_height = n.height;
+         break;
+      }
+      invalid |= n.invalid;
+      branch.push_back( id );
+      id = n.prev;
+   }
+   if( invalid )
+   {
+      for( auto itr = branch.begin(); itr != branch.end(); ++itr ) mark_invalid( *itr );
+      FC_THROW_EXCEPTION( exception, "block ${id} builds on an invalid block", ("id",tip) );
+   }
+
+   if( fork_height + 1 < _chain.size() )
+   {
+      wlog( "switching to block ${tip}, undoing ${d} blocks after height ${h}",
+            ("tip",tip)("d",_chain.size() - 1 - fork_height)("h",fork_height) );
+   }
+   std::vector<bts::pow_hash> undone;
+   while( _chain.size() > fork_height + 1 )
+   {
+      undone.push_back( _chain.back().id );
+      undo_head();
+   }
+
+   for( auto itr = branch.rbegin(); itr != branch.rend(); ++itr )
+   {
+      try
+      {
+         apply_block( *itr, fc::raw::unpack<bts::block>( *_block_log.fetch( *itr ) ) );
+      }
+      catch ( ... )
+      {
+         for( auto bad = itr; bad != branch.rend(); ++bad ) mark_invalid( *bad );
+         ++_validation_stats.rejected_transactions;
+         throw;
+      }
+   }
+
+   // transactions of the blocks undone wait for the next block unless the new branch spent their inputs
+   for( auto old = undone.rbegin(); old != undone.rend(); ++old )
+   {
+      auto trxs = fc::raw::unpack<bts::block>( *_block_log.fetch( *old ) ).state.transactions;
+      for( auto itr = trxs.begin() + 1; itr != trxs.end(); ++itr )
+      {
+         try
+         {
+            _pool.add( *itr, check_pending( *itr ) );
+         }
+         catch ( const fc::exception& e )
+         {
+            ilog( "transaction ${id} of an undone block is no longer valid: ${e}", ("id",itr->id())("e",e.to_string()) );
+         }
+      }
+   }
+}
+
+/**
+ *  Applies b on top of the head through one chain_state_transaction,
+ *  checks the resulting state against b.state_hash, records the journal
+ *  of the transaction in the undo log unless b was applied before, and
+ *  pushes b onto _chain.
+ *
+ *  Changes are buffered by the transaction until commit(), so a block
+ *  with an invalid transaction leaves the chain state untouched.
+ */
+void detail::block_chain_impl::apply_block( const bts::pow_hash& id, const bts::block& b )
+{
+   chain_state_transaction trx( _state );
+   uint64_t total_fees = apply_transactions( b, trx ); // make sure all transfers are valid
+   check_block_dividends( b, total_fees );             // verify the coinbase claims no more than reward + fees
+
+   // if successful commit those transactions to the state
+   trx.commit();
+   if( trx.final_condition() != b.state_hash )
+   {
+      trx.undo();
+      FC_THROW_EXCEPTION( exception, "block ${id} results in chain state ${s} instead of ${h}",
+                          ("id",id)("s",trx.final_condition())("h",b.state_hash) );
+   }
+
+   auto undo = trx.pack();
+   if( !_undo_log.find( id ) ) _undo_log.append( id, b.prev, b.block_num, undo );
+
+   _chain.back().next_blocks.push_back(id);
+   _chain.push_back( meta_block_header() );
+   _chain.back().id        = id;
+   _chain.back().header    = b;
+   _chain.back().undo_data = std::move(undo);
+
+   _pool.remove_included( b.state.transactions );
+   _pool.expire( b.block_num + 1 );
+
+   if( b.block_num % CHAIN_STATE_SNAPSHOT_INTERVAL == 0 && !_data_dir.generic_string().empty() )
+   {
+      try
+      {
+         _state.save( _data_dir / "chain_state", id );
+      }
+      catch ( const fc::exception& e )
+      {
+         wlog( "unable to save the chain state: ${e}", ("e",e.to_detail_string()) );
+      }
+   }
+}
+
+/**
+ *  Rolls the chain state back to the parent of the head block in
+ *  O(changes made by the head block).
+ */
+void detail::block_chain_impl::undo_head()
+{
+   FC_ASSERT( _chain.size() > 1, "the gensis block can not be undone" );
+   meta_block_header& head = _chain.back();
+   if( head.undo_data.empty() ) // only the head is read back when loading a snapshot
+   {
+      auto data = _undo_log.fetch( head.id );
+      if( !data )
+      {
+         FC_THROW_EXCEPTION( exception, "no undo data for block ${id}", ("id",head.id) );
+      }
+      head.undo_data = std::move(*data);
+   }
+
+   chain_state_transaction trx( _state );
+   trx.unpack( head.undo_data.data(), head.undo_data.size() );
+   trx.undo();
+   _chain.pop_back();
+}
+
+/**
+ *  Keeps a block until its previous block arrives, the oldest orphans are
+ *  dropped once there are more than MAX_ORPHAN_BLOCKS.
+ */
+void detail::block_chain_impl::add_orphan( const bts::pow_hash& id, const bts::block& b )
+{
+   auto& waiting = _orphans[b.prev];
+   for( auto itr = waiting.begin(); itr != waiting.end(); ++itr )
+   {
+      if( itr->id == id ) return;
+   }
+   orphan_block o;
+   o.id  = id;
+   o.blk = b;
+   waiting.push_back( std::move(o) );
+   _orphan_order.push_back( std::make_pair( b.prev, id ) );
+   ilog( "block ${id} is waiting for unknown previous block ${prev}", ("id",id)("prev",b.prev) );
+
+   while( _orphan_order.size() > MAX_ORPHAN_BLOCKS )
+   {
+      auto oldest = _orphan_order.front();
+      _orphan_order.pop_front();
+
+      auto itr = _orphans.find( oldest.first );
+      auto& v  = itr->second;
+      v.erase( std::find_if( v.begin(), v.end(), [&]( const orphan_block& ob ){ return ob.id == oldest.second; } ) );
+      if( v.empty() ) _orphans.erase( itr );
+   }
+}
+
+/** removes and returns the orphans whose previous block is prev */
+std::vector<detail::block_chain_impl::orphan_block> detail::block_chain_impl::take_orphans( const bts::pow_hash& prev )
+{
+   std::vector<orphan_block> children;
+   auto itr = _orphans.find( prev );
+   if( itr == _orphans.end() ) return children;
+
+   children = std::move( itr->second );
+   _orphans.erase( itr );
+   _orphan_order.erase( std::remove_if( _orphan_order.begin(), _orphan_order.end(),
+                          [&]( const std::pair<bts::pow_hash,bts::pow_hash>& o ){ return o.first == prev; } ),
+                        _orphan_order.end() );
+   return children;
+}
+
+/**
+ *  Checks everything about b that does not require the proof of work, the
+ *  previous block or the chain state.
+ */
+void detail::block_chain_impl::check_block_header( const bts::block& b )
+{
+   if( b.state.transactions.size() == 0 )
+   {
+      FC_THROW_EXCEPTION( exception, "block has no coinbase transaction" );
+   }
+
+   auto size = fc::raw::pack_size( b );
+   if( size > MAX_BLOCK_SIZE )
+   {
+      FC_THROW_EXCEPTION( exception, "block of ${size} bytes exceeds the limit of ${max}", ("size",size)("max",MAX_BLOCK_SIZE) );
+   }
+
+   uint64_t now = fc::time_point_sec( fc::time_point::now() ).sec_since_epoch();
+   if( b.timestamp > now + MAX_BLOCK_CLOCK_DRIFT_SEC )
+   {
+      FC_THROW_EXCEPTION( exception, "block timestamp ${t} is too far in the future", ("t",b.timestamp) );
+   }
+}
+
+/**
+ *  Checks the height and timestamp of b against its previous block, which
+ *  must be in the block log.
+ */
+void detail::block_chain_impl::check_block_parent( const bts::block& b )
+{
+   auto prev = _block_log.find( b.prev );
+   if( !prev )
+   {
+      FC_THROW_EXCEPTION( exception, "unknown previous block ${prev}", ("prev",b.prev) );
+   }
+   if( b.block_num != prev->height + 1 )
+   {
+      FC_THROW_EXCEPTION( exception, "block height ${h} does not follow previous block height ${p}",
+                          ("h",b.block_num)("p",prev->height) );
+   }
 
-       // validate that the result of the commit == b.block_state
-      
-       my->_chain.back().next_blocks.push_back(pow);
-       my->_chain.push_back( meta_block_header() );
-       my->_chain.back().id = pow;
-       my->_chain.back().header = b.header;
+   // a packed block starts with its header, the transactions are not parsed
+   auto data = _block_log.fetch( prev->id );
+   fc::datastream<const char*> ds( data->data(), data->size() );
+   bts::block_header prev_header;
+   fc::raw::unpack( ds, prev_header );
+   if( !(prev_header.timestamp < b.timestamp) )
+   {
+      FC_THROW_EXCEPTION( exception, "block timestamp must be after the previous block" );
    }
 }
 
+block_validation_stats block_chain::get_validation_stats()const
+{
+   return my->_validation_stats;
+}
+
+bts::pow_hash block_chain::target_for_difficulty( uint64_t difficulty )
+{
+   if( difficulty == 0 ) difficulty = 1;
+   bts::uint256 max_pow = (bts::uint256(1) << (8*sizeof(bts::pow_hash))) - bts::uint256(1);
+   return bts::to_mini_pow( max_pow / bts::uint256(difficulty) );
+}
+
+fc::sha256 block_chain::pow_seed( const bts::block_proof& b )
+{
+   fc::sha224::encoder leaf;
+   fc::raw::pack( leaf, static_cast<const bts::block_header&>(b) );
+
+   bts::merkle_branch branch = b.pow.header_branch;
+   branch.mid_states.insert( branch.mid_states.begin(), leaf.result() );
+
+   fc::sha256::encoder enc;
+   fc::raw::pack( enc, branch.calculate_root() );
+   fc::raw::pack( enc, b.pow.nonce );
+   return enc.result();
+}
+
 uint64_t block_chain::current_difficulty()
 {
   // calculate the average time for the past 120 blocks
@@ -231,286 +825,349 @@ int64_t  block_chain::get_reward_for_height( int64_t h )
    int64_t reward = INIT_BLOCK_REWARD * SHARE;
    do
    {
-      ilog( "height: ${h}  ${reward}", ("h", h)("reward",reward) );
-         int num  = h > REWARD_ADJUSTMENT_INTERVAL ? REWARD_ADJUSTMENT_INTERVAL : h;
-         reward -= num * (reward/2/REWARD_ADJUSTMENT_INTERVAL);
-      ilog( "height: ${h}  ${reward}", ("h", h)("reward",reward) );
+      int64_t num = h > REWARD_ADJUSTMENT_INTERVAL ? REWARD_ADJUSTMENT_INTERVAL : h;
+      reward -= num * (reward/2/REWARD_ADJUSTMENT_INTERVAL);
       h -= REWARD_ADJUSTMENT_INTERVAL;
    } while( h > 0 );
-  ilog( "height: ${h}  ${reward}", ("h", h)("reward",reward) );
 
    return reward;
 }
 
 
 
-/*
-void detail::block_chain_impl::check_block_inputs_unique( const block& b )
+/**
+ *  Returns the cached proof of work for seed if this block has been seen
+ *  before, otherwise waits (without blocking the current thread) for the
+ *  pow_service to calculate it.  The result is not cached here, a hash
+ *  that misses the target or belongs to an orphan would stay in the cache
+ *  forever, accept_block() caches it once the block is linked.
+ */
+bts::pow_hash detail::block_chain_impl::calculate_pow( const fc::sha256& seed )
+{
+   auto cached = _pow_cache.fetch( seed );
+   if( cached ) return *cached;
+
+   return _pow_service->submit( seed, bts::chain_block_priority ).wait();
+}
+
+std::vector<bts::address> block_chain::get_signed_addresses( const bts::cached_transaction& trx )
 {
-    std::unordered_set<fc::sha224> input_set;
-    for( auto itr = b.trx.begin(); itr != b.trx.end(); ++itr )
+  fc::sha256 digest = fc::sha256::hash( (char*)&trx.id(), sizeof(trx.id()) );
+
+  // transactions are checked when relayed and again in a block, the second time is a lookup
+  auto& cache = bts::get_signature_cache();
+  std::vector<bts::address> addrs;
+  addrs.reserve( trx.trx().sigs.size() );
+  for( auto itr = trx.trx().sigs.begin(); itr != trx.trx().sigs.end(); ++itr )
+  {
+    try
     {
-       for( auto in = itr->inputs.begin(); in != itr->inputs.end(); ++in )
-       {
-           if( !input_set.insert( in->source_output ) )
-           {
-              FC_THROW_EXCEPTION( exception, "duplicate inputs" ); 
-           }
-       }
+      addrs.push_back( cache.recover( digest, *itr ) );
     }
+    catch ( const fc::exception& )
+    {
+      // a malformed signature signs for no one, the others still count
+    }
+  }
+  return addrs;
 }
-*/
 
 /**
- *  All transactions that are not part of a bid/ask must have matching
- *  units and must have more inputs than outputs (a non-0 fee)
+ *  Public key recovery dominates the cost of validating a block and does
+ *  not depend on the chain state, so the signers of every transaction are
+ *  recovered up front on all cores.  Thread t handles transactions t, t+n,
+ *  t+2n... so large transactions are spread over the threads.  The signers
+ *  are left in bts::get_signature_cache() where claim_output() finds them.
  */
-uint64_t detail::block_chain_impl::apply_transactions( const block& b )
+void detail::block_chain_impl::recover_signers( const bts::block& b )
 {
-    uint64_t total_fees = 0;
-    int      coinbase_count = 0;
-    for( auto itr = b.trxs.begin(); itr != b.trxs.end(); ++itr )
-    {
-       if( itr->inputs.size() != 0 ) // not a coinbase
-       {
-          // TODO: assert trx has not expired by this block
-          total_fees += apply_transaction( *itr );
-       }
-       else // this is a coinbase, make sure there is only 1
-       {
-          if( coinbase_count > 0 )
-          { 
-              // TODO: indicate that this is a malicious block and flag
-              // who ever sent this to us!
-              FC_THROW_EXCEPTION( exception, "multiple coinbase!" );
-          }
-       }
-    }
-    return total_fees;
-}
+   const auto& trxs = b.state.transactions;
+   if( trxs.size() < 3 ) // the coinbase and at most one transfer
+   {
+      for( uint32_t i = 0; i < trxs.size(); ++i )
+      {
+         if( trxs[i].trx().inputs.size() ) block_chain::get_signed_addresses( trxs[i] );
+      }
+      return;
+   }
 
+   if( _verify_threads.empty() )
+   {
+      uint32_t n = std::thread::hardware_concurrency();
+      for( uint32_t i = 0; i < (n ? n : 1); ++i )
+      {
+         _verify_threads.push_back( std::unique_ptr<fc::thread>( new fc::thread( "verify" ) ) );
+      }
+   }
 
-uint64_t detail::block_chain_impl::calculate_dividends( const output_cache& out )
-{
-  return 0;
-}
-uint64_t detail::block_chain_impl::calculate_dividend_fee( const output_cache& out )
-{
-  return 0;
-}
+   const uint32_t n = std::min<size_t>( _verify_threads.size(), trxs.size() );
+   std::vector< fc::future<void> > done;
+   for( uint32_t t = 0; t < n; ++t )
+   {
+      done.push_back( _verify_threads[t]->async( [&trxs,t,n]()
+      {
+         for( uint32_t i = t; i < trxs.size(); i += n )
+         {
+            if( trxs[i].trx().inputs.size() ) block_chain::get_signed_addresses( trxs[i] );
+         }
+      }));
+   }
 
+   // every thread must be done with b before anything is thrown
+   fc::exception_ptr failed;
+   for( uint32_t t = 0; t < done.size(); ++t )
+   {
+      try
+      {
+         done[t].wait();
+      }
+      catch ( const fc::exception& e )
+      {
+         if( !failed ) failed = e.dynamic_copy_exception();
+      }
+   }
+   if( failed ) failed->dynamic_rethrow_exception();
+}
 
 /**
- *   A transfer requires that all inputs and outputs have matching value
+ *  Applies the transactions of b to state in order, so a transaction may
+ *  spend the outputs of an earlier one in the same block.  The first
+ *  transaction is the coinbase, which has no inputs and whose outputs are
+ *  checked by check_block_dividends().
+ *
+ *  @return the fees paid by every other transaction
  */
-bool is_transfer( std::map<unit,uint64_t>& in, std::map<unit,uint64_t>& out, uint64_t total_fee )
+uint64_t detail::block_chain_impl::apply_transactions( const bts::block& b, chain_state_transaction& state )
 {
-    for( auto itr = in.begin(); itr != in.end(); ++itr )
+    const auto& trxs = b.state.transactions;
+    recover_signers( b );
+
+    uint64_t total_fees = 0;
+    for( uint32_t i = 0; i < trxs.size(); ++i )
     {
-       auto out_itr = out.find(itr->first);
-       if( out_itr == out.end() )
+       const bts::signed_transaction& trx = trxs[i].trx();
+       if( i == 0 ) // the coinbase
+       {
+          if( trx.inputs.size() != 0 || trx.expire_block != b.block_num )
+          {
+             FC_THROW_EXCEPTION( exception, "the first transaction must be a coinbase for block ${n}", ("n",b.block_num) );
+          }
+          for( uint32_t o = 0; o < trx.outputs.size(); ++o )
+          {
+             bts::output_reference ref;
+             ref.trx_hash   = trxs[i].id();
+             ref.output_idx = o;
+             state.add_output( ref, trx.outputs[o], b.block_num );
+          }
+       }
+       else if( trx.inputs.size() == 0 )
        {
-          return false;
+          // TODO: indicate that this is a malicious block and flag
+          // who ever sent this to us!
+          FC_THROW_EXCEPTION( exception, "multiple coinbase!" );
        }
-       if( itr->second != out_itr->second )
+       else
        {
-          // check to see if the fee makes them equal... 
-          if( itr->first == unit() && out_itr->second == (total_fee+itr->second) )
+          uint64_t fee = apply_transaction( trxs[i], b.block_num, state );
+          if( total_fees + fee < total_fees )
           {
-             continue;
+             FC_THROW_EXCEPTION( exception, "fees overflow" );
           }
-          return false;
+          total_fees += fee;
        }
     }
-    return true;
+    return total_fees;
 }
 
-
-
 /**
- *  @return total fees
+ *  Spends the inputs of trx and adds its outputs to state.  Every unit
+ *  other than the default one has to balance, the default unit has to
+ *  leave a fee.
+ *
+ *  Everything is checked before state is changed, so a transaction that
+ *  fails leaves state as it was and the next one can still be applied.
+ *
+ *  @return the fee
  */
-uint64_t detail::block_chain_impl::apply_transaction( const signed_transaction& trx )
+uint64_t detail::block_chain_impl::apply_transaction( const bts::cached_transaction& ctrx,
+                                                      uint32_t block_num, chain_state_transaction& state )
 {
-    std::vector<output_cache>  inputs;
-    inputs.reserve( trx.inputs.size() );
+    const bts::signed_transaction& trx = ctrx.trx();
+    if( trx.expire_block && trx.expire_block < block_num )
+    {
+       FC_THROW_EXCEPTION( exception, "transaction expired at block ${e}", ("e",trx.expire_block) );
+    }
+    if( trx.outputs.size() > 256 )
+    {
+       FC_THROW_EXCEPTION( exception, "${n} outputs can not all be referenced", ("n",trx.outputs.size()) );
+    }
 
-    uint64_t dividend_due  = 0; // dividends earned over 24 hours ago
-    uint64_t dividend_fee  = 0; // dividends earned in the past 24 hours
+    unit_totals in_value;  // track all inputs by value
+    unit_totals out_value; // track all outputs by value
 
-    std::map<unit,uint64_t> in_value; // track all inputs by value
+    // the signers were recovered into the signature cache by recover_signers()
+    const fc::sha256 digest = fc::sha256::hash( (char*)&ctrx.id(), sizeof(ctrx.id()) );
 
-    // calculate the total value of all inputs, including dividends + fees
-    // store the 'outputs' so we can validate exchange rates (if any) later
+    std::vector<fc::sha224>        spent; // in the order of the inputs, which decides the slots they free
+    bts::flat_hash_set<fc::sha224> spent_set;
+    spent.reserve( trx.inputs.size() );
     for( auto itr = trx.inputs.begin(); itr != trx.inputs.end(); ++itr )
     {
-       output_cache& out = _state.getOutput( itr->source_output );
-
-       // validate that we can actually claim this output, it must be in the chain state,
-       // and be part of a valid transaction.
-       claim_output( inputs.back().output_state, itr->claim_input, trx );
-
-       dividend_due           +=  calculate_dividends( out );
-       dividend_fee           +=  calculate_dividend_fee( out );
-
-       if( in_value.find( out.output_state.amount_unit ) != in_value.end() )
+       if( itr->in_type != bts::claim_by_address )
        {
-           in_value[ out.output_state.amount_unit ] += out.output_state.amount;
+          FC_THROW_EXCEPTION( exception, "unsupported input type ${t}", ("t",int(itr->in_type)) );
        }
-       else
+       auto in = fc::raw::unpack<bts::trx_input_by_address>( itr->data );
+       auto id = chain_state::output_id( in.output_ref );
+       if( !spent_set.insert( id ).second )
        {
-           in_value[ out.output_state.amount_unit ] =  out.output_state.amount;
+          FC_THROW_EXCEPTION( exception, "output ${idx} of ${trx} is spent twice",
+                              ("idx",in.output_ref.output_idx)("trx",in.output_ref.trx_hash) );
        }
-       inputs.push_back( out );
+       auto out = claim_output( state.get_output( in.output_ref ), digest, trx.sigs );
+       add_amount( in_value, out.unit, out.amount );
+       spent.push_back( id );
     }
-    in_value[unit()] = dividend_due;
 
-    // calculate the output value in each unit
-    std::map<unit,uint64_t> out_value; // track all outputs by value.
-    in_value[unit()] = 0;
-
-    for( auto itr = trx.outputs.begin(); itr != trx.outputs.end(); ++itr )
+    for( uint32_t i = 0; i < trx.outputs.size(); ++i )
     {
-       if( out_value.find( itr->amount_unit ) != out_value.end() )
-           out_value[ itr->amount_unit ] += itr->amount;
-       else
-           out_value[ itr->amount_unit ] = itr->amount;
+       if( trx.outputs[i].out_type != bts::claim_by_address )
+       {
+          FC_THROW_EXCEPTION( exception, "unsupported output type ${t}", ("t",int(trx.outputs[i].out_type)) );
+       }
+       auto out = fc::raw::unpack<bts::trx_output_by_address>( trx.outputs[i].data );
+       add_amount( out_value, out.unit, out.amount );
     }
 
     // calculate total fees earned by this transaction
-    int64_t total_fees =  dividend_fee + (in_value[unit()] - out_value[unit()]);
-    if( total_fees <= 0 ) 
+    uint64_t fee_in  = in_value[bts::bond_type()];
+    uint64_t fee_out = out_value[bts::bond_type()];
+    if( fee_in <= fee_out )
     {
-      FC_THROW_EXCEPTION( exception, "No Fees Paid" ); 
+      FC_THROW_EXCEPTION( exception, "No Fees Paid" );
     }
+    in_value.erase( bts::bond_type() );
+    out_value.erase( bts::bond_type() );
 
     // check that we have a valid transfer or exchange, note that 'bids' are
     // just transfers that have extra claim criteria
-    if( !is_transfer( in_value, out_value, total_fees ) )
+    if( in_value != out_value )
     {
-        // checks to make sure this exchange is happening at the proper price
-        // *note* to claim the inputs the transaction already has proper outputs
-        // so all that this must do is check that the exchange rate / margin
-        // requirements are met... 
-        validate_exchange( in_value, out_value, inputs, trx );
+        validate_exchange( in_value, out_value, ctrx );
     }
 
-    // this should have been validated by is_transfer or validate exchange
-    assert( in_value[unit()] > out_value[unit()] );
-
-    // remove all inputs from the current state
-    for( auto itr = inputs.begin(); itr != inputs.end(); ++itr )
+    for( auto itr = spent.begin(); itr != spent.end(); ++itr )
     {
-      _state.removeOutput( itr->output_id );
+       state.remove_output( *itr );
     }
-
-    fc::sha224 trx_id = trx.calculate_id();
-    // add all outputs to the current state
     for( uint32_t i = 0; i < trx.outputs.size(); ++i )
     {
-       _state.addOutput( output_cache( trx_id, i, trx.outputs[i] ) ); 
+       bts::output_reference ref;
+       ref.trx_hash   = ctrx.id();
+       ref.output_idx = i;
+       state.add_output( ref, trx.outputs[i], block_num );
     }
-
-    return total_fees;
-}
-
-void detail::block_chain_impl::check_block_dividends( const block& b, uint64_t total_fees )
-{
-  // TODO
+    return fee_in - fee_out;
 }
 
 /**
- *  Applies input to the output claim function in the context of trx.  Throws an exception if
- *  the input / trx do not satisfy the claim criteria
- *
- *  @throw an exception if the output could not be claimed!
+ *  The coinbase may only pay the default unit and at most the block reward
+ *  plus the fees of the other transactions.
  */
-void detail::block_chain_impl::claim_output( const trx_output& out, const std::vector<char>& in, const signed_transaction& trx )
+void detail::block_chain_impl::check_block_dividends( const bts::block& b, uint64_t total_fees )
 {
-  // TODO     
-}
+  unit_totals paid;
+  const auto& coinbase = b.state.transactions.front().trx();
+  for( auto itr = coinbase.outputs.begin(); itr != coinbase.outputs.end(); ++itr )
+  {
+     if( itr->out_type != bts::claim_by_address )
+     {
+        FC_THROW_EXCEPTION( exception, "unsupported coinbase output type ${t}", ("t",int(itr->out_type)) );
+     }
+     auto out = fc::raw::unpack<bts::trx_output_by_address>( itr->data );
+     add_amount( paid, out.unit, out.amount );
+  }
 
-void detail::block_chain_impl::validate_exchange( const std::map<unit,uint64_t>& in_value, 
-                                                  const std::map<unit,uint64_t>& out_value,
-                                                  const std::vector<output_cache>& inputs,
-                                                  const signed_transaction& trx )
-{
-  // TODO
+  uint64_t allowed = block_chain::get_reward_for_height( b.block_num ) + total_fees;
+  if( paid.size() > 1 || (paid.size() && paid.begin()->first != bts::bond_type()) )
+  {
+     FC_THROW_EXCEPTION( exception, "the coinbase may only pay the default unit" );
+  }
+  if( paid[bts::bond_type()] > allowed )
+  {
+     FC_THROW_EXCEPTION( exception, "coinbase pays ${p}, more than the reward and fees of ${a}",
+                         ("p",paid[bts::bond_type()])("a",allowed) );
+  }
 }
 
 /**
- *  Note this method may through if public_key recovery fails for one of the provided signtures.
+ *  Checks that out can be spent by a transaction with sigs over digest.
+ *  The signers are looked up in bts::get_signature_cache(), which only
+ *  recovers them again if they were evicted since recover_signers().
+ *
+ *  @param digest the sha256 of the cached_transaction id that sigs sign
+ *  @return the decoded output
+ *  @throw an exception if the output could not be claimed!
  */
-std::vector<address> signed_transaction::get_signed_addresses()const
+bts::trx_output_by_address detail::block_chain_impl::claim_output( const unspent_output& out, const fc::sha256& digest,
+                                                                   const std::vector<fc::ecc::compact_signature>& sigs )
 {
-  auto trx_id       = calculate_id();
-  //ilog( "trx_id: ${d}", ("d", trx_id) );
-  fc::sha256 digest = fc::sha256::hash( (char*)&trx_id, sizeof(trx_id) );
-  //ilog( "digest: ${d}", ("d", digest) );
-
-  std::vector<address> addrs;
-  for( auto itr = trx_sigs.begin(); itr != trx_sigs.end(); ++itr )
+  if( out.output.out_type != bts::claim_by_address )
   {
-    addrs.push_back( address( fc::ecc::public_key( *itr, digest ) ) );
+     FC_THROW_EXCEPTION( exception, "unsupported claim type ${t}", ("t",int(out.output.out_type)) );
   }
-  return addrs;
+  auto owned = fc::raw::unpack<bts::trx_output_by_address>( out.output.data );
+  auto& cache = bts::get_signature_cache();
+  for( auto itr = sigs.begin(); itr != sigs.end(); ++itr )
+  {
+     try
+     {
+        if( cache.recover( digest, *itr ) == owned.claim_address ) return owned;
+     }
+     catch ( const fc::exception& )
+     {
+        // a malformed signature signs for no one, a later one may match
+     }
+  }
+  FC_THROW_EXCEPTION( exception, "output owned by ${a} was not signed for", ("a",owned.claim_address) );
 }
-void    signed_transaction::sign_with_key( const fc::ecc::private_key& pk )
-{
-  auto trx_id       = calculate_id();
-  //ilog( "trx_id: ${d}", ("d", trx_id) );
-  fc::sha256 digest = fc::sha256::hash( (char*)&trx_id, sizeof(trx_id) );
-  //ilog( "digest: ${d}", ("d", digest) );
 
-  trx_sigs.push_back( pk.sign_compact( digest ) );
+void detail::block_chain_impl::validate_exchange( const unit_totals& in_value, const unit_totals& out_value,
+                                                  const bts::cached_transaction& trx )
+{
+  FC_THROW_EXCEPTION( exception, "transaction ${id} does not balance and exchanges are not supported yet",
+                      ("id",trx.id()) );
 }
 
-std::string   block_chain::pretty_print_output( const fc::sha224& out )
+std::string   block_chain::pretty_print_output( const bts::output_reference& out )
 {
-  return pretty_print_output( my->_state.getOutput(out) );
+  return pretty_print_output( my->_state.get_output( out ) );
 }
-std::string   block_chain::pretty_print_output( const output_cache& out )
+std::string   block_chain::pretty_print_output( const unspent_output& out )
 {
-  /*
   std::stringstream ss;
-    if( out.amount_unit == unit() )
-        ss<<out.amount<< " bs ";
-    else
-        ss<<out.amount<< "  unit: "<< out.amount_unit.id <<" margin: "<<out.amount_unit.min_margin<<"%  ";
-  
+  ss<<pretty_print_output( out.output )<<" in block "<<out.block_num;
   return ss.str();
-  */
-  return pretty_print_output( out.output_state );
 }
 
 
-std::string   block_chain::pretty_print_output( const trx_output& out )
+std::string   block_chain::pretty_print_output( const bts::generic_trx_out& out )
 {
   std::stringstream ss;
-    if( out.amount_unit == unit() )
-        ss<<out.amount<< " bs ";
-    else
-        ss<<out.amount<< "  unit: "<< out.amount_unit.id <<" margin: "<<out.amount_unit.min_margin<<"%  ";
-    ss<<"claim with ";
-    switch( out.claim_function.value )
+    switch( out.out_type )
     {
-        case claim_with_address::type:
+        case bts::claim_by_address:
         {
-            ss<<"address "<< std::string(fc::raw::unpack<claim_with_address>( out.claim_data ).addr);
-        }
-        break;
-        case claim_with_coinbase_address::type:
-        {
-            ss<<"coinbase address "<< 
-                std::string(fc::raw::unpack<claim_with_coinbase_address>( out.claim_data ).addr);
-        }
-        break;
-        case claim_with_exchange::type:
-        {
-            ss<< "exchange ";
-
+            auto o = fc::raw::unpack<bts::trx_output_by_address>( out.data );
+            if( o.unit == bts::bond_type() )
+                ss<<o.amount<< " bs ";
+            else
+                ss<<o.amount<< "  unit: "<< int(o.unit.issue_type) <<" backed by: "<<int(o.unit.backing_type)<<"  ";
+            ss<<"claim with address "<< std::string(o.claim_address);
         }
         break;
+        default:
+            ss<<"unknown output type "<<int(out.out_type);
     }
 
   return ss.str();
@@ -519,48 +1176,103 @@ std::string   block_chain::pretty_print_output( const trx_output& out )
 /**
  *  @return a human-readable, well-formated view of the transaction.
  */
-std::string   block_chain::pretty_print_transaction( const signed_transaction& trx )
+std::string   block_chain::pretty_print_transaction( const bts::cached_transaction& trx )
 {
   std::stringstream ss;
-  ss<<" Transaction: "<< fc::string(trx.calculate_id()).c_str() <<"\n"; 
+  ss<<" Transaction: "<< fc::string(trx.id()).c_str() <<"\n";
   ss<<"   Inputs: \n";
+    for( auto itr = trx.trx().inputs.begin(); itr != trx.trx().inputs.end(); ++itr )
+    {
+       auto ref = fc::raw::unpack<bts::trx_input>( itr->data ).output_ref;
+       ss<<"    "<< fc::string( ref.trx_hash ).substr(0,8).c_str()<<"."<<int(ref.output_idx)<<"\n";
+    }
 
   ss<<"   Outputs: \n";
-    int i = 0;
-    for( auto itr = trx.outputs.begin(); itr != trx.outputs.end(); ++itr )
+    for( auto itr = trx.trx().outputs.begin(); itr != trx.trx().outputs.end(); ++itr )
     {
-       ss<<"    "<<pretty_print_output( *itr )<<"  id: "<< fc::string( output_cache( trx.calculate_id(), i, *itr).output_id ).substr(0,8).c_str()<<"\n";
-       ++i;
+       ss<<"    "<<pretty_print_output( *itr )<<"\n";
     }
 
-  ss<<"   Fees: \n";
   ss<<"   Signed By:  ";
-  auto sadr = trx.get_signed_addresses();
+  auto sadr = get_signed_addresses( trx );
   for( auto itr = sadr.begin(); itr != sadr.end(); ++itr )
   {
     ss<<" "<<std::string(*itr)<<",";
-    ++itr;
   }
   return ss.str();
 }
 
-block block_chain::get_block( const pow_hash& block_id )
+/**
+ *  Validates trx against the chain state, and the pooled transactions it
+ *  spends, and adds it to the pool that generate_next_block() draws from.
+ */
+bool block_chain::add_transaction( const bts::signed_transaction& trx )
+{
+   bts::cached_transaction ctrx( trx );
+   if( my->_pool.contains( ctrx.id() ) ) return false;
+
+   // leaves the signers in the cache shared with block validation
+   get_signed_addresses( ctrx );
+   if( !my->_pool.add( ctrx, my->check_pending( ctrx ) ) ) return false;
+   changed(); // miners pick it up with the next block
+   return true;
+}
+
+fc::optional<bts::cached_transaction> block_chain::get_transaction( const fc::sha224& trx_id )const
+{
+   return my->_pool.get( trx_id );
+}
+
+std::vector<fc::sha224> block_chain::get_missing_transactions( const std::vector<fc::sha224>& trx_ids )const
 {
-  auto itr = my->_block_db.find(block_id);
-  if( itr != my->_block_db.end() ) return itr->second;
+   std::vector<fc::sha224> missing;
+   for( auto itr = trx_ids.begin(); itr != trx_ids.end(); ++itr )
+   {
+      if( !my->_pool.contains( *itr ) ) missing.push_back( *itr );
+   }
+   return missing;
+}
+
+/**
+ *  Checks trx as if it were included in the next block.  Outputs of pooled
+ *  transactions may be spent, so a chain of unconfirmed transfers can wait
+ *  in the pool together.
+ *
+ *  @return the fee
+ */
+uint64_t detail::block_chain_impl::check_pending( const bts::cached_transaction& trx )
+{
+   chain_state_transaction state( _state ); // never committed
+   for( auto itr = trx.trx().inputs.begin(); itr != trx.trx().inputs.end(); ++itr )
+   {
+      if( itr->in_type != bts::claim_by_address ) continue; // rejected by apply_transaction()
+      auto ref = fc::raw::unpack<bts::trx_input_by_address>( itr->data ).output_ref;
+      if( state.contains( chain_state::output_id( ref ) ) ) continue;
+
+      auto parent = _pool.get( ref.trx_hash );
+      if( parent && ref.output_idx < parent->trx().outputs.size() )
+      {
+         state.add_output( ref, parent->trx().outputs[ref.output_idx], _chain.size() );
+      }
+   }
+   return apply_transaction( trx, _chain.size(), state );
+}
+
+bts::block block_chain::get_block( const bts::pow_hash& block_id )
+{
+  auto data = my->_block_log.fetch( block_id );
+  if( data ) return fc::raw::unpack<bts::block>( *data );
   FC_THROW_EXCEPTION( exception, "unable to find block ${block}", ("block",block_id) );
 }
 
-std::string block_chain::pretty_print_block( const pow_hash& block_id )
+std::string block_chain::pretty_print_block( const bts::pow_hash& block_id )
 {
    std::stringstream ss;
    auto blk = get_block( block_id );
-   ss << blk.header.height <<"]   "<<  fc::string( block_id ).substr(0,8).c_str() 
-      << "  prev: "<< fc::string( blk.header.prev_block ).substr(0,8).c_str() 
-      << " @  "<<fc::string(blk.header.timestamp).c_str()<<" "
-      << " dividends  "<<blk.header.dividends<<" bs\n";
-   //ss << std::string( fc::json::to_string( blk.header ) ) << "\n";
-   for( auto itr = blk.trxs.begin(); itr != blk.trxs.end(); ++itr )
+   ss << blk.block_num <<"]   "<<  fc::to_hex( block_id.data, 4 ).c_str()
+      << "  prev: "<< fc::to_hex( blk.prev.data, 4 ).c_str()
+      << " @  "<<blk.timestamp<<"\n";
+   for( auto itr = blk.state.transactions.begin(); itr != blk.state.transactions.end(); ++itr )
    {
       ss<<pretty_print_transaction( *itr )<<"\n";
    }
@@ -577,27 +1289,7 @@ void block_chain::pretty_print_chain()
    std::cout.flush();
 }
 
-fc::optional<address> trx_output::get_claim_address()const
-{
-   ilog( "claim_function.value: ${v}", ("v",claim_function.value) );
-   if( claim_function.value == claim_with_coinbase_address::type ||
-       claim_function.value == claim_with_address::type )
-   {
-      auto a = fc::raw::unpack<claim_with_address>( claim_data ).addr;
-      ilog( "claim address: ${a}", ("a", a));
-      return a;
-   }
-   return fc::optional<address>();
-}
-
-
-
-bool operator==( const unit& a, const unit& b ){ return a.id == b.id && a.min_margin == b.min_margin; }
-bool operator!=( const unit& a, const unit& b ){ return !(a==b); }
-bool operator<( const unit& a, const unit& b ) { return a.id < b.id  || ((a.id == b.id) && (a.min_margin < b.min_margin)); }
-
-std::vector<output_cache> block_chain::get_outputs_for_address( const address& a )const
+std::vector<unspent_output> block_chain::get_outputs_for_address( const bts::address& a )const
 {
-  ilog( "${a}", ("a",a) );
-  return my->_state.getCurrentOutputsForAddress( a );
+  return my->_state.get_outputs_for_address( a );
 }
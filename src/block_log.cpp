@@ -0,0 +1,290 @@
+#include <bts/block_log.hpp>
+#include <bts/flat_hash.hpp>
+#include <fc/crypto/city.hpp>
+#include <fc/exception/exception.hpp>
+#include <fc/reflect/variant.hpp>
+#include <fc/log/logger.hpp>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define BLOCK_LOG_MAGIC  (0x6b6c4254) // "TBlk"
+
+namespace bts {
+
+  namespace detail
+  {
+     /**
+      *  On disk layout of a record, written field by field so that the file
+      *  does not depend on the padding of a struct.
+      */
+     enum record_layout
+     {
+        magic_pos       = 0,
+        size_pos        = magic_pos  + sizeof(uint32_t),
+        id_pos          = size_pos   + sizeof(uint32_t),
+        prev_pos        = id_pos     + sizeof(pow_hash),
+        height_pos      = prev_pos   + sizeof(pow_hash),
+        header_size     = height_pos + sizeof(uint32_t),
+        checksum_size   = sizeof(uint64_t)
+     };
+
+     uint64_t record_checksum( const char* header, const char* data, uint32_t size )
+     {
+        return fc::city_hash64( header, header_size ) ^ fc::city_hash64( data, size );
+     }
+
+     class block_log_impl
+     {
+        public:
+          block_log_impl():fd(-1),end(0){}
+
+          int                                   fd;
+          fc::path                              file;
+          uint64_t                              end;       ///< offset of the next record
+          flat_hash_map<pow_hash,block_log::entry> index;
+          std::vector< std::vector<pow_hash> >  by_height;
+
+          void read_exact( char* out, size_t len, uint64_t offset )const
+          {
+             while( len )
+             {
+                ssize_t r = pread( fd, out, len, offset );
+                if( r < 0 && errno == EINTR ) continue;
+                if( r <= 0 )
+                {
+                   FC_THROW_EXCEPTION( exception, "unable to read ${len} bytes at ${offset} from ${file}: ${e}",
+                                       ("len",len)("offset",offset)("file",file)("e", r < 0 ? strerror(errno) : "end of file") );
+                }
+                out += r; len -= r; offset += r;
+             }
+          }
+
+          void write_exact( const char* in, size_t len, uint64_t offset )
+          {
+             while( len )
+             {
+                ssize_t r = pwrite( fd, in, len, offset );
+                if( r < 0 && errno == EINTR ) continue;
+                if( r <= 0 )
+                {
+                   FC_THROW_EXCEPTION( exception, "unable to write ${len} bytes at ${offset} to ${file}: ${e}",
+                                       ("len",len)("offset",offset)("file",file)("e",strerror(errno)) );
+                }
+                in += r; len -= r; offset += r;
+             }
+          }
+
+          static block_log::entry parse_header( const char* h, uint64_t offset )
+          {
+             block_log::entry e;
+             memcpy( &e.size,   h + size_pos,   sizeof(e.size) );
+             memcpy( &e.id,     h + id_pos,     sizeof(e.id) );
+             memcpy( &e.prev,   h + prev_pos,   sizeof(e.prev) );
+             memcpy( &e.height, h + height_pos, sizeof(e.height) );
+             e.offset = offset;
+             return e;
+          }
+
+          bool check_record( const block_log::entry& e )const
+          {
+             std::vector<char> rec( header_size + e.size + checksum_size );
+             read_exact( rec.data(), rec.size(), e.offset );
+             uint64_t sum;
+             memcpy( &sum, rec.data() + header_size + e.size, sizeof(sum) );
+             return sum == record_checksum( rec.data(), rec.data() + header_size, e.size );
+          }
+
+          /** @return false if the block was already indexed */
+          bool add_to_index( const block_log::entry& e )
+          {
+             if( index.find( e.id ) != index.end() ) return false;
+             index[e.id] = e;
+             if( by_height.size() <= e.height ) by_height.resize( e.height + 1 );
+             by_height[e.height].push_back( e.id );
+             return true;
+          }
+
+          /**
+           *  Rebuilds the index from the record headers and returns the
+           *  offset just past the last complete record.
+           */
+          uint64_t scan( uint64_t file_size )
+          {
+             uint64_t                offset = 0;
+             fc::optional<block_log::entry> last;
+             bool                    last_indexed = false;
+             char                    h[header_size];
+             while( offset + header_size <= file_size )
+             {
+                read_exact( h, header_size, offset );
+                uint32_t magic;
+                memcpy( &magic, h + magic_pos, sizeof(magic) );
+                auto e = parse_header( h, offset );
+                if( magic != BLOCK_LOG_MAGIC || offset + header_size + e.size + checksum_size > file_size )
+                {
+                   break;
+                }
+                last_indexed = add_to_index( e );
+                last         = e;
+                offset      += header_size + e.size + checksum_size;
+             }
+
+             // a crash may leave the file extended before the data reached the disk
+             if( last && !check_record( *last ) )
+             {
+                wlog( "dropping block ${id} with a bad checksum at the end of ${file}", ("id",last->id)("file",file) );
+                if( last_indexed )
+                {
+                   index.erase( last->id );
+                   by_height[last->height].pop_back();
+                }
+                offset = last->offset;
+             }
+             return offset;
+          }
+     };
+  } // namespace detail
+
+  block_log::block_log()
+  :my( new detail::block_log_impl() ){}
+
+  block_log::~block_log()
+  {
+     close();
+  }
+
+  void block_log::open( const fc::path& file )
+  {
+     try
+     {
+        close();
+        if( !fc::exists( file.parent_path() ) ) fc::create_directories( file.parent_path() );
+
+        my->file = file;
+        my->fd   = ::open( file.generic_string().c_str(), O_RDWR | O_CREAT, 0644 );
+        if( my->fd < 0 )
+        {
+           FC_THROW_EXCEPTION( exception, "${e}", ("e",strerror(errno)) );
+        }
+
+        struct stat st;
+        if( fstat( my->fd, &st ) != 0 )
+        {
+           FC_THROW_EXCEPTION( exception, "${e}", ("e",strerror(errno)) );
+        }
+
+        my->end = my->scan( st.st_size );
+        if( my->end != uint64_t(st.st_size) )
+        {
+           wlog( "truncating ${n} bytes of an incomplete record from the end of ${file}",
+                 ("n", uint64_t(st.st_size) - my->end)("file",file) );
+           if( ftruncate( my->fd, my->end ) != 0 )
+           {
+              FC_THROW_EXCEPTION( exception, "unable to truncate: ${e}", ("e",strerror(errno)) );
+           }
+        }
+        ilog( "opened ${file} with ${n} blocks", ("file",file)("n",my->index.size()) );
+     } FC_RETHROW_EXCEPTIONS( warn, "unable to open block log ${file}", ("file",file) )
+  }
+
+  void block_log::close()
+  {
+     if( my->fd >= 0 ) ::close( my->fd );
+     my->fd  = -1;
+     my->end = 0;
+     my->index.clear();
+     my->by_height.clear();
+  }
+
+  bool block_log::is_open()const
+  {
+     return my->fd >= 0;
+  }
+
+  block_log::entry block_log::append( const pow_hash& id, const pow_hash& prev, uint32_t height,
+                                      const std::vector<char>& packed_block )
+  {
+     FC_ASSERT( is_open() );
+     auto itr = my->index.find( id );
+     if( itr != my->index.end() ) return itr->second;
+
+     entry e;
+     e.id     = id;
+     e.prev   = prev;
+     e.height = height;
+     e.offset = my->end;
+     e.size   = packed_block.size();
+
+     // one write per record, the header is only valid if the whole record made it
+     std::vector<char> rec( detail::header_size + e.size + detail::checksum_size );
+     uint32_t magic = BLOCK_LOG_MAGIC;
+     memcpy( rec.data() + detail::magic_pos,  &magic,    sizeof(magic) );
+     memcpy( rec.data() + detail::size_pos,   &e.size,   sizeof(e.size) );
+     memcpy( rec.data() + detail::id_pos,     &e.id,     sizeof(e.id) );
+     memcpy( rec.data() + detail::prev_pos,   &e.prev,   sizeof(e.prev) );
+     memcpy( rec.data() + detail::height_pos, &e.height, sizeof(e.height) );
+     if( e.size ) memcpy( rec.data() + detail::header_size, packed_block.data(), e.size );
+     uint64_t sum = detail::record_checksum( rec.data(), packed_block.data(), e.size );
+     memcpy( rec.data() + detail::header_size + e.size, &sum, sizeof(sum) );
+
+     my->write_exact( rec.data(), rec.size(), e.offset );
+     if( fdatasync( my->fd ) != 0 )
+     {
+        FC_THROW_EXCEPTION( exception, "unable to sync ${file}: ${e}", ("file",my->file)("e",strerror(errno)) );
+     }
+
+     my->end += rec.size();
+     my->add_to_index( e );
+     return e;
+  }
+
+  fc::optional<block_log::entry> block_log::find( const pow_hash& id )const
+  {
+     fc::optional<entry> result;
+     auto itr = my->index.find( id );
+     if( itr != my->index.end() ) result = itr->second;
+     return result;
+  }
+
+  std::vector<block_log::entry> block_log::at_height( uint32_t h )const
+  {
+     std::vector<entry> result;
+     if( h >= my->by_height.size() ) return result;
+     for( auto itr = my->by_height[h].begin(); itr != my->by_height[h].end(); ++itr )
+     {
+        result.push_back( my->index.find( *itr )->second );
+     }
+     return result;
+  }
+
+  fc::optional<std::vector<char> > block_log::fetch( const pow_hash& id )const
+  {
+     fc::optional<std::vector<char> > result;
+     auto itr = my->index.find( id );
+     if( itr == my->index.end() ) return result;
+
+     const entry& e = itr->second;
+     std::vector<char> rec( detail::header_size + e.size + detail::checksum_size );
+     my->read_exact( rec.data(), rec.size(), e.offset );
+
+     uint64_t sum;
+     memcpy( &sum, rec.data() + detail::header_size + e.size, sizeof(sum) );
+     if( sum != detail::record_checksum( rec.data(), rec.data() + detail::header_size, e.size ) )
+     {
+        FC_THROW_EXCEPTION( exception, "block ${id} at ${offset} of ${file} is corrupt",
+                            ("id",id)("offset",e.offset)("file",my->file) );
+     }
+     result = std::vector<char>( rec.begin() + detail::header_size, rec.begin() + detail::header_size + e.size );
+     return result;
+  }
+
+  uint64_t block_log::size()const
+  {
+     return my->index.size();
+  }
+
+} // namespace bts
@@ -0,0 +1,97 @@
+#include <bts/blockchain/block_view.hpp>
+#include <fc/exception/exception.hpp>
+
+namespace bts {
+
+  namespace detail
+  {
+     /** skips count fixed size elements of a packed vector */
+     const char* skip_fixed( const char* pos, const char* end, uint32_t count, uint32_t size )
+     {
+        if( uint64_t(count) * size > uint64_t(end - pos) )
+        {
+           FC_THROW_EXCEPTION( exception, "${n} elements of ${s} bytes run past the end of the buffer",
+                               ("n",count)("s",size) );
+        }
+        return pos + count * size;
+     }
+  }
+
+  block_view::block_view()
+  :_begin(nullptr),_header_end(nullptr),_num_trxs(0),_trxs(nullptr),_trxs_end(nullptr),_end(nullptr){}
+
+  /**
+   *  Walks the fields of block_state in the order they are reflected.
+   */
+  block_view::block_view( const char* data, size_t size )
+  {
+     const char* end = data + size;
+     _begin = data;
+     {
+        fc::datastream<const char*> ds( data, size );
+        block_proof h;
+        fc::raw::unpack( ds, h );
+        _header_end = ds.pos();
+     }
+
+     const char* pos = detail::skip_fixed( _header_end, end, 1, sizeof(uint16_t) + 2*sizeof(fc::sha224) );
+     uint32_t num_features = detail::read_packed_size( pos, end );
+     for( uint32_t i = 0; i < num_features; ++i ) detail::read_packed_bytes( pos, end );
+
+     _num_trxs = detail::read_packed_size( pos, end );
+     _trxs     = pos;
+     for( uint32_t i = 0; i < _num_trxs; ++i )
+     {
+        pos += transaction_view( pos, end - pos ).bytes().size;
+     }
+     _trxs_end = pos;
+
+     uint32_t num_indexes = detail::read_packed_size( pos, end );
+     pos = detail::skip_fixed( pos, end, num_indexes, sizeof(uint32_t) );
+
+     uint32_t num_sources = detail::read_packed_size( pos, end );
+     for( uint32_t i = 0; i < num_sources; ++i )
+     {
+        // table_idx, block_num and the out_type of the generic_trx_out
+        pos = detail::skip_fixed( pos, end, 1, 2*sizeof(uint32_t) + sizeof(uint8_t) );
+        detail::read_packed_bytes( pos, end );
+     }
+
+     uint32_t num_dividends = detail::read_packed_size( pos, end );
+     _end = detail::skip_fixed( pos, end, num_dividends, sizeof(uint64_t) );
+  }
+
+  block_proof block_view::header()const
+  {
+     fc::datastream<const char*> ds( _begin, _header_end - _begin );
+     block_proof h;
+     fc::raw::unpack( ds, h );
+     return h;
+  }
+
+  packed_range block_view::header_bytes()const
+  {
+     return packed_range( _begin, _header_end - _begin );
+  }
+
+  uint32_t block_view::num_transactions()const
+  {
+     return _num_trxs;
+  }
+
+  packed_transaction_iterator block_view::transactions_begin()const
+  {
+     return packed_transaction_iterator( _trxs, _trxs_end );
+  }
+
+  packed_transaction_iterator block_view::transactions_end()const
+  {
+     return packed_transaction_iterator( _trxs_end, _trxs_end );
+  }
+
+  packed_range block_view::bytes()const
+  {
+     return packed_range( _begin, _end - _begin );
+  }
+
+} // namespace bts
@@ -1,14 +1,55 @@
 #include "chain_state.hpp"
+#include <bts/flat_hash.hpp>
+#include <bts/merkle_tree.hpp>
+#include <fc/crypto/city.hpp>
+#include <fc/exception/exception.hpp>
+#include <fc/io/raw.hpp>
+#include <fc/log/logger.hpp>
+#include <algorithm>
+#include <functional>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define CHAIN_STATE_SNAPSHOT_MAGIC    (0x73535442) // "BTSs"
+#define CHAIN_STATE_SNAPSHOT_VERSION  (2)
 
 struct output_state
 {
    output_state():block_num(0){}
+   output_state( const fc::sha224& id, uint32_t num )
+   :output_id(id),block_num(num){}
 
    fc::sha224 output_id;
    uint32_t   block_num;
 };
 FC_REFLECT( output_state, (output_id)(block_num) )
 
+/**
+ *  A snapshot is this header followed by the _outputs array and the
+ *  _freestack array exactly as they are laid out in memory, so loading one
+ *  is a copy rather than a parse, then the packed unspent_output of every
+ *  full slot in slot order.  Snapshots are a local cache that is only ever
+ *  read by the build that wrote it.
+ */
+struct chain_state_snapshot_header
+{
+   uint32_t      magic;
+   uint32_t      version;
+   uint64_t      num_outputs;
+   uint64_t      num_free;
+   uint64_t      record_bytes;
+   uint64_t      checksum;    ///< city_hash64 of everything after the header
+   fc::sha224    state;
+   bts::pow_hash head;
+   char          reserved[6];
+};
+static_assert( sizeof(output_state) == 32, "snapshots copy output_state as raw bytes" );
+
 namespace detail 
 {
 
@@ -18,8 +59,62 @@ namespace detail
         std::vector<uint32_t>       _freestack;
         std::vector<output_state>   _outputs;
 
-        std::unordered_map<fc::sha224,uint32_t> _index;
+        bts::flat_hash_map<fc::sha224,uint32_t> _index;
         fc::sha224                              _state;
+        /** one leaf per slot of _outputs, _state is its root */
+        bts::merkle_tree                        _tree;
+
+        struct slot_record
+        {
+           bts::output_reference     ref;
+           bts::output_pools::handle handle;
+        };
+        /** by slot, where the output in each full slot of _outputs is kept */
+        std::vector<slot_record>                _slot_records;
+        bts::output_pools                       _records;
+        /** the slots of the outputs in _records.by_address(), by claim address */
+        bts::flat_hash_map<bts::address,std::vector<uint32_t> > _address_slots;
+
+        static fc::sha224 slot_hash( const output_state& s )
+        {
+           if( s.output_id == fc::sha224() ) return fc::sha224();
+           return fc::sha224::hash( (const char*)&s, sizeof(s) );
+        }
+
+        /** @pre slot < _slot_records.size() and h is not in use by another slot */
+        void set_record( uint32_t slot, const bts::output_reference& ref, const bts::output_pools::handle& h )
+        {
+           _slot_records[slot].ref    = ref;
+           _slot_records[slot].handle = h;
+           if( h.type == bts::claim_by_address )
+           {
+              _address_slots[_records.by_address().get( h.index ).claim_address].push_back( slot );
+           }
+        }
+
+        /** @pre slot is full, erases its record */
+        void erase_record( uint32_t slot )
+        {
+           const bts::output_pools::handle& h = _slot_records[slot].handle;
+           if( h.type == bts::claim_by_address )
+           {
+              auto  itr   = _address_slots.find( _records.by_address().get( h.index ).claim_address );
+              auto& slots = itr->second;
+              *std::find( slots.begin(), slots.end(), slot ) = slots.back();
+              slots.pop_back();
+              if( slots.empty() ) _address_slots.erase( itr );
+           }
+           _records.erase( h );
+        }
+
+        unspent_output get_record( uint32_t slot )const
+        {
+           unspent_output o;
+           o.ref       = _slot_records[slot].ref;
+           o.output    = _records.get( _slot_records[slot].handle );
+           o.block_num = _outputs[slot].block_num;
+           return o;
+        }
    };
 
    class chain_state_transaction_impl
@@ -32,21 +127,208 @@ namespace detail
 
         struct action
         {
-           bool         add; // true for add, false for remove
-           output_state state;
+           bool           add; // true for add, false for remove
+           fc::sha224     output_id;
+           unspent_output out; ///< only for an add
         };
 
-        std::vector<action>                      _actions;
-        std::unordered_set<fc::sha224>           _added;
-        std::unordered_set<fc::sha224>           _removed;
+        std::vector<action>                                _actions;
+        bts::flat_hash_map<fc::sha224,unspent_output>      _added;
+        bts::flat_hash_set<fc::sha224>                     _removed;
         bool                                     _committed;
+
+        fc::sha224                               _init_state;
+        fc::sha224                               _final_state;
+        chain_state::change_set                  _changes; ///< journal of the last commit
    };
 }
 
 
 
-void chain_state::save( const fc::path& loc ){}
-void chain_state::load( const fc::path& loc ){}
+chain_state::chain_state()
+:my( new detail::chain_state_impl() )
+{
+}
+
+chain_state::~chain_state()
+{
+}
+
+chain_state& chain_state::operator=( chain_state&& s )
+{
+  my = std::move(s.my);
+  return *this;
+}
+
+void chain_state::save( const fc::path& loc, const bts::pow_hash& head )const
+{
+  FC_ASSERT( my->_tree.dirty.size() == 0, "update_state() must be called before saving" );
+
+  chain_state_snapshot_header h;
+  memset( &h, 0, sizeof(h) );
+  h.magic       = CHAIN_STATE_SNAPSHOT_MAGIC;
+  h.version     = CHAIN_STATE_SNAPSHOT_VERSION;
+  h.num_outputs = my->_outputs.size();
+  h.num_free    = my->_freestack.size();
+  h.state       = my->_state;
+  h.head        = head;
+
+  std::vector<unspent_output> unspent;
+  unspent.reserve( my->_index.size() );
+  const fc::sha224 null_output;
+  for( uint32_t i = 0; i < my->_outputs.size(); ++i )
+  {
+     if( my->_outputs[i].output_id != null_output ) unspent.push_back( my->get_record( i ) );
+  }
+  const std::vector<char> records = fc::raw::pack( unspent );
+  h.record_bytes = records.size();
+
+  const size_t out_bytes  = h.num_outputs * sizeof(output_state);
+  const size_t free_bytes = h.num_free * sizeof(uint32_t);
+  h.checksum = fc::city_hash64( (const char*)my->_outputs.data(), out_bytes ) ^
+               fc::city_hash64( (const char*)my->_freestack.data(), free_bytes ) ^
+               fc::city_hash64( records.data(), records.size() );
+
+  auto tmp = loc.generic_string() + ".tmp";
+  int fd = ::open( tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644 );
+  if( fd < 0 )
+  {
+     FC_THROW_EXCEPTION( exception, "unable to create ${file}: ${e}", ("file",tmp)("e",strerror(errno)) );
+  }
+
+  struct part { const char* data; size_t size; };
+  part parts[] = { { (const char*)&h, sizeof(h) },
+                   { (const char*)my->_outputs.data(), out_bytes },
+                   { (const char*)my->_freestack.data(), free_bytes },
+                   { records.data(), records.size() } };
+  for( auto p = parts; p != parts + 4; ++p )
+  {
+     while( p->size )
+     {
+        ssize_t w = ::write( fd, p->data, p->size );
+        if( w < 0 && errno == EINTR ) continue;
+        if( w <= 0 )
+        {
+           int e = errno;
+           ::close( fd );
+           FC_THROW_EXCEPTION( exception, "unable to write ${file}: ${e}", ("file",tmp)("e",strerror(e)) );
+        }
+        p->data += w; p->size -= w;
+     }
+  }
+
+  if( fsync( fd ) != 0 )
+  {
+     int e = errno;
+     ::close( fd );
+     FC_THROW_EXCEPTION( exception, "unable to sync ${file}: ${e}", ("file",tmp)("e",strerror(e)) );
+  }
+  ::close( fd );
+
+  if( rename( tmp.c_str(), loc.generic_string().c_str() ) != 0 )
+  {
+     FC_THROW_EXCEPTION( exception, "unable to replace ${file}: ${e}", ("file",loc)("e",strerror(errno)) );
+  }
+
+  // the rename only survives a crash once the directory entry is on disk
+  auto dir = loc.parent_path().generic_string();
+  if( dir.empty() ) dir = ".";
+  int dfd = ::open( dir.c_str(), O_RDONLY );
+  if( dfd < 0 || fsync( dfd ) != 0 )
+  {
+     int e = errno;
+     if( dfd >= 0 ) ::close( dfd );
+     FC_THROW_EXCEPTION( exception, "unable to sync ${dir}: ${e}", ("dir",dir)("e",strerror(e)) );
+  }
+  ::close( dfd );
+  ilog( "saved ${n} outputs at block ${head}", ("n",h.num_outputs - h.num_free)("head",head) );
+}
+
+/**
+ *  The snapshot is mapped rather than read so that the arrays are copied
+ *  straight out of the page cache, then _index is rebuilt from the
+ *  non-empty slots in one pass over a table reserved up front.
+ */
+bts::pow_hash chain_state::load( const fc::path& loc )
+{
+  int fd = ::open( loc.generic_string().c_str(), O_RDONLY );
+  if( fd < 0 )
+  {
+     FC_THROW_EXCEPTION( file_not_found_exception, "unable to open ${file}: ${e}", ("file",loc)("e",strerror(errno)) );
+  }
+
+  struct stat st;
+  if( fstat( fd, &st ) != 0 || size_t(st.st_size) < sizeof(chain_state_snapshot_header) )
+  {
+     ::close( fd );
+     FC_THROW_EXCEPTION( exception, "${file} is not a chain state snapshot", ("file",loc) );
+  }
+
+  void* map = mmap( nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0 );
+  ::close( fd );
+  if( map == MAP_FAILED )
+  {
+     FC_THROW_EXCEPTION( exception, "unable to map ${file}: ${e}", ("file",loc)("e",strerror(errno)) );
+  }
+  std::unique_ptr<void, std::function<void(void*)> > unmap( map, [&]( void* m ){ munmap( m, st.st_size ); } );
+
+  chain_state_snapshot_header h;
+  memcpy( &h, map, sizeof(h) );
+  const char* out_data  = (const char*)map + sizeof(h);
+  const char* free_data   = out_data + h.num_outputs * sizeof(output_state);
+  const char* record_data = free_data + h.num_free * sizeof(uint32_t);
+  if( h.magic != CHAIN_STATE_SNAPSHOT_MAGIC || h.version != CHAIN_STATE_SNAPSHOT_VERSION ||
+      uint64_t(st.st_size) != sizeof(h) + h.num_outputs * sizeof(output_state) + h.num_free * sizeof(uint32_t) + h.record_bytes )
+  {
+     FC_THROW_EXCEPTION( exception, "${file} is not a chain state snapshot", ("file",loc) );
+  }
+  if( h.checksum != (fc::city_hash64( out_data, h.num_outputs * sizeof(output_state) ) ^
+                     fc::city_hash64( free_data, h.num_free * sizeof(uint32_t) ) ^
+                     fc::city_hash64( record_data, h.record_bytes )) )
+  {
+     FC_THROW_EXCEPTION( exception, "chain state snapshot ${file} is corrupt", ("file",loc) );
+  }
+
+  std::unique_ptr<detail::chain_state_impl> s( new detail::chain_state_impl() );
+  s->_outputs.resize( h.num_outputs );
+  s->_freestack.resize( h.num_free );
+  memcpy( s->_outputs.data(), out_data, h.num_outputs * sizeof(output_state) );
+  memcpy( s->_freestack.data(), free_data, h.num_free * sizeof(uint32_t) );
+  s->_state = h.state;
+
+  std::vector<unspent_output> unspent;
+  fc::datastream<const char*> ds( record_data, h.record_bytes );
+  fc::raw::unpack( ds, unspent );
+  FC_ASSERT( unspent.size() == h.num_outputs - h.num_free, "${file} has a record for ${r} of ${n} outputs",
+             ("file",loc)("r",unspent.size())("n",h.num_outputs - h.num_free) );
+
+  s->_index.reserve( unspent.size() );
+  s->_tree.resize( h.num_outputs );
+  s->_slot_records.resize( h.num_outputs );
+  const fc::sha224 null_output;
+  auto next = unspent.begin();
+  for( uint32_t i = 0; i < s->_outputs.size(); ++i )
+  {
+     if( s->_outputs[i].output_id != null_output )
+     {
+        FC_ASSERT( chain_state::output_id( next->ref ) == s->_outputs[i].output_id &&
+                   next->block_num == s->_outputs[i].block_num,
+                   "the record of slot ${i} in ${file} is not its output", ("i",i)("file",loc) );
+        s->_index[s->_outputs[i].output_id] = i;
+        s->_tree.set( i, detail::chain_state_impl::slot_hash( s->_outputs[i] ) );
+        s->set_record( i, next->ref, s->_records.store( next->output ) );
+        ++next;
+     }
+  }
+  if( s->_tree.update_root() != s->_state )
+  {
+     FC_THROW_EXCEPTION( exception, "outputs in ${file} do not match the state ${s}", ("file",loc)("s",s->_state) );
+  }
+
+  my = std::move(s);
+  ilog( "loaded ${n} outputs at block ${head}", ("n",my->_index.size())("head",h.head) );
+  return h.head;
+}
 
 /** @return the state to include in the blockchain */
 fc::sha224 chain_state::get_state()const
@@ -54,53 +336,178 @@ fc::sha224 chain_state::get_state()const
   return my->_state;
 }
 
+fc::sha224 chain_state::update_state()
+{
+  my->_state = my->_tree.update_root();
+  return my->_state;
+}
+
+fc::sha224 chain_state::output_id( const bts::output_reference& ref )
+{
+  fc::sha224::encoder enc;
+  fc::raw::pack( enc, ref );
+  return enc.result();
+}
+
 bool    chain_state::contains( const fc::sha224& out )const
 {
   return my->_index.find(out) != my->_index.end();
 }
 
+unspent_output chain_state::get_output( const bts::output_reference& ref )const
+{
+  auto itr = my->_index.find( output_id( ref ) );
+  if( itr == my->_index.end() )
+  {
+    FC_THROW_EXCEPTION( key_not_found_exception, "unable to find output ${idx} of ${trx}",
+                        ("idx",ref.output_idx)("trx",fc::string(ref.trx_hash)) );
+  }
+  return my->get_record( itr->second );
+}
+
+std::vector<unspent_output> chain_state::get_outputs_for_address( const bts::address& a )const
+{
+  std::vector<unspent_output> r;
+  auto itr = my->_address_slots.find( a );
+  if( itr == my->_address_slots.end() ) return r;
+
+  r.reserve( itr->second.size() );
+  for( auto slot = itr->second.begin(); slot != itr->second.end(); ++slot )
+  {
+     r.push_back( my->get_record( *slot ) );
+  }
+  return r;
+}
+
 int32_t chain_state::get_block_num_for_output( const fc::sha224& out )
 {
   auto itr = my->_index.find(out);
   if( itr != my->_index.end() )
   {
-    return _outputs[itr->second].block_num;
+    return my->_outputs[itr->second].block_num;
   }
   FC_THROW_EXCEPTION( key_not_found_exception, "unable to find output ${out}", ("out", fc::string(out)) );
 }
 
 
-void chain_state::add_output( const fc::sha224& out, uint32_t block_num )
+void chain_state::undo( const change_set& changes )
 {
-    if( _freestack.size() == 0 )
+  for( auto itr = changes.rbegin(); itr != changes.rend(); ++itr )
+  {
+     revert( *itr );
+  }
+  update_state();
+}
+
+chain_state_change chain_state::add_output( const unspent_output& o )
+{
+    const fc::sha224 out = output_id( o.ref );
+    chain_state_change c;
+    c.add       = true;
+    c.output_id = out;
+    c.block_num = o.block_num;
+
+    // the only step that can fail, so it goes before any slot is touched
+    auto h = my->_records.store( o.output );
+
+    if( my->_freestack.size() == 0 )
     {
-      _outputs.push_back( output_state(out,block_num) );
-      my->_index[out] = _outputs.size() - 1;
-      return;
+      my->_outputs.push_back( output_state(out,o.block_num) );
+      my->_slot_records.resize( my->_outputs.size() );
+      my->_index[out] = my->_outputs.size() - 1;
+      my->_tree.resize( my->_outputs.size() );
+      my->_tree.set( my->_outputs.size() - 1, my->slot_hash( my->_outputs.back() ) );
+      c.slot = my->_outputs.size() - 1;
+      c.end  = true;
+      my->set_record( c.slot, o.ref, h );
+      return c;
     }
 
     auto idx = my->_freestack.back();
     my->_freestack.pop_back();
-    my->_outputs[idx] = output_state(out, block_num);
+    my->_outputs[idx] = output_state(out, o.block_num);
     my->_index[out] = idx;
+    my->_tree.set( idx, my->slot_hash( my->_outputs[idx] ) );
+    c.slot = idx;
+    my->set_record( c.slot, o.ref, h );
+    return c;
 }
 
-void chain_state::remove_output( const fc::sha224& out )
+chain_state_change chain_state::remove_output( const fc::sha224& out )
 {
   auto itr = my->_index.find(out);
-  if( itr != my->_index.end() )
+  if( itr == my->_index.end() )
+  {
+     FC_THROW_EXCEPTION( key_not_found_exception, "unable to find output ${out}", ("out", fc::string(out)) );
+  }
+
+  chain_state_change c;
+  c.output_id = out;
+  c.slot      = itr->second;
+  c.block_num = my->_outputs[c.slot].block_num;
+
+  auto record = my->get_record( c.slot );
+  c.ref    = record.ref;
+  c.output = std::move(record.output);
+  my->erase_record( c.slot );
+
+  my->_outputs[c.slot] = output_state();
+  if( c.slot != my->_outputs.size() -1 )
+  {
+     my->_freestack.push_back(c.slot);
+     my->_tree.set( c.slot, fc::sha224() );
+  }
+  else 
+  {
+     my->_outputs.pop_back();
+     my->_slot_records.pop_back();
+     my->_tree.resize( my->_outputs.size() );
+     c.end = true;
+  }
+  my->_index.erase(itr);
+  return c;
+}
+
+void chain_state::revert( const chain_state_change& c )
+{
+  if( c.add )
   {
-     my->_outputs[itr->second] = output_state();
-     if( itr->second != my->_outputs.size() -1 )
+     FC_ASSERT( c.slot < my->_outputs.size() && my->_outputs[c.slot].output_id == c.output_id );
+     my->_index.erase( c.output_id );
+     my->erase_record( c.slot );
+     if( c.end )
      {
-        my->_freestack.push_back(itr->second);
+        FC_ASSERT( c.slot == my->_outputs.size() - 1 );
+        my->_outputs.pop_back();
+        my->_slot_records.pop_back();
+        my->_tree.resize( my->_outputs.size() );
      }
-     else 
+     else
      {
-        my->_outputs.pop_back();
+        my->_outputs[c.slot] = output_state();
+        my->_freestack.push_back( c.slot );
+        my->_tree.set( c.slot, fc::sha224() );
      }
-     my->_index.erase(itr);
+     return;
+  }
+
+  FC_ASSERT( !contains( c.output_id ) );
+  FC_ASSERT( c.end ? c.slot == my->_outputs.size() : my->_freestack.size() && my->_freestack.back() == c.slot );
+  auto h = my->_records.store( c.output );
+  if( c.end )
+  {
+     my->_outputs.push_back( output_state( c.output_id, c.block_num ) );
+     my->_slot_records.resize( my->_outputs.size() );
+     my->_tree.resize( my->_outputs.size() );
+  }
+  else
+  {
+     my->_freestack.pop_back();
+     my->_outputs[c.slot] = output_state( c.output_id, c.block_num );
   }
+  my->_index[c.output_id] = c.slot;
+  my->_tree.set( c.slot, my->slot_hash( my->_outputs[c.slot] ) );
+  my->set_record( c.slot, c.ref, h );
 }
 
 
@@ -108,16 +515,53 @@ chain_state_transaction::chain_state_transaction( chain_state& s )
 :my( new detail::chain_state_transaction_impl(s) )
 {
   my->_committed = false;
+  my->_init_state = s.get_state();
 }
 
 chain_state_transaction::~chain_state_transaction()
 {
 }
 
-void chain_state_transaction::reset() 
+std::vector<char> chain_state_transaction::pack()const
+{
+  FC_ASSERT( my->_committed, "only a committed transaction has a journal" );
+  fc::datastream<size_t> ps;
+  fc::raw::pack( ps, my->_init_state );
+  fc::raw::pack( ps, my->_final_state );
+  fc::raw::pack( ps, my->_changes );
+
+  std::vector<char> data( ps.tellp() );
+  fc::datastream<char*> ds( data.data(), data.size() );
+  fc::raw::pack( ds, my->_init_state );
+  fc::raw::pack( ds, my->_final_state );
+  fc::raw::pack( ds, my->_changes );
+  return data;
+}
+
+void chain_state_transaction::unpack( const char* vec, size_t len )
 {
-  _actions.clear();
+  fc::datastream<const char*> ds( vec, len );
+  fc::sha224              init, final_state;
+  chain_state::change_set changes;
+  fc::raw::unpack( ds, init );
+  fc::raw::unpack( ds, final_state );
+  fc::raw::unpack( ds, changes );
+
+  reset();
+  my->_init_state  = init;
+  my->_final_state = final_state;
+  my->_changes     = std::move(changes);
+  my->_committed   = true;
+}
 
+void chain_state_transaction::reset() 
+{
+  my->_actions.clear();
+  my->_added.clear();
+  my->_removed.clear();
+  my->_changes.clear();
+  my->_committed  = false;
+  my->_init_state = my->_cstate.get_state();
 }
 
 fc::sha224 chain_state_transaction::initial_condition()const
@@ -129,17 +573,51 @@ fc::sha224 chain_state_transaction::final_condition()const
   return my->_final_state;
 }
 
+const chain_state::change_set& chain_state_transaction::changes()const
+{
+  return my->_changes;
+}
+
 /** @return true if either this transaction or the underlying chain_state 
  *           contains out *and* it has not been removed by this state
  *           transaction.
  */
 bool chain_state_transaction::contains( const fc::sha224& out )const
 {
+  if( my->_added.count(out) )   return true;
+  if( my->_removed.count(out) ) return false;
+  return my->_cstate.contains(out);
 }
 
-/** adds an output at the specified block_height */
-void chain_state_transaction::add_output( const fc::sha224& out, uint32_t block_num )
+unspent_output chain_state_transaction::get_output( const bts::output_reference& ref )const
 {
+  auto id    = chain_state::output_id( ref );
+  auto added = my->_added.find( id );
+  if( added != my->_added.end() ) return added->second;
+  if( my->_removed.count( id ) )
+  {
+    FC_THROW_EXCEPTION( key_not_found_exception, "output ${idx} of ${trx} was already spent",
+                        ("idx",ref.output_idx)("trx",fc::string(ref.trx_hash)) );
+  }
+  return my->_cstate.get_output( ref );
+}
+
+void chain_state_transaction::add_output( const bts::output_reference& ref, const bts::generic_trx_out& out, uint32_t block_num )
+{
+  FC_ASSERT( !my->_committed );
+  auto id = chain_state::output_id( ref );
+  if( contains(id) )
+  {
+     FC_THROW_EXCEPTION( exception, "output ${out} is already unspent", ("out", fc::string(id)) );
+  }
+  detail::chain_state_transaction_impl::action a;
+  a.add           = true;
+  a.output_id     = id;
+  a.out.ref       = ref;
+  a.out.output    = out;
+  a.out.block_num = block_num;
+  my->_added[id]  = a.out;
+  my->_actions.push_back( std::move(a) );
 }
 
 /** 
@@ -147,6 +625,16 @@ void chain_state_transaction::add_output( const fc::sha224& out, uint32_t block_
  */
 void  chain_state_transaction::remove_output( const fc::sha224& out )
 {
+  FC_ASSERT( !my->_committed );
+  if( !contains(out) )
+  {
+     FC_THROW_EXCEPTION( key_not_found_exception, "unable to find output ${out}", ("out", fc::string(out)) );
+  }
+  detail::chain_state_transaction_impl::action a;
+  a.add       = false;
+  a.output_id = out;
+  my->_actions.push_back( a );
+  if( !my->_added.erase( out ) ) my->_removed.insert( out );
 }
 
 /**
@@ -155,6 +643,30 @@ void  chain_state_transaction::remove_output( const fc::sha224& out )
  */
 void chain_state_transaction::commit()
 {
+  FC_ASSERT( !my->_committed );
+  my->_init_state = my->_cstate.get_state();
+  my->_changes.clear();
+  my->_changes.reserve( my->_actions.size() );
+  try
+  {
+     for( auto itr = my->_actions.begin(); itr != my->_actions.end(); ++itr )
+     {
+        if( itr->add ) my->_changes.push_back( my->_cstate.add_output( itr->out ) );
+        else           my->_changes.push_back( my->_cstate.remove_output( itr->output_id ) );
+     }
+  }
+  catch ( ... )
+  {
+     my->_cstate.undo( my->_changes );
+     my->_changes.clear();
+     throw;
+  }
+  my->_final_state = my->_cstate.update_state();
+
+  my->_actions.clear();
+  my->_added.clear();
+  my->_removed.clear();
+  my->_committed = true;
 }
 
 /**
@@ -163,4 +675,13 @@ void chain_state_transaction::commit()
  */
 void chain_state_transaction::undo()
 {
+  FC_ASSERT( my->_committed, "only a committed transaction can be undone" );
+  if( my->_cstate.get_state() != my->_final_state )
+  {
+     FC_THROW_EXCEPTION( exception, "chain state ${s} is not the final condition ${f} of this transaction",
+                         ("s",my->_cstate.get_state())("f",my->_final_state) );
+  }
+  my->_cstate.undo( my->_changes );
+  FC_ASSERT( my->_cstate.get_state() == my->_init_state );
+  my->_committed = false;
 }
@@ -1,7 +1,44 @@
 #pragma once
+#include <bts/proof_of_work.hpp>
+#include <bts/blockchain/output_pool.hpp>
+#include <fc/crypto/sha224.hpp>
+#include <fc/filesystem.hpp>
 #include <memory>
+#include <vector>
 
-namespace detail { class chain_state_impl; }
+namespace detail { class chain_state_impl; class chain_state_transaction_impl; }
+
+/**
+ *  An unspent output, the transaction output it was created by and the
+ *  block it was included in.
+ */
+struct unspent_output
+{
+   unspent_output():block_num(0){}
+
+   bts::output_reference ref;
+   bts::generic_trx_out  output;
+   uint32_t              block_num;
+};
+
+/**
+ *  One slot level change to the chain_state, enough to put the slot array,
+ *  the free list and the output records back exactly as they were before it.
+ */
+struct chain_state_change
+{
+   chain_state_change():add(false),end(false),slot(0),block_num(0){ output.out_type = 0; }
+
+   bool       add;       ///< false if the output was removed
+   bool       end;       ///< the slot was appended to or popped from the end of the array
+   uint32_t   slot;
+   fc::sha224 output_id;
+   uint32_t   block_num;
+
+   /** the removed output so that reverting stores it again, empty for an add */
+   bts::output_reference ref;
+   bts::generic_trx_out  output;
+};
 
 /**
  *  Maintains the set of 'unspent outputs' and which
@@ -25,9 +62,10 @@ namespace detail { class chain_state_impl; }
  *  removing outputs. Each header includes the delta change
  *  in the balance of all shares/shorts.  
  *
- *  The chain_state only stores the hashes to the actual
- *  outputs along with the block index which included
- *  the output.  Actual outputs are managed by the database.
+ *  Each slot hashes only the id of its output and the block index
+ *  which included it, the outputs themselves are kept decoded in
+ *  bts::output_pools beside the slots so that validation and wallet
+ *  lookups never go to disk.
  *
  *  Internally the chain-state is managed as an array of
  *  output-hashes combined with a 'free-list' that 
@@ -36,33 +74,86 @@ namespace detail { class chain_state_impl; }
  *  be made to the output set without requiring rehashing
  *  the entire chain_state.
  *
- *  *note* merkel tree implementation is TBD
+ *  Adding or removing an output only marks its slot in the tree,
+ *  update_state() rehashes the marked branches once per block.
  */
 class chain_state
 {
    public:
+     /** the changes made by one block, in the order they were made */
+     typedef std::vector<chain_state_change> change_set;
+
      chain_state();
      ~chain_state();
 
-     void save( const fc::path& loc );
-     void load( const fc::path& loc );
+     /** takes over the outputs of s, which must not be used afterwards */
+     chain_state& operator=( chain_state&& s );
+
+     /**
+      *  Writes a snapshot of the unspent outputs, the free list and the
+      *  state hash taken right after head was applied.  The snapshot is
+      *  written next to loc and renamed over it once it is on disk, so loc
+      *  always holds a complete snapshot.
+      *
+      *  @pre update_state() was called after the last change
+      */
+     void     save( const fc::path& loc, const bts::pow_hash& head )const;
+
+     /**
+      *  Replaces the current state with the snapshot at loc, the current
+      *  state is left untouched if the snapshot is damaged or its outputs
+      *  do not hash to the state it was saved with.
+      *
+      *  @return the head block the snapshot was taken at
+      */
+     bts::pow_hash load( const fc::path& loc );
 
      /** @return the state to include in the blockchain */
      fc::sha224 get_state()const;
 
+     /**
+      *  Rehashes the slots changed since the last call, O(changes * log(slots)).
+      *
+      *  @return the new get_state()
+      */
+     fc::sha224 update_state();
+
+     /**
+      *  The id an output is stored under.  The transaction hash covers the
+      *  output so the id, and therefore the state, does too.
+      */
+     static fc::sha224 output_id( const bts::output_reference& ref );
+
      bool contains( const fc::sha224& out )const;
      int32_t get_block_num_for_output( const fc::sha224& out );
 
+     /** @throw key_not_found_exception if ref is not unspent */
+     unspent_output get_output( const bts::output_reference& ref )const;
+
+     /** every unspent output claimed by the signature of a, in no particular order, O(outputs of a) */
+     std::vector<unspent_output> get_outputs_for_address( const bts::address& a )const;
+
+     /**
+      *  Reverts changes in reverse order and updates the state, the cost
+      *  is O(changes) no matter how many outputs there are.
+      */
+     void undo( const change_set& changes );
+
    private:
      /**
-      * @return the index where the output was stored.
+      * @return the slot where the output was stored.
+      * @throw if the output is not of a type output_pools can store
       */
-     void add_output( const fc::sha224& out, uint32_t block_num );
+     chain_state_change add_output( const unspent_output& out );
 
      /** 
-      *  @return the index where the output was stored, now null
+      *  @return the slot where the output was stored, now null
+      *  @throw key_not_found_exception if out is not unspent
       */
-     void remove_output( const fc::sha224& out );
+     chain_state_change remove_output( const fc::sha224& out );
+
+     /** puts the slot array and free list back to before c was made */
+     void revert( const chain_state_change& c );
 
      friend class chain_state_transaction;
      std::unique_ptr<detail::chain_state_impl> my;
@@ -86,13 +177,16 @@ class chain_state_transaction
      chain_state_transaction( chain_state& s );
      ~chain_state_transaction();
 
-     // saves this transaction so it can be stored in the block db
+     // saves the journal of a committed transaction so it can be stored in the block db
      std::vector<char> pack()const;
 
-     // loads this transaction, so that it can be loaded from the block db
+     // loads the journal of a committed transaction, so that it can be undone
      void              unpack( const char* vec, size_t len );
 
-     void reset(); // drops all changes and restors state to s.get_state()
+     void reset(); // drops all changes and the journal so the transaction can be reused
+
+     /** the journal of the last commit(), what undo() reverts */
+     const chain_state::change_set& changes()const;
 
      fc::sha224 initial_condition()const; // after calling reset
      fc::sha224 final_condition()const; // after calling commit
@@ -103,8 +197,15 @@ class chain_state_transaction
       */
      bool contains( const fc::sha224& out )const;
 
-     /** adds an output at the specified block_height */
-     void add_output( const fc::sha224& out, uint32_t block_num );
+     /**
+      *  @return the output if it was added by this transaction, or is in
+      *          the underlying chain_state and was not removed by it
+      *  @throw key_not_found_exception otherwise
+      */
+     unspent_output get_output( const bts::output_reference& ref )const;
+
+     /** adds output ref of a transaction in block block_num */
+     void add_output( const bts::output_reference& ref, const bts::generic_trx_out& out, uint32_t block_num );
 
      /** 
       *  @return the index where the output was stored, now null
@@ -114,6 +215,11 @@ class chain_state_transaction
      /**
       * Applies all changes from this transaction to chain state and
       * updates 'final_condition' to the new chain_state::get_state()
+      *
+      * Changes are buffered until commit so that a transaction that
+      * fails to apply only has to be reset, the journal records each
+      * slot as it is actually written.  If an output cannot be stored
+      * the changes already made are reverted before rethrowing.
       */
      void commit();
 
@@ -125,3 +231,7 @@ class chain_state_transaction
    private:
      std::unique_ptr<detail::chain_state_transaction_impl> my;
 };
+
+#include <fc/reflect/reflect.hpp>
+FC_REFLECT( unspent_output, (ref)(output)(block_num) )
+FC_REFLECT( chain_state_change, (add)(end)(slot)(output_id)(block_num)(ref)(output) )
@@ -6,10 +6,9 @@
 #include <fc/exception/exception.hpp>
 #include <fc/io/fstream.hpp>
 #include <fc/io/raw.hpp>
+#include <bts/flat_hash.hpp>
 #include <algorithm>
 
-#include <unordered_map>
-
 #define OUTPUTS_PER_CHUNK  uint64_t(2*1024*1024/sizeof(bts::output_by_address_table::entry))
 
 
@@ -47,7 +46,7 @@ namespace bts
            *
            *  TODO: find a way to save / load this to accelerate startup
            */
-          std::unordered_map<output_reference, uint32_t> output_index;
+          flat_hash_map<output_reference, uint32_t, output_reference_hash> output_index;
 
           std::vector<mmap_entry_chunk_ptr>  entries;
           std::vector<bool>                  dirty_chunks;
@@ -0,0 +1,66 @@
+#include <bts/duty_cycle.hpp>
+
+namespace bts {
+
+  duty_cycle::duty_cycle( fc::microseconds window )
+  :_window(window),_busy_us(0),_count(0){}
+
+  void duty_cycle::reset()
+  {
+     _samples.clear();
+     _busy_us = 0;
+     _count   = 0;
+  }
+
+  void duty_cycle::record( const fc::time_point& start, const fc::time_point& end, uint64_t count )
+  {
+     sample s;
+     s.start = start;
+     s.end   = end;
+     s.count = count;
+     _samples.push_back(s);
+     _busy_us += (end - start).count();
+     _count   += count;
+     trim( end );
+  }
+
+  void duty_cycle::trim( const fc::time_point& now )
+  {
+     // always keep the most recent sample so there is something to measure
+     while( _samples.size() > 1 && _samples.front().end < now - _window )
+     {
+        _busy_us -= (_samples.front().end - _samples.front().start).count();
+        _count   -= _samples.front().count;
+        _samples.pop_front();
+     }
+  }
+
+  fc::microseconds duty_cycle::idle_time( float effort, const fc::time_point& now )
+  {
+     trim( now );
+     if( effort >= 1 || _samples.empty() ) return fc::microseconds(0);
+     if( effort <= 0 ) return _window;
+
+     // busy / (elapsed + idle) == effort
+     int64_t elapsed = (now - _samples.front().start).count();
+     int64_t idle    = int64_t( _busy_us / effort ) - elapsed;
+     return fc::microseconds( idle > 0 ? idle : 0 );
+  }
+
+  double duty_cycle::rate( const fc::time_point& now )
+  {
+     trim( now );
+     if( _samples.empty() ) return 0;
+     int64_t elapsed = (now - _samples.front().start).count();
+     return elapsed > 0 ? _count * 1000000.0 / elapsed : 0;
+  }
+
+  double duty_cycle::utilization( const fc::time_point& now )
+  {
+     trim( now );
+     if( _samples.empty() ) return 0;
+     int64_t elapsed = (now - _samples.front().start).count();
+     return elapsed > 0 ? double(_busy_us) / elapsed : 0;
+  }
+
+} // namespace bts
@@ -0,0 +1,125 @@
+#include <bts/merkle_tree.hpp>
+#include <fc/exception/exception.hpp>
+#include <algorithm>
+
+namespace bts {
+
+  fc::sha224 merkle_tree::hash_pair( const fc::sha224& left, const fc::sha224& right )
+  {
+     char buf[2*sizeof(fc::sha224)];
+     memcpy( buf, &left, sizeof(left) );
+     memcpy( buf + sizeof(left), &right, sizeof(right) );
+     return fc::sha224::hash( buf, sizeof(buf) );
+  }
+
+  fc::sha224 merkle_branch::calculate_root()const
+  {
+     if( mid_states.size() == 0 ) return fc::sha224();
+     fc::sha224 h = mid_states[0];
+     for( uint32_t i = 1; i < mid_states.size(); ++i )
+     {
+        if( (branch >> (i-1)) & 1 ) h = merkle_tree::hash_pair( mid_states[i], h );
+        else                        h = merkle_tree::hash_pair( h, mid_states[i] );
+     }
+     return h;
+  }
+
+  void merkle_tree::resize( uint64_t s )
+  {
+     if( mtree.size() == 0 ) mtree.resize(1);
+     uint64_t old = mtree[0].size();
+     mtree[0].resize( s );
+     for( uint64_t i = old; i < s; ++i ) dirty.push_back(i);
+     // the last leaf lost its sibling
+     if( s < old && s > 0 ) dirty.push_back( s - 1 );
+  }
+
+  uint64_t merkle_tree::size()const
+  {
+     return mtree.size() ? mtree[0].size() : 0;
+  }
+
+  void merkle_tree::set( uint64_t index, const fc::sha224& val )
+  {
+     if( index >= size() )
+     {
+        FC_THROW_EXCEPTION( out_of_range_exception, "index ${i} of ${s}", ("i",index)("s",size()) );
+     }
+     mtree[0][index] = val;
+     dirty.push_back( index );
+  }
+
+  fc::sha224 merkle_tree::get( uint64_t index )const
+  {
+     if( index >= size() )
+     {
+        FC_THROW_EXCEPTION( out_of_range_exception, "index ${i} of ${s}", ("i",index)("s",size()) );
+     }
+     return mtree[0][index];
+  }
+
+  const fc::sha224& merkle_tree::update_root()
+  {
+     const uint64_t n = size();
+     if( n == 0 )
+     {
+        mtree.resize( mtree.size() ? 1 : 0 );
+        dirty.clear();
+        mroot = fc::sha224();
+        return mroot;
+     }
+
+     uint32_t levels = 1;
+     for( uint64_t s = n; s > 1; s = (s+1)/2 ) ++levels;
+     mtree.resize( levels );
+     for( uint32_t l = 1; l < levels; ++l ) mtree[l].resize( (mtree[l-1].size()+1)/2 );
+
+     std::sort( dirty.begin(), dirty.end() );
+     dirty.erase( std::unique( dirty.begin(), dirty.end() ), dirty.end() );
+     dirty.erase( std::lower_bound( dirty.begin(), dirty.end(), n ), dirty.end() );
+
+     // walk the dirty nodes up one level at a time, siblings share a parent
+     std::vector<uint64_t> parents;
+     const fc::sha224      null_hash;
+     for( uint32_t l = 1; l < levels; ++l )
+     {
+        parents.clear();
+        for( auto itr = dirty.begin(); itr != dirty.end(); ++itr )
+        {
+           if( parents.empty() || parents.back() != *itr / 2 ) parents.push_back( *itr / 2 );
+        }
+
+        const std::vector<fc::sha224>& below = mtree[l-1];
+        for( auto itr = parents.begin(); itr != parents.end(); ++itr )
+        {
+           uint64_t left = 2 * *itr;
+           mtree[l][*itr] = hash_pair( below[left], left + 1 < below.size() ? below[left+1] : null_hash );
+        }
+        dirty.swap( parents );
+     }
+
+     dirty.clear();
+     mroot = mtree.back()[0];
+     return mroot;
+  }
+
+  merkle_branch merkle_tree::get_branch( uint32_t index )const
+  {
+     FC_ASSERT( dirty.size() == 0, "update_root() must be called before get_branch()" );
+     if( index >= size() )
+     {
+        FC_THROW_EXCEPTION( out_of_range_exception, "index ${i} of ${s}", ("i",index)("s",size()) );
+     }
+
+     merkle_branch b;
+     b.branch = index;
+     b.mid_states.push_back( mtree[0][index] );
+     for( uint32_t l = 0; l + 1 < mtree.size(); ++l, index /= 2 )
+     {
+        uint64_t sibling = index ^ 1;
+        b.mid_states.push_back( sibling < mtree[l].size() ? mtree[l][sibling] : fc::sha224() );
+     }
+     return b;
+  }
+
+} // namespace bts
@@ -1,20 +1,172 @@
 #include "miner.hpp"
+#include "account.hpp"
+#include <fc/crypto/sha256.hpp>
+#include <fc/log/logger.hpp>
 
 
-miner::miner( block_chain& bc, account& a )
-:_block_chain(bc),_mining_account(a)
+miner::miner( block_chain& bc, account& a, const bts::mining_pool_ptr& pool )
+:_self( fc::thread::current() ),
+ _block_chain(bc),
+ _mining_account(a),
+ _effort(0),
+ _pool( pool ? pool : std::make_shared<bts::mining_pool>() ),
+ _block_ver(0)
 {
+   _changed_connection = _block_chain.changed.connect( [this]()
+   {
+      if( _effort > 0 ) start_new_block();
+   });
 }
 
 miner::~miner()
 {
+   _block_chain.changed.disconnect( _changed_connection );
+   stop();
 }
 
 void miner::start( float effort )
 {
+   FC_ASSERT( effort >= 0 && effort <= 1, "effort must be a fraction of a core", ("effort",effort) );
+   if( effort == 0 )
+   {
+      stop();
+      return;
+   }
+
+   bool kickoff = _effort <= 0;
+   _effort = effort;
+   if( kickoff )
+   {
+      start_new_block();
+   }
 }
 
 void miner::stop()
 {
+   _effort = 0;
+   ++_block_ver;
+   for( uint32_t i = 0; i < _mining_complete.size(); ++i )
+   {
+      if( _mining_complete[i].valid() ) _mining_complete[i].wait();
+   }
+}
+
+void miner::set_thread_count( uint32_t n )
+{
+   _pool->resize( n );
+   if( _effort > 0 ) start_new_block();
+}
+
+uint32_t miner::thread_count()const
+{
+   return _pool->size();
+}
+
+double miner::hashes_per_sec()const
+{
+   auto   now   = fc::time_point::now();
+   double total = 0;
+   std::unique_lock<std::mutex> lock( _stats_mutex );
+   for( uint32_t i = 0; i < _duty.size(); ++i )
+   {
+      total += _duty[i].rate( now );
+   }
+   return total;
+}
+
+/**
+ *  Called whenever the head changes (or the thread count or effort
+ *  changes), abandons the current search and starts a new one on top of
+ *  the current head.
+ */
+void miner::start_new_block()
+{
+   auto       next_blk = ++_block_ver;
+   bts::block b        = _block_chain.generate_next_block( _mining_account.get_new_address() );
+   auto       target   = block_chain::target_for_difficulty( _block_chain.current_difficulty() );
+
+   const uint32_t n = _pool->size();
+   {
+      std::unique_lock<std::mutex> lock( _stats_mutex );
+      if( _duty.size() < n ) _duty.resize( n );
+   }
+   while( _buffers.size() < n ) _buffers.push_back( bts::pow_buffer() );
+   if( _mining_complete.size() < n ) _mining_complete.resize( n );
+
+   for( uint32_t i = 0; i < n; ++i )
+   {
+      unsigned char* buffer = _buffers[i].data();
+      _mining_complete[i] = _pool->at(i).async( [=](){ mine( b, i, n, next_blk, target, buffer ); } );
+   }
+}
+
+/**
+ *  Called on the thread that owns the miner once any thread finds a
+ *  solution for version ver of the block.
+ */
+void miner::found_block( const bts::block& b, uint64_t ver )
+{
+   if( ver != _block_ver ) return; // another thread or a new head got there first
+   ++_block_ver; // stop the other threads
+
+   try
+   {
+      ilog( "found block ${h} with nonce ${n}", ("h",b.block_num)("n",b.pow.nonce) );
+      _block_chain.add_block( b );
+   }
+   catch ( const fc::exception& e )
+   {
+      elog( "unable to add mined block: ${e}", ("e",e.to_detail_string()) );
+   }
+
+   // add_block normally fires 'changed' which restarts the search
+   if( _block_ver == ver + 1 && _effort > 0 )
+   {
+      start_new_block();
+   }
 }
 
+/**
+ *  Called from mining thread
+ *
+ *  Thread i tests nonces congruent to i modulo stride using its own scratch
+ *  buffer (_buffers[i]), idling between hashes as needed to stay at _effort.
+ */
+void miner::mine( bts::block b, uint32_t thread_num, uint32_t stride, uint64_t ver, bts::pow_hash target, unsigned char* buffer )
+{
+   b.pow.nonce = thread_num;
+
+   const fc::microseconds slice( MINING_SLICE_USEC );
+   while( ver == _block_ver )
+   {
+      auto start = fc::time_point::now();
+      bts::pow_hash pow;
+      if( !bts::proof_of_work( block_chain::pow_seed( b ), buffer,
+                               [&](){ return ver != _block_ver; }, pow ) )
+      {
+         return; // a new head or stop() made this block stale
+      }
+      auto end   = fc::time_point::now();
+
+      fc::microseconds idle;
+      {
+         std::unique_lock<std::mutex> lock( _stats_mutex );
+         _duty[thread_num].record( start, end, 1 );
+         idle = _duty[thread_num].idle_time( _effort, end );
+      }
+
+      if( pow < target )
+      {
+         _self.async( [=](){ found_block( b, ver ); } );
+         return;
+      }
+      b.pow.nonce += stride;
+
+      while( idle.count() > 0 && ver == _block_ver )
+      {
+         auto nap = idle < slice ? idle : slice;
+         fc::usleep( nap );
+         idle -= nap;
+      }
+   }
+}
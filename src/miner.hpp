@@ -1,6 +1,11 @@
 #pragma once
 #include "api.hpp"
+#include <bts/mining_pool.hpp>
+#include <bts/duty_cycle.hpp>
+#include <bts/proof_of_work.hpp>
 #include <fc/thread/thread.hpp>
+#include <mutex>
+#include <atomic>
 
 class account;
 
@@ -9,19 +14,58 @@ class account;
  *  The miner will monitor the block chain for changes and
  *  attempt to solve new blocks as they come in.  When a new
  *  block is solved it will be 'added' to the chain.
+ *
+ *  Every thread of the mining pool searches its own slice of the nonce
+ *  space with its own 128 MB scratch buffer.  A new head (block_chain::changed)
+ *  restarts the search, threads notice between the phases of the
+ *  proof_of_work() they are evaluating and abandon it.
  */
 class miner
 {
     public:
-       miner( block_chain& bc, account& a );
+       /**
+        *  @param pool threads to mine on, may be shared with the name miner,
+        *         a pool with the default configuration is created if none is
+        *         given.
+        */
+       miner( block_chain& bc, account& a, const bts::mining_pool_ptr& pool = bts::mining_pool_ptr() );
        ~miner();
 
-       void start( float effort = 1);
-       void stop();
+       /**
+        *  @param effort fraction of each mining thread's core to use
+        */
+       void     start( float effort = 1);
+       void     stop();
+
+       /** @param n 0 for one thread per core, restarts the current search */
+       void     set_thread_count( uint32_t n );
+       uint32_t thread_count()const;
+
+       /** @return proof_of_work() evaluations per second over all threads */
+       double   hashes_per_sec()const;
 
     private:
-       fc::thread     _mining_thread;
-       block_chain&   _block_chain;
-       account&       _mining_account;
-       float          _effort;
+       void start_new_block();
+       void found_block( const bts::block& b, uint64_t ver );
+       void mine( bts::block b, uint32_t thread_num, uint32_t stride, uint64_t ver, bts::pow_hash target, unsigned char* buffer );
+
+       fc::thread&                         _self;
+       block_chain&                        _block_chain;
+       account&                            _mining_account;
+       /** read by every mining thread, 0 while stopped */
+       std::atomic<float>                  _effort;
+
+       bts::mining_pool_ptr                _pool;
+       std::vector<fc::future<void> >      _mining_complete;
+       /** one scratch buffer per pool thread that has ever mined, never shrinks */
+       std::vector<bts::pow_buffer>        _buffers;
+
+       /** incremented to stop every thread searching an older block */
+       std::atomic<uint64_t>               _block_ver;
+
+       /** guards _duty which is read by hashes_per_sec() */
+       mutable std::mutex                  _stats_mutex;
+       mutable std::vector<bts::duty_cycle> _duty;
+
+       fc::signal<void()>::connection_id_type  _changed_connection;
 };
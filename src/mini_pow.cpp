@@ -1,11 +1,66 @@
 #include <fc/crypto/sha512.hpp>
 #include <fc/crypto/bigint.hpp>
 #include <bts/mini_pow.hpp>
+#include <bts/sha512_multi.hpp>
 #include <algorithm>
 #include <fc/log/logger.hpp>
 
 namespace bts {
 
+  namespace detail
+  {
+     inline uint64_t load_big_endian64( const unsigned char* b )
+     {
+        uint64_t v = 0;
+        for( uint32_t i = 0; i < 8; ++i ) v = (v << 8) | b[i];
+        return v;
+     }
+
+     inline uint32_t count_leading_zeros64( uint64_t v )
+     {
+     #ifdef __GNUC__
+        return __builtin_clzll( v );
+     #else
+        uint32_t n = 0;
+        while( !(v & (uint64_t(1) << 63)) ) { v <<= 1; ++n; }
+        return n;
+     #endif
+     }
+
+     mini_pow mini_pow_from_digest( const fc::sha512& h2 )
+     {
+        // Treat h2 as a 512 bit big endian integer, shift out the leading zeros
+        // and keep the top 80 bits, replacing the first byte with the number of
+        // leading zeros.  This produces the same result as doing the math with
+        // fc::bigint without any heap allocation.  Two extra zero words allow
+        // the shift to read past the end of the digest.
+        const unsigned char* d = (const unsigned char*)&h2;
+        uint64_t w[10];
+        for( uint32_t i = 0; i < 8; ++i ) w[i] = detail::load_big_endian64( d + 8*i );
+        w[8] = w[9] = 0;
+
+        mini_pow p;
+        uint32_t q = 0;
+        while( q < 8 && w[q] == 0 ) ++q;
+        if( q == 8 )
+        {
+           memset( p.data, 0, sizeof(p) );
+           p.data[0] = char(255-512);
+           return p;
+        }
+
+        uint32_t r    = detail::count_leading_zeros64( w[q] );
+        uint64_t top0 = r ? (w[q]   << r) | (w[q+1] >> (64-r)) : w[q];
+        uint64_t top1 = r ? (w[q+1] << r) | (w[q+2] >> (64-r)) : w[q+1];
+
+        for( uint32_t i = 0; i < 8; ++i ) p.data[i] = char( top0 >> (56 - 8*i) );
+        p.data[8] = char( top1 >> 56 );
+        p.data[9] = char( top1 >> 48 );
+        p.data[0] = char( 255 - (64*q + r) );
+        return p;
+     }
+  }
+
   mini_pow mini_pow_hash( const char* data, size_t len )
   {
       return mini_pow_hash( fc::sha512::hash( data, len ) );
@@ -13,16 +68,22 @@ namespace bts {
 
   mini_pow mini_pow_hash( const fc::sha512& h1 )
   {
-      auto h2 = fc::sha512::hash( (char*)&h1, sizeof(h1) );
-      mini_pow p;
-      fc::bigint  h3( (char*)&h2, sizeof(h2) );
-      int64_t lz = 512 - h3.log2();
-      h3 <<= lz;
-      std::vector<char> bige = h3;
-      bige[0] = 255-lz;
-      memcpy( p.data, bige.data(), sizeof(p) );
-      return p;
+      return detail::mini_pow_from_digest( fc::sha512::hash( (char*)&h1, sizeof(h1) ) );
+  }
+
+  void mini_pow_hash( const char* const* data, size_t len, uint32_t n, mini_pow* out )
+  {
+      fc::sha512 h1[sha512_max_lanes];
+      fc::sha512 h2[sha512_max_lanes];
+      const char* m[sha512_max_lanes];
+
+      sha512_multi( data, len, n, h1 );
+      for( uint32_t i = 0; i < n; ++i ) m[i] = (const char*)&h1[i];
+      sha512_multi( m, sizeof(fc::sha512), n, h2 );
+
+      for( uint32_t i = 0; i < n; ++i ) out[i] = detail::mini_pow_from_digest( h2[i] );
   }
+
   fc::bigint     to_bigint( const mini_pow& p )
   {
       return fc::bigint( p.data, sizeof(p) );
@@ -0,0 +1,99 @@
+#include <bts/mining_pool.hpp>
+#include <fc/exception/exception.hpp>
+#include <fc/log/logger.hpp>
+#include <thread>
+#include <vector>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#include <string.h>
+#endif
+
+namespace bts {
+
+  namespace detail
+  {
+     class mining_pool_impl
+     {
+        public:
+          mining_pool_impl()
+          :_size(0){}
+
+          mining_pool::config                          _config;
+          std::vector<std::unique_ptr<fc::thread> >    _threads;
+          uint32_t                                     _size;
+     };
+
+     /** called on the thread to pin */
+     void pin_current_thread( uint32_t cpu )
+     {
+     #ifdef __linux__
+        cpu_set_t set;
+        CPU_ZERO( &set );
+        CPU_SET( cpu, &set );
+        int r = pthread_setaffinity_np( pthread_self(), sizeof(set), &set );
+        if( r != 0 )
+        {
+           wlog( "unable to pin mining thread to cpu ${cpu}: ${e}", ("cpu",cpu)("e",strerror(r)) );
+        }
+     #else
+        wlog( "pinning mining threads is not supported on this platform" );
+     #endif
+     }
+  } // namespace detail
+
+  mining_pool::mining_pool( const mining_pool::config& c )
+  :my( new detail::mining_pool_impl() )
+  {
+     my->_config = c;
+     resize( c.threads );
+  }
+
+  mining_pool::~mining_pool(){}
+
+  uint32_t mining_pool::default_thread_count()
+  {
+     uint32_t n = std::thread::hardware_concurrency();
+     return n ? n : 1;
+  }
+
+  void mining_pool::resize( uint32_t n )
+  {
+     if( n == 0 ) n = default_thread_count();
+
+     const uint32_t cpus = default_thread_count();
+     while( my->_threads.size() < n )
+     {
+        uint32_t i = my->_threads.size();
+        my->_threads.push_back( std::unique_ptr<fc::thread>( new fc::thread( "mining" ) ) );
+        if( my->_config.pin_threads )
+        {
+           my->_threads.back()->async( [=](){ detail::pin_current_thread( i % cpus ); } ).wait();
+        }
+     }
+
+     if( n != my->_size )
+     {
+        ilog( "mining with ${n} threads", ("n",n) );
+     }
+     my->_size = n;
+  }
+
+  uint32_t mining_pool::size()const
+  {
+     return my->_size;
+  }
+
+  bool mining_pool::pinned()const
+  {
+     return my->_config.pin_threads;
+  }
+
+  fc::thread& mining_pool::at( uint32_t i )
+  {
+     FC_ASSERT( i < my->_size, "mining thread ${i} of ${n}", ("i",i)("n",my->_size) );
+     return *my->_threads[i];
+  }
+
+} // namespace bts
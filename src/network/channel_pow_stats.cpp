@@ -1,5 +1,6 @@
 #include <bts/network/channel_pow_stats.hpp>
-#include <fc/crypto/bigint.hpp>
+#include <bts/uint256.hpp>
+#include <bts/config.hpp>
 
 namespace bts { namespace network {
 
@@ -10,13 +11,10 @@ channel_pow_stats::channel_pow_stats()
   memset( (char*)&target_pow, 0xff, sizeof(target_pow) );
 }
 
-/**
- *   TODO: unit test channel_pow_stats::update_pbs_avg
- */
-bool channel_pow_stats::update_bps_avg( uint64_t bytes_recv, const pow_hash& msg_pow )
+bool channel_pow_stats::update_bpus_avg( uint64_t bytes_recv, const mini_pow& msg_pow )
 {
    // normalize the proof of work for the message size
-   fc::bigint msg( &msg_pow,     sizeof(msg_pow) );
+   uint256 msg = to_uint256( msg_pow );
    msg *= ( (bytes_recv / 1024) + 1); // give the average work per kb
 
    // for the purposes of this calculation, there is no such thing as a message less than
@@ -43,33 +41,26 @@ bool channel_pow_stats::update_bps_avg( uint64_t bytes_recv, const pow_hash& msg
    avg_bits_per_usec = total / (BITCHAT_BANDWIDTH_WINDOW_US + ellapsed_us);
 
    // use the same weighting factors to weight the update to the average POW
-   fc::bigint avg( &average_pow, sizeof(average_pow) );
-   fc::bigint wsum = (avg * BITCHAT_BANDWIDTH_WINDOW_US + msg*ellapsed_us) 
-                     / 
-                     (BITCHAT_BANDWIDTH_WINDOW_US+ellapsed_us);
+   uint256 wsum = (to_uint256( average_pow ) * uint64_t(BITCHAT_BANDWIDTH_WINDOW_US) + msg * uint64_t(ellapsed_us)) 
+                  / 
+                  uint64_t(BITCHAT_BANDWIDTH_WINDOW_US+ellapsed_us);
 
-   fc::bigint tar( &target_pow, sizeof(target_pow) );
+   uint256 tar;
    if( avg_bits_per_usec >= target_bits_per_usec )
    {
-      tar *= wsum * bigint( 990000ll);
-      tar /= bigint(1000000ll);
+      // decrease target (making it harder to get under)
+      tar = wsum * uint64_t(990000ll);
+      tar /=       uint64_t(1000000ll);
    }
    else
    {
       // increase target (making it easier to get under)
-      tar =  wsum * bigint(1010000ll); 
-      tar /=        bigint(1000000ll);
+      tar = wsum * uint64_t(1010000ll); 
+      tar /=       uint64_t(1000000ll);
    }
 
-   std::vector<char> tarw(tar);
-   std::vector<char> avgw(wsum);
-   target_pow = pow_hash();
-
-   memcpy( (char*)&target_pow + sizeof(pow_hash)-tarw.size(), 
-            tarw.data(), tarw.size() );
-   
-   memcpy( (char*)&average_pow + sizeof(pow_hash)-avgw.size(), 
-            avgw.data(), avgw.size() );
+   target_pow  = to_mini_pow( tar );
+   average_pow = to_mini_pow( wsum );
 
    return true;
 }
@@ -0,0 +1,71 @@
+#include <bts/blockchain/output_pool.hpp>
+#include <bts/blockchain/transaction_view.hpp>
+#include <fc/io/raw.hpp>
+
+namespace bts {
+
+  output_pools::handle output_pools::store( const generic_trx_out& out )
+  {
+     trx_output_view v;
+     v.type = out.out_type;
+     v.data = packed_range( out.data.data(), out.data.size() );
+     return store( v );
+  }
+
+  output_pools::handle output_pools::store( const trx_output_view& out )
+  {
+     switch( out.type )
+     {
+        case claim_by_address:
+           return handle( claim_by_address, _by_address.insert( out.as<trx_output_by_address>() ) );
+        default:
+           FC_THROW_EXCEPTION( exception, "no output pool for claim type ${t}", ("t",out.type) );
+     }
+  }
+
+  void output_pools::erase( const handle& h )
+  {
+     switch( h.type )
+     {
+        case claim_by_address:
+           _by_address.erase( h.index );
+           return;
+        default:
+           FC_THROW_EXCEPTION( exception, "no output pool for claim type ${t}", ("t",h.type) );
+     }
+  }
+
+  generic_trx_out output_pools::get( const handle& h )const
+  {
+     generic_trx_out out;
+     out.out_type = h.type;
+     switch( h.type )
+     {
+        case claim_by_address:
+           out.data = fc::raw::pack( _by_address.get( h.index ) );
+           return out;
+        default:
+           FC_THROW_EXCEPTION( exception, "no output pool for claim type ${t}", ("t",h.type) );
+     }
+  }
+
+  bool output_pools::contains( const handle& h )const
+  {
+     switch( h.type )
+     {
+        case claim_by_address: return _by_address.contains( h.index );
+        default:               return false;
+     }
+  }
+
+  uint32_t output_pools::size()const
+  {
+     return _by_address.size();
+  }
+
+  void output_pools::clear()
+  {
+     _by_address.clear();
+  }
+
+} // namespace bts
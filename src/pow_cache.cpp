@@ -0,0 +1,93 @@
+#include <bts/pow_cache.hpp>
+#include <fc/exception/exception.hpp>
+#include <fc/reflect/variant.hpp>
+#include <fc/log/logger.hpp>
+#include <leveldb/db.h>
+
+namespace bts {
+
+  namespace ldb = leveldb;
+
+  namespace detail
+  {
+     class pow_cache_impl
+     {
+        public:
+          std::unique_ptr<ldb::DB> pow_db;
+     };
+  }
+
+  pow_cache::pow_cache()
+  :my( new detail::pow_cache_impl() ){}
+
+  pow_cache::~pow_cache(){}
+
+  void pow_cache::open( const fc::path& db_dir, bool create )
+  {
+     try
+     {
+        if( !fc::exists( db_dir ) )
+        {
+          if( !create )
+          {
+             FC_THROW_EXCEPTION( file_not_found_exception, "Unable to open pow cache ${dir}", ("dir",db_dir) );
+          }
+          fc::create_directories( db_dir );
+        }
+
+        ldb::Options opts;
+        opts.create_if_missing = create;
+
+        ldb::DB* db = nullptr;
+        auto status = ldb::DB::Open( opts, db_dir.generic_string().c_str(), &db );
+        if( !status.ok() )
+        {
+           FC_THROW_EXCEPTION( exception, "Unable to open database ${db}\n\t${msg}",
+                ("db",db_dir)
+                ("msg",status.ToString())
+                );
+        }
+        my->pow_db.reset(db);
+     } FC_RETHROW_EXCEPTIONS( warn, "unable to open pow cache ${dir}", ("dir",db_dir) )
+  }
+
+  void pow_cache::close()
+  {
+     my->pow_db.reset();
+  }
+
+  fc::optional<pow_hash> pow_cache::fetch( const fc::sha256& in )const
+  {
+     fc::optional<pow_hash> result;
+     if( !my->pow_db ) return result;
+
+     std::string value;
+     ldb::Slice  key( (char*)&in, sizeof(in) );
+     auto status = my->pow_db->Get( ldb::ReadOptions(), key, &value );
+     if( status.ok() && value.size() == sizeof(pow_hash) )
+     {
+        result = pow_hash();
+        memcpy( result->data, value.c_str(), sizeof(pow_hash) );
+     }
+     else if( !status.ok() && !status.IsNotFound() )
+     {
+        wlog( "pow cache lookup failed: ${msg}", ("msg", status.ToString()) );
+     }
+     return result;
+  }
+
+  void pow_cache::store( const fc::sha256& in, const pow_hash& out )
+  {
+     if( !my->pow_db ) return;
+
+     ldb::Slice key( (char*)&in, sizeof(in) );
+     ldb::Slice value( out.data, sizeof(out) );
+     auto status = my->pow_db->Put( ldb::WriteOptions(), key, value );
+     if( !status.ok() )
+     {
+        FC_THROW_EXCEPTION( exception, "Unable to store pow ${out}\n\t${msg}",
+              ("out",out)("msg",status.ToString() ) );
+     }
+  }
+
+} // namespace bts
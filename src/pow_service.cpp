@@ -0,0 +1,153 @@
+#include <bts/pow_service.hpp>
+#include <fc/thread/thread.hpp>
+#include <fc/exception/exception.hpp>
+#include <fc/log/logger.hpp>
+#include <map>
+
+namespace bts {
+
+  namespace detail
+  {
+     struct pow_request
+     {
+        fc::sha256                    seed;
+        fc::promise<mini_pow>::ptr    result;
+     };
+
+     class pow_service_impl
+     {
+        public:
+          pow_service_impl()
+          :_self( fc::thread::current() ),_next_seq(0){}
+
+          fc::thread&                                   _self;
+
+          /** one thread and one leased scratch buffer per worker */
+          std::vector<std::unique_ptr<fc::thread> >     _threads;
+          std::vector<pow_buffer>                       _buffers;
+          std::vector<fc::future<void> >                _running;
+          std::vector<uint32_t>                         _idle;
+
+          /** ordered by priority then by submission order */
+          std::map< std::pair<uint32_t,uint64_t>, pow_request > _queue;
+          uint64_t                                      _next_seq;
+
+          /**
+           *  Starts the highest priority requests on any idle workers, called
+           *  any time a request is queued or a worker finishes.
+           */
+          void dispatch()
+          {
+             while( _idle.size() && _queue.size() )
+             {
+                uint32_t w = _idle.back();
+                _idle.pop_back();
+
+                pow_request req = _queue.begin()->second;
+                _queue.erase( _queue.begin() );
+
+                _running[w] = fc::async( [=](){ run( w, req ); } );
+             }
+          }
+
+          void run( uint32_t w, pow_request req )
+          {
+             try
+             {
+                auto seed = req.seed;
+                auto buf  = _buffers[w].data();
+                req.result->set_value( _threads[w]->async( [=](){ return proof_of_work( seed, buf ); } ).wait() );
+             }
+             catch ( const fc::exception& e )
+             {
+                req.result->set_exception( e.dynamic_copy_exception() );
+             }
+             catch ( ... ) // e.g. std::bad_alloc, the caller must still be woken up
+             {
+                try {
+                   FC_THROW_EXCEPTION( unhandled_exception, "proof-of-work failed: ${e}", ("e", fc::except_str()) );
+                }
+                catch ( const fc::exception& e )
+                {
+                   req.result->set_exception( e.dynamic_copy_exception() );
+                }
+             }
+             // every request returns its worker, or the budget would shrink for good
+             _idle.push_back(w);
+             dispatch();
+          }
+     };
+  } // namespace detail
+
+  pow_service::pow_service( const pow_service::config& c )
+  :my( new detail::pow_service_impl() )
+  {
+     uint64_t workers = c.memory_budget_mb / 128;
+     if( workers == 0 ) workers = 1;
+
+     ilog( "starting ${n} proof-of-work workers for a ${mb} MB budget", ("n",workers)("mb",c.memory_budget_mb) );
+     for( uint32_t i = 0; i < workers; ++i )
+     {
+        my->_threads.push_back( std::unique_ptr<fc::thread>( new fc::thread( "pow_service" ) ) );
+        my->_buffers.push_back( pow_buffer() );
+        my->_running.push_back( fc::future<void>() );
+        my->_idle.push_back( workers - 1 - i ); // hand out worker 0 first
+     }
+  }
+
+  pow_service::~pow_service()
+  {
+     try
+     {
+        // fail anything that has not started yet
+        auto pending = std::move( my->_queue );
+        for( auto itr = pending.begin(); itr != pending.end(); ++itr )
+        {
+           try {
+              FC_THROW_EXCEPTION( canceled_exception, "proof-of-work service shut down" );
+           }
+           catch ( const fc::exception& e )
+           {
+              itr->second.result->set_exception( e.dynamic_copy_exception() );
+           }
+        }
+
+        for( auto itr = my->_running.begin(); itr != my->_running.end(); ++itr )
+        {
+           if( itr->valid() ) itr->wait();
+        }
+     }
+     catch ( ... )
+     {
+        wlog( "unexpected exception ${e}", ("e", fc::except_str()) );
+     }
+  }
+
+  fc::future<mini_pow> pow_service::submit( const fc::sha256& in, pow_priority p )
+  {
+     if( !my->_self.is_current() )
+     {
+        return my->_self.async( [=](){ return submit( in, p ); } ).wait();
+     }
+
+     detail::pow_request req;
+     req.seed   = in;
+     req.result = fc::promise<mini_pow>::ptr( new fc::promise<mini_pow>( "pow_service::submit" ) );
+
+     my->_queue[ std::make_pair( uint32_t(p), my->_next_seq++ ) ] = req;
+     my->dispatch();
+
+     return fc::future<mini_pow>( req.result );
+  }
+
+  uint32_t pow_service::worker_count()const
+  {
+     return my->_threads.size();
+  }
+
+  uint32_t pow_service::pending_count()const
+  {
+     return my->_queue.size();
+  }
+
+} // namespace bts
@@ -1,33 +1,370 @@
 #include <bts/proof_of_work.hpp>
 #include <bts/mini_pow.hpp>
+#include <bts/config.hpp>
 #include <fc/crypto/sha512.hpp>
 #include <fc/crypto/city.hpp>
+#include <stdio.h>
 #include <string.h>
-#include <SFMT.h>
+#include <bts/sfmt_fill.hpp>
 
 #include <fc/io/raw.hpp>
+#include <fc/exception/exception.hpp>
 #include <utility>
+#include <vector>
+#include <mutex>
 #include <fc/log/logger.hpp>
 
-#define MB128 (128*1024*1024)
+#ifdef __linux__
+#include <sys/mman.h>
+#endif
+
+#define MB128          (128*1024*1024)
+#define HUGE_PAGE_SIZE (2*1024*1024)
 
 namespace bts  {
 
-mini_pow proof_of_work( const fc::sha256& in)
+namespace detail
 {
-   unsigned char* buf = new unsigned char[MB128];
-   mini_pow out;
-   try {
-     out = proof_of_work( in, buf );
-   } catch ( ... )
+   /**
+    *  @return true if the kernel will back madvise(MADV_HUGEPAGE) regions
+    *          with transparent huge pages, the active setting is the one
+    *          in brackets, e.g. "always [madvise] never".
+    */
+   bool transparent_huge_pages_enabled()
+   {
+   #ifdef __linux__
+      FILE* f = fopen( "/sys/kernel/mm/transparent_hugepage/enabled", "r" );
+      if( !f ) return false;
+      char buf[128];
+      size_t n = fread( buf, 1, sizeof(buf) - 1, f );
+      fclose( f );
+      buf[n] = 0;
+      return strstr( buf, "[always]" ) || strstr( buf, "[madvise]" );
+   #else
+      return false;
+   #endif
+   }
+
+#ifdef __linux__
+   /**
+    *  Maps MB128 of regular pages starting on a huge page boundary, a
+    *  region that is not aligned can only be partially backed by huge pages.
+    *  The slack mapped to find the boundary is unmapped again so the buffer
+    *  is freed with a plain munmap( b, MB128 ).
+    */
+   void* map_aligned_scratch()
+   {
+      void* m = mmap( nullptr, MB128 + HUGE_PAGE_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0 );
+      if( m == MAP_FAILED ) return m;
+
+      const uintptr_t start   = uintptr_t(m);
+      const uintptr_t aligned = (start + HUGE_PAGE_SIZE - 1) & ~uintptr_t(HUGE_PAGE_SIZE - 1);
+      if( aligned != start ) munmap( m, aligned - start );
+      munmap( (void*)(aligned + MB128), start + HUGE_PAGE_SIZE - aligned );
+      return (void*)aligned;
+   }
+#endif
+
+   /**
+    *  The SFMT fill, the random swaps and the final city hash all walk the
+    *  entire 128 MB buffer, with 4 KB pages that is 32K TLB entries per hash.
+    *  Where possible the buffer is backed by huge pages, first by asking for
+    *  explicit (reserved) huge pages and then by hinting that transparent huge
+    *  pages should be used.  Transparent huge pages are only reported when
+    *  the kernel has them enabled and accepts the hint.
+    */
+   pow_memory_mode init_pow_memory_mode()
+   {
+   #ifdef __linux__
+   #ifdef MAP_HUGETLB
+      void* probe = mmap( nullptr, MB128, PROT_READ | PROT_WRITE, 
+                          MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0 );
+      if( probe != MAP_FAILED )
+      {
+         munmap( probe, MB128 );
+         ilog( "proof-of-work scratch memory is using explicit huge pages" );
+         return explicit_huge_pages;
+      }
+   #endif
+   #ifdef MADV_HUGEPAGE
+      if( transparent_huge_pages_enabled() )
+      {
+         void* b = map_aligned_scratch();
+         if( b != MAP_FAILED )
+         {
+            bool advised = madvise( b, MB128, MADV_HUGEPAGE ) == 0;
+            munmap( b, MB128 );
+            if( advised )
+            {
+               ilog( "proof-of-work scratch memory is using transparent huge pages" );
+               return transparent_huge_pages;
+            }
+         }
+      }
+   #endif
+   #endif
+      wlog( "proof-of-work scratch memory is using standard pages" );
+      return standard_pages;
+   }
+
+   pow_memory_mode get_pow_memory_mode()
+   {
+      static pow_memory_mode mode = init_pow_memory_mode();
+      return mode;
+   }
+
+   unsigned char* alloc_pow_scratch()
+   {
+   #ifdef __linux__
+      void* b = MAP_FAILED;
+   #ifdef MAP_HUGETLB
+      if( get_pow_memory_mode() == explicit_huge_pages )
+      {
+         // the reserved huge page pool may be exhausted, in which case fall
+         // through to regular pages for this buffer.
+         b = mmap( nullptr, MB128, PROT_READ | PROT_WRITE, 
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0 );
+      }
+   #endif
+      if( b == MAP_FAILED )
+      {
+         b = map_aligned_scratch();
+         if( b == MAP_FAILED )
+         {
+            FC_THROW_EXCEPTION( exception, "unable to allocate proof-of-work scratch memory" );
+         }
+   #ifdef MADV_HUGEPAGE
+         if( get_pow_memory_mode() == transparent_huge_pages )
+         {
+            madvise( b, MB128, MADV_HUGEPAGE );
+         }
+   #endif
+      }
+      return (unsigned char*)b;
+   #else
+      return new unsigned char[MB128];
+   #endif
+   }
+
+   void free_pow_scratch( unsigned char* b )
    {
-    delete [] buf;
-    throw;
+   #ifdef __linux__
+      munmap( b, MB128 );
+   #else
+      delete[] b;
+   #endif
    }
-   delete[] buf;
-   return out;
+
+   /**
+    *  Keeps idle 128 MB scratch buffers around so that every call to
+    *  proof_of_work() does not have to pay for allocating and page faulting
+    *  32K fresh pages.
+    */
+   class pow_buffer_pool
+   {
+      public:
+        pow_buffer_pool()
+        :_max_idle(DEFAULT_MAX_POW_BUFFERS){}
+
+        ~pow_buffer_pool()
+        {
+           for( auto itr = _idle.begin(); itr != _idle.end(); ++itr )
+           {
+              free_pow_scratch( *itr );
+           }
+        }
+
+        unsigned char* acquire()
+        {
+           {
+              std::unique_lock<std::mutex> lock(_idle_lock);
+              if( _idle.size() )
+              {
+                 unsigned char* b = _idle.back();
+                 _idle.pop_back();
+                 return b;
+              }
+           }
+           return alloc_pow_scratch();
+        }
+
+        void release( unsigned char* b )
+        {
+           {
+              std::unique_lock<std::mutex> lock(_idle_lock);
+              if( _idle.size() < _max_idle )
+              {
+                 _idle.push_back(b);
+                 return;
+              }
+           }
+           free_pow_scratch( b );
+        }
+
+        void set_max_idle( uint32_t m )
+        {
+           std::vector<unsigned char*> excess;
+           {
+              std::unique_lock<std::mutex> lock(_idle_lock);
+              _max_idle = m;
+              while( _idle.size() > _max_idle )
+              {
+                 excess.push_back( _idle.back() );
+                 _idle.pop_back();
+              }
+           }
+           for( auto itr = excess.begin(); itr != excess.end(); ++itr )
+           {
+              free_pow_scratch( *itr );
+           }
+        }
+
+        uint32_t get_max_idle()
+        {
+           std::unique_lock<std::mutex> lock(_idle_lock);
+           return _max_idle;
+        }
+
+      private:
+        std::mutex                   _idle_lock;
+        std::vector<unsigned char*>  _idle;
+        uint32_t                     _max_idle;
+   };
+
+   pow_buffer_pool& get_pow_buffer_pool()
+   {
+      static pow_buffer_pool pool;
+      return pool;
+   }
+} // namespace detail
+
+pow_buffer::pow_buffer()
+:_data( detail::get_pow_buffer_pool().acquire() ){}
+
+pow_buffer::pow_buffer( pow_buffer&& b )
+:_data(b._data)
+{
+   b._data = nullptr;
 }
 
+pow_buffer::~pow_buffer()
+{
+   if( _data ) detail::get_pow_buffer_pool().release( _data );
+}
+
+pow_buffer& pow_buffer::operator=( pow_buffer&& b )
+{
+   if( this != &b )
+   {
+      if( _data ) detail::get_pow_buffer_pool().release( _data );
+      _data   = b._data;
+      b._data = nullptr;
+   }
+   return *this;
+}
+
+void set_max_pow_buffers( uint32_t max_idle )
+{
+   detail::get_pow_buffer_pool().set_max_idle( max_idle );
+}
+
+uint32_t get_max_pow_buffers()
+{
+   return detail::get_pow_buffer_pool().get_max_idle();
+}
+
+pow_memory_mode get_pow_memory_mode()
+{
+   return detail::get_pow_memory_mode();
+}
+
+mini_pow proof_of_work( const fc::sha256& in )
+{
+   pow_buffer buf;
+   return proof_of_work( in, buf.data() );
+}
+
+
+namespace detail
+{
+   /**
+    *  The default for proof_of_work_phases(), compiles away.  Each hook is
+    *  called as a phase ends and returns false to abandon the evaluation.
+    */
+   struct no_pow_timer
+   {
+      bool sfmt_fill()   { return true; }
+      bool random_swaps(){ return true; }
+      bool city_hash()   { return true; }
+      bool final_hash()  { return true; }
+   };
+
+   /** marks the end of each phase, each phase starts where the last ended */
+   struct pow_phase_timer
+   {
+      pow_phase_timer( pow_timings& t )
+      :_t(t),_last(fc::time_point::now()){}
+
+      bool sfmt_fill()    { _t.sfmt_fill    = lap(); return true; }
+      bool random_swaps() { _t.random_swaps = lap(); return true; }
+      bool city_hash()    { _t.city_hash    = lap(); return true; }
+      bool final_hash()   { _t.final_hash   = lap(); return true; }
+
+      fc::microseconds lap()
+      {
+         auto now = fc::time_point::now();
+         auto d   = now - _last;
+         _last    = now;
+         return d;
+      }
+
+      pow_timings&   _t;
+      fc::time_point _last;
+   };
+
+   /** stops between phases once the caller no longer wants the result */
+   struct pow_cancel_check
+   {
+      pow_cancel_check( const std::function<bool()>& c ):_canceled(c){}
+
+      bool sfmt_fill()    { return !_canceled(); }
+      bool random_swaps() { return !_canceled(); }
+      bool city_hash()    { return !_canceled(); }
+      bool final_hash()   { return true; }
+
+      const std::function<bool()>& _canceled;
+   };
+
+   template<typename Timer>
+   bool proof_of_work_phases( const fc::sha256& in, unsigned char* buffer_128m, Timer& timer, mini_pow& result )
+   {
+      const uint64_t  s = MB128/sizeof(uint64_t);
+      uint64_t* buf = (uint64_t*)buffer_128m;
+
+      sfmt_t gen;
+      sfmt_init_by_array( &gen, (uint32_t*)&in, sizeof(in)/sizeof(uint32_t) );
+      sfmt_fill( &gen, buf, s );
+      if( !timer.sfmt_fill() ) return false;
+
+      // use the last number generated in the sequence as the seed to
+      // determine which numbers must be randomly swapped
+      uint64_t data = (buf+s)[-1];
+      for( uint32_t x = 0; x < 1024; ++x )
+      {
+         uint64_t d = data%s;
+         uint64_t tmp = data ^ buf[d];
+         std::swap( buf[tmp%s], buf[d] );
+         data = tmp * (x+17);
+      }
+      if( !timer.random_swaps() ) return false;
+
+      auto  out  = fc::city_hash_crc_128( (char*)buffer_128m, MB128 ); 
+      if( !timer.city_hash() ) return false;
+
+      result = mini_pow_hash( (char*)&out, sizeof(out) );
+      return timer.final_hash();
+   }
+} // namespace detail
 
 /**
  *  This proof-of-work is computationally difficult even for a single hash,
@@ -59,26 +396,25 @@ mini_pow proof_of_work( const fc::sha256& in)
  */
 mini_pow proof_of_work( const fc::sha256& in, unsigned char* buffer_128m )
 {
-   const uint64_t  s = MB128/sizeof(uint64_t);
-   uint64_t* buf = (uint64_t*)buffer_128m;
-
-   sfmt_t gen;
-   sfmt_init_by_array( &gen, (uint32_t*)&in, sizeof(in)/sizeof(uint32_t) );
-   sfmt_fill_array64( &gen, buf, s );
+   detail::no_pow_timer timer;
+   mini_pow result;
+   detail::proof_of_work_phases( in, buffer_128m, timer, result );
+   return result;
+}
 
-   // use the last number generated in the sequence as the seed to
-   // determine which numbers must be randomly swapped
-   uint64_t data = (buf+s)[-1];
-   for( uint32_t x = 0; x < 1024; ++x )
-   {
-      uint64_t d = data%s;
-      uint64_t tmp = data ^ buf[d];
-      std::swap( buf[tmp%s], buf[d] );
-      data = tmp * (x+17);
-   }
+mini_pow proof_of_work( const fc::sha256& in, unsigned char* buffer_128m, pow_timings& t )
+{
+   detail::pow_phase_timer timer( t );
+   mini_pow result;
+   detail::proof_of_work_phases( in, buffer_128m, timer, result );
+   return result;
+}
 
-   auto  out  = fc::city_hash_crc_128( (char*)buffer_128m, MB128 ); 
-   return mini_pow_hash( (char*)&out, sizeof(out) );
+bool proof_of_work( const fc::sha256& in, unsigned char* buffer_128m,
+                    const std::function<bool()>& canceled, mini_pow& out )
+{
+   detail::pow_cancel_check check( canceled );
+   return detail::proof_of_work_phases( in, buffer_128m, check, out );
 }
 
 
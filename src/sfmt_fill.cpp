@@ -0,0 +1,247 @@
+#include <bts/sfmt_fill.hpp>
+#include <fc/exception/exception.hpp>
+#include <fc/log/logger.hpp>
+#include <string.h>
+#include <vector>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define BTS_SFMT_X86 1
+#include <immintrin.h>
+#endif
+
+namespace bts {
+
+namespace detail
+{
+   typedef void (*sfmt_fill_func)( sfmt_t* gen, uint64_t* array, uint64_t size );
+
+   void sfmt_fill_reference( sfmt_t* gen, uint64_t* array, uint64_t size )
+   {
+      sfmt_fill_array64( gen, array, int(size) );
+   }
+
+#ifdef BTS_SFMT_X86
+   /**
+    *  The recursion only ever looks SFMT_N 128 bit words back, so rather than
+    *  reading the previous output back out of the (much larger than cache)
+    *  destination array the kernels keep the last SFMT_N words in a ring that
+    *  stays in L1 and write the destination with non-temporal stores.  This
+    *  avoids reading every destination cache line before it is written.
+    *
+    *  The ring is indexed so that ring[i % SFMT_N] holds the most recent
+    *  output whose index is congruent to i, which makes ring[k] the 'a' term
+    *  and ring[(k+SFMT_POS1)%SFMT_N] the 'b' term of the recursion for step i.
+    */
+   static_assert( SFMT_POS1 < SFMT_N, "pick up position must be inside the state" );
+
+   __attribute__((target("sse2")))
+   static inline __m128i sse2_recursion( __m128i a, __m128i b, __m128i c, __m128i d, __m128i mask )
+   {
+      __m128i x = _mm_slli_si128( a, SFMT_SL2 );
+      __m128i y = _mm_and_si128( _mm_srli_epi32( b, SFMT_SR1 ), mask );
+      __m128i z = _mm_xor_si128( _mm_srli_si128( c, SFMT_SR2 ), _mm_slli_epi32( d, SFMT_SL1 ) );
+      return _mm_xor_si128( _mm_xor_si128( a, x ), _mm_xor_si128( y, z ) );
+   }
+
+   /**
+    *  Copies the last SFMT_N outputs (oldest first) back into the generator
+    *  state in the same way gen_rand_array() does.
+    */
+   static void store_final_state( sfmt_t* gen, const w128_t* ring, uint64_t n128 )
+   {
+      for( uint32_t j = 0; j < SFMT_N; ++j )
+      {
+         gen->state[j] = ring[ (n128 - SFMT_N + j) % SFMT_N ];
+      }
+      gen->idx = SFMT_N32;
+   }
+
+   __attribute__((target("sse2")))
+   void sfmt_fill_sse2( sfmt_t* gen, uint64_t* array, uint64_t size )
+   {
+      const __m128i mask = _mm_set_epi32( SFMT_MSK4, SFMT_MSK3, SFMT_MSK2, SFMT_MSK1 );
+      const uint64_t n128    = size / 2;
+      const bool     aligned = (uintptr_t(array) & 15) == 0;
+      __m128i*       out     = (__m128i*)array;
+
+      w128_t ring[SFMT_N];
+      memcpy( ring, gen->state, sizeof(ring) );
+
+      __m128i r1 = _mm_loadu_si128( (__m128i*)&ring[SFMT_N-2] );
+      __m128i r2 = _mm_loadu_si128( (__m128i*)&ring[SFMT_N-1] );
+
+      uint32_t k  = 0;
+      uint32_t kb = SFMT_POS1;
+      for( uint64_t i = 0; i < n128; ++i )
+      {
+         __m128i r = sse2_recursion( _mm_loadu_si128( (__m128i*)&ring[k] ),
+                                     _mm_loadu_si128( (__m128i*)&ring[kb] ), r1, r2, mask );
+         _mm_storeu_si128( (__m128i*)&ring[k], r );
+         if( aligned ) _mm_stream_si128( out + i, r );
+         else          _mm_storeu_si128( out + i, r );
+         r1 = r2;
+         r2 = r;
+         if( ++k  == SFMT_N ) k  = 0;
+         if( ++kb == SFMT_N ) kb = 0;
+      }
+      _mm_sfence();
+      store_final_state( gen, ring, n128 );
+   }
+
+   /**
+    *  The 'a' and 'b' terms of two consecutive steps are independent of each
+    *  other so they are combined 256 bits at a time, only the short chain
+    *  through the previous two outputs is evaluated 128 bits at a time.
+    *
+    *  Pairs always start on an even ring index, so with SFMT_N and SFMT_POS1
+    *  even both halves of each 256 bit load are adjacent in the ring and the
+    *  'b' term of the second step was produced before this pair started.
+    */
+   static_assert( SFMT_N % 2 == 0 && SFMT_POS1 % 2 == 0 && SFMT_POS1 + 1 < SFMT_N,
+                  "avx2 kernel requires an even state size and pick up position" );
+
+   __attribute__((target("avx2")))
+   void sfmt_fill_avx2( sfmt_t* gen, uint64_t* array, uint64_t size )
+   {
+      const __m256i mask = _mm256_set_epi32( SFMT_MSK4, SFMT_MSK3, SFMT_MSK2, SFMT_MSK1,
+                                             SFMT_MSK4, SFMT_MSK3, SFMT_MSK2, SFMT_MSK1 );
+      const uint64_t n128    = size / 2;
+      const uint64_t npairs  = n128 / 2;
+      const bool     aligned = (uintptr_t(array) & 31) == 0;
+      __m256i*       out     = (__m256i*)array;
+
+      w128_t ring[SFMT_N];
+      memcpy( ring, gen->state, sizeof(ring) );
+
+      __m128i r1 = _mm_loadu_si128( (__m128i*)&ring[SFMT_N-2] );
+      __m128i r2 = _mm_loadu_si128( (__m128i*)&ring[SFMT_N-1] );
+
+      uint32_t k  = 0;
+      uint32_t kb = SFMT_POS1;
+      for( uint64_t p = 0; p < npairs; ++p )
+      {
+         __m256i a = _mm256_loadu_si256( (__m256i*)&ring[k] );
+         __m256i b = _mm256_loadu_si256( (__m256i*)&ring[kb] );
+         __m256i x = _mm256_xor_si256( _mm256_xor_si256( a, _mm256_slli_si256( a, SFMT_SL2 ) ),
+                                       _mm256_and_si256( _mm256_srli_epi32( b, SFMT_SR1 ), mask ) );
+
+         __m128i lo = _mm_xor_si128( _mm256_castsi256_si128( x ),
+                      _mm_xor_si128( _mm_srli_si128( r1, SFMT_SR2 ), _mm_slli_epi32( r2, SFMT_SL1 ) ) );
+         __m128i hi = _mm_xor_si128( _mm256_extracti128_si256( x, 1 ),
+                      _mm_xor_si128( _mm_srli_si128( r2, SFMT_SR2 ), _mm_slli_epi32( lo, SFMT_SL1 ) ) );
+
+         __m256i r = _mm256_inserti128_si256( _mm256_castsi128_si256( lo ), hi, 1 );
+         _mm256_storeu_si256( (__m256i*)&ring[k], r );
+         if( aligned ) _mm256_stream_si256( out + p, r );
+         else          _mm256_storeu_si256( out + p, r );
+         r1 = lo;
+         r2 = hi;
+         if( (k  += 2) == SFMT_N ) k  = 0;
+         if( (kb += 2) == SFMT_N ) kb = 0;
+      }
+
+      if( n128 % 2 )
+      {
+         const __m128i mask128 = _mm256_castsi256_si128( mask );
+         __m128i r = sse2_recursion( _mm_loadu_si128( (__m128i*)&ring[k] ),
+                                     _mm_loadu_si128( (__m128i*)&ring[kb] ), r1, r2, mask128 );
+         _mm_storeu_si128( (__m128i*)&ring[k], r );
+         _mm_storeu_si128( (__m128i*)array + n128 - 1, r );
+      }
+      _mm_sfence();
+      store_final_state( gen, ring, n128 );
+   }
+#endif // BTS_SFMT_X86
+
+   /**
+    *  Compares a kernel to the vendor implementation over a few seeds and
+    *  sizes, including an odd number of 128 bit words, checking both the
+    *  output and the state left behind for the next call.
+    */
+   bool sfmt_self_test( sfmt_fill_func f )
+   {
+      const uint64_t sizes[] = { SFMT_N64, SFMT_N64 * 3 + 2, 20000, 20002 };
+      for( uint32_t seed = 1; seed < 4; ++seed )
+      {
+         for( uint32_t s = 0; s < sizeof(sizes)/sizeof(sizes[0]); ++s )
+         {
+            std::vector<uint64_t> expect( sizes[s] + 4 ), actual( sizes[s] + 4 );
+            uint32_t key[4] = { seed, seed * 31, seed * 977, 0x5bd1e995 };
+
+            sfmt_t ref_gen, test_gen;
+            sfmt_init_by_array( &ref_gen,  key, 4 );
+            sfmt_init_by_array( &test_gen, key, 4 );
+
+            // offset by 64 bits on alternate runs to exercise unaligned stores
+            uint32_t off = seed % 2;
+            sfmt_fill_array64( &ref_gen, expect.data() + off, int(sizes[s]) );
+            f( &test_gen, actual.data() + off, sizes[s] );
+
+            if( memcmp( expect.data(), actual.data(), expect.size() * sizeof(uint64_t) ) != 0 ||
+                memcmp( ref_gen.state, test_gen.state, sizeof(ref_gen.state) ) != 0 ||
+                ref_gen.idx != test_gen.idx )
+            {
+               return false;
+            }
+         }
+      }
+      return true;
+   }
+
+   struct sfmt_dispatch
+   {
+      sfmt_dispatch()
+      :kernel(sfmt_reference_kernel),fill(&sfmt_fill_reference)
+      {
+      #ifdef BTS_SFMT_X86
+         __builtin_cpu_init();
+         if( __builtin_cpu_supports( "avx2" ) )
+         {
+            if( sfmt_self_test( &sfmt_fill_avx2 ) )
+            {
+               kernel = sfmt_avx2_kernel;
+               fill   = &sfmt_fill_avx2;
+               ilog( "using avx2 sfmt fill kernel" );
+               return;
+            }
+            elog( "avx2 sfmt fill kernel failed self test" );
+         }
+         if( __builtin_cpu_supports( "sse2" ) )
+         {
+            if( sfmt_self_test( &sfmt_fill_sse2 ) )
+            {
+               kernel = sfmt_sse2_kernel;
+               fill   = &sfmt_fill_sse2;
+               ilog( "using sse2 sfmt fill kernel" );
+               return;
+            }
+            elog( "sse2 sfmt fill kernel failed self test" );
+         }
+      #endif
+         wlog( "using reference sfmt fill kernel" );
+      }
+
+      sfmt_fill_kernel kernel;
+      sfmt_fill_func   fill;
+   };
+
+   const sfmt_dispatch& get_sfmt_dispatch()
+   {
+      static sfmt_dispatch d;
+      return d;
+   }
+} // namespace detail
+
+void sfmt_fill( sfmt_t* gen, uint64_t* array, uint64_t size )
+{
+   FC_ASSERT( size % 2 == 0 && size >= SFMT_N64 );
+   FC_ASSERT( gen->idx == SFMT_N32 );
+   detail::get_sfmt_dispatch().fill( gen, array, size );
+}
+
+sfmt_fill_kernel get_sfmt_fill_kernel()
+{
+   return detail::get_sfmt_dispatch().kernel;
+}
+
+} // namespace bts
@@ -0,0 +1,263 @@
+#include <bts/sha512_multi.hpp>
+#include <fc/exception/exception.hpp>
+#include <fc/log/logger.hpp>
+#include <algorithm>
+#include <string.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define BTS_SHA512_X86 1
+#endif
+
+namespace bts {
+
+namespace detail
+{
+   typedef void (*sha512_multi_func)( const char* const* msgs, size_t len, uint32_t n, fc::sha512* out );
+
+   void sha512_multi_scalar( const char* const* msgs, size_t len, uint32_t n, fc::sha512* out )
+   {
+      for( uint32_t i = 0; i < n; ++i )
+      {
+         out[i] = fc::sha512::hash( msgs[i], len );
+      }
+   }
+
+#ifdef BTS_SHA512_X86
+   static const uint64_t sha512_k[80] = {
+      0x428a2f98d728ae22ull, 0x7137449123ef65cdull, 0xb5c0fbcfec4d3b2full, 0xe9b5dba58189dbbcull,
+      0x3956c25bf348b538ull, 0x59f111f1b605d019ull, 0x923f82a4af194f9bull, 0xab1c5ed5da6d8118ull,
+      0xd807aa98a3030242ull, 0x12835b0145706fbeull, 0x243185be4ee4b28cull, 0x550c7dc3d5ffb4e2ull,
+      0x72be5d74f27b896full, 0x80deb1fe3b1696b1ull, 0x9bdc06a725c71235ull, 0xc19bf174cf692694ull,
+      0xe49b69c19ef14ad2ull, 0xefbe4786384f25e3ull, 0x0fc19dc68b8cd5b5ull, 0x240ca1cc77ac9c65ull,
+      0x2de92c6f592b0275ull, 0x4a7484aa6ea6e483ull, 0x5cb0a9dcbd41fbd4ull, 0x76f988da831153b5ull,
+      0x983e5152ee66dfabull, 0xa831c66d2db43210ull, 0xb00327c898fb213full, 0xbf597fc7beef0ee4ull,
+      0xc6e00bf33da88fc2ull, 0xd5a79147930aa725ull, 0x06ca6351e003826full, 0x142929670a0e6e70ull,
+      0x27b70a8546d22ffcull, 0x2e1b21385c26c926ull, 0x4d2c6dfc5ac42aedull, 0x53380d139d95b3dfull,
+      0x650a73548baf63deull, 0x766a0abb3c77b2a8ull, 0x81c2c92e47edaee6ull, 0x92722c851482353bull,
+      0xa2bfe8a14cf10364ull, 0xa81a664bbc423001ull, 0xc24b8b70d0f89791ull, 0xc76c51a30654be30ull,
+      0xd192e819d6ef5218ull, 0xd69906245565a910ull, 0xf40e35855771202aull, 0x106aa07032bbd1b8ull,
+      0x19a4c116b8d2d0c8ull, 0x1e376c085141ab53ull, 0x2748774cdf8eeb99ull, 0x34b0bcb5e19b48a8ull,
+      0x391c0cb3c5c95a63ull, 0x4ed8aa4ae3418acbull, 0x5b9cca4f7763e373ull, 0x682e6ff3d6b2b8a3ull,
+      0x748f82ee5defb2fcull, 0x78a5636f43172f60ull, 0x84c87814a1f0ab72ull, 0x8cc702081a6439ecull,
+      0x90befffa23631e28ull, 0xa4506cebde82bde9ull, 0xbef9a3f7b2c67915ull, 0xc67178f2e372532bull,
+      0xca273eceea26619cull, 0xd186b8c721c0c207ull, 0xeada7dd6cde0eb1eull, 0xf57d4f7fee6ed178ull,
+      0x06f067aa72176fbaull, 0x0a637dc5a2c898a6ull, 0x113f9804bef90daeull, 0x1b710b35131c471bull,
+      0x28db77f523047d84ull, 0x32caab7b40c72493ull, 0x3c9ebe0a15c9bebcull, 0x431d67c49c100d4cull,
+      0x4cc5d4becb3e42b6ull, 0x597f299cfc657e2aull, 0x5fcb6fab3ad6faecull, 0x6c44198c4a475817ull
+   };
+
+   static const uint64_t sha512_h0[8] = {
+      0x6a09e667f3bcc908ull, 0xbb67ae8584caa73bull, 0x3c6ef372fe94f82bull, 0xa54ff53a5f1d36f1ull,
+      0x510e527fade682d1ull, 0x9b05688c2b3e6c1full, 0x1f83d9abfb41bd6bull, 0x5be0cd19137e2179ull
+   };
+
+   typedef uint64_t sha512_x4 __attribute__((vector_size(32)));
+   typedef uint64_t sha512_x8 __attribute__((vector_size(64)));
+
+   #define BTS_SHA512_ROTR(x,n) (((x) >> (n)) | ((x) << (64-(n))))
+
+   /**
+    *  Runs the compression function over one 128 byte block of every lane,
+    *  lane l of each word of V belongs to the message in blocks[l].
+    *
+    *  This is written once against GCC vector types and always inlined into
+    *  the target specific entry points below so that the same source is
+    *  compiled to AVX2 or AVX-512 instructions.  Vectors are only passed by
+    *  pointer to keep the ABI independent of the enabled instruction set.
+    */
+   template<typename V>
+   __attribute__((always_inline))
+   inline void sha512_compress_lanes( V* state, const unsigned char* const* blocks )
+   {
+      const uint32_t lanes = sizeof(V) / sizeof(uint64_t);
+      V w[80];
+      for( uint32_t t = 0; t < 16; ++t )
+      {
+         for( uint32_t l = 0; l < lanes; ++l )
+         {
+            uint64_t v;
+            memcpy( &v, blocks[l] + 8*t, sizeof(v) );
+            w[t][l] = __builtin_bswap64( v );
+         }
+      }
+      for( uint32_t t = 16; t < 80; ++t )
+      {
+         V s0 = BTS_SHA512_ROTR(w[t-15],1) ^ BTS_SHA512_ROTR(w[t-15],8) ^ (w[t-15] >> 7);
+         V s1 = BTS_SHA512_ROTR(w[t-2],19) ^ BTS_SHA512_ROTR(w[t-2],61) ^ (w[t-2] >> 6);
+         w[t] = w[t-16] + s0 + w[t-7] + s1;
+      }
+
+      V a = state[0], b = state[1], c = state[2], d = state[3];
+      V e = state[4], f = state[5], g = state[6], h = state[7];
+      for( uint32_t t = 0; t < 80; ++t )
+      {
+         V S1 = BTS_SHA512_ROTR(e,14) ^ BTS_SHA512_ROTR(e,18) ^ BTS_SHA512_ROTR(e,41);
+         V ch = (e & f) ^ (~e & g);
+         V t1 = h + S1 + ch + sha512_k[t] + w[t];
+         V S0 = BTS_SHA512_ROTR(a,28) ^ BTS_SHA512_ROTR(a,34) ^ BTS_SHA512_ROTR(a,39);
+         V mj = (a & b) ^ (a & c) ^ (b & c);
+         h = g; g = f; f = e; e = d + t1;
+         d = c; c = b; b = a; a = t1 + S0 + mj;
+      }
+      state[0] += a; state[1] += b; state[2] += c; state[3] += d;
+      state[4] += e; state[5] += f; state[6] += g; state[7] += h;
+   }
+
+   #undef BTS_SHA512_ROTR
+
+   /**
+    *  Pads every message into its own 128 byte block on the stack one block
+    *  at a time, so no lane ever allocates.  Batches larger than the vector
+    *  are hashed one group of lanes at a time, lanes beyond n in the last
+    *  group hash a copy of the first message and are discarded.
+    */
+   template<typename V>
+   __attribute__((always_inline))
+   inline void sha512_multi_vector( const char* const* msgs, size_t len, uint32_t n, fc::sha512* out )
+   {
+      const uint32_t lanes   = sizeof(V) / sizeof(uint64_t);
+      const uint64_t nblocks = (len + 17 + 127) / 128;
+      const uint64_t bitlen  = __builtin_bswap64( uint64_t(len) * 8 );
+
+      unsigned char        block[lanes][128];
+      const unsigned char* blocks[lanes];
+      for( uint32_t l = 0; l < lanes; ++l ) blocks[l] = block[l];
+
+      for( uint32_t base = 0; base < n; base += lanes )
+      {
+         V state[8];
+         for( uint32_t i = 0; i < 8; ++i )
+            for( uint32_t l = 0; l < lanes; ++l )
+               state[i][l] = sha512_h0[i];
+
+         for( uint64_t bn = 0; bn < nblocks; ++bn )
+         {
+            const size_t start = bn * 128;
+            const size_t take  = start < len ? std::min<size_t>( 128, len - start ) : 0;
+            for( uint32_t l = 0; l < lanes; ++l )
+            {
+               const char* m = msgs[ base + l < n ? base + l : 0 ];
+               if( take ) memcpy( block[l], m + start, take );
+               memset( block[l] + take, 0, 128 - take );
+               if( take < 128 && start + take == len ) block[l][take] = 0x80;
+               if( bn == nblocks - 1 ) memcpy( block[l] + 120, &bitlen, sizeof(bitlen) );
+            }
+            sha512_compress_lanes<V>( state, blocks );
+         }
+
+         for( uint32_t l = 0; l < lanes && base + l < n; ++l )
+         {
+            uint64_t* o = (uint64_t*)&out[base + l];
+            for( uint32_t i = 0; i < 8; ++i ) o[i] = __builtin_bswap64( state[i][l] );
+         }
+      }
+   }
+
+   __attribute__((target("avx2")))
+   void sha512_multi_avx2( const char* const* msgs, size_t len, uint32_t n, fc::sha512* out )
+   {
+      sha512_multi_vector<sha512_x4>( msgs, len, n, out );
+   }
+
+   __attribute__((target("avx512f")))
+   void sha512_multi_avx512( const char* const* msgs, size_t len, uint32_t n, fc::sha512* out )
+   {
+      sha512_multi_vector<sha512_x8>( msgs, len, n, out );
+   }
+#endif // BTS_SHA512_X86
+
+   /**
+    *  Compares a kernel to fc::sha512 for every length that changes how the
+    *  message is padded (empty, one byte short of needing a second block,
+    *  exactly one block, several blocks) and for partial batches.
+    */
+   bool sha512_multi_self_test( sha512_multi_func f )
+   {
+      char data[sha512_max_lanes][300];
+      for( uint32_t l = 0; l < sha512_max_lanes; ++l )
+         for( uint32_t i = 0; i < sizeof(data[l]); ++i )
+            data[l][i] = char( i * 131 + l * 17 + (i >> 3) );
+
+      const char* msgs[sha512_max_lanes];
+      for( uint32_t l = 0; l < sha512_max_lanes; ++l ) msgs[l] = data[l];
+
+      const size_t lengths[] = { 0, 1, 64, 70, 111, 112, 127, 128, 129, 239, 240, 300 };
+      for( uint32_t s = 0; s < sizeof(lengths)/sizeof(lengths[0]); ++s )
+      {
+         for( uint32_t n = 1; n <= sha512_max_lanes; ++n )
+         {
+            fc::sha512 out[sha512_max_lanes];
+            f( msgs, lengths[s], n, out );
+            for( uint32_t l = 0; l < n; ++l )
+            {
+               if( !(out[l] == fc::sha512::hash( msgs[l], lengths[s] )) ) return false;
+            }
+         }
+      }
+      return true;
+   }
+
+   struct sha512_multi_dispatch
+   {
+      sha512_multi_dispatch()
+      :kernel(sha512_scalar_kernel),lanes(1),hash(&sha512_multi_scalar)
+      {
+      #ifdef BTS_SHA512_X86
+         __builtin_cpu_init();
+         if( __builtin_cpu_supports( "avx512f" ) )
+         {
+            if( sha512_multi_self_test( &sha512_multi_avx512 ) )
+            {
+               kernel = sha512_avx512_kernel;
+               lanes  = 8;
+               hash   = &sha512_multi_avx512;
+               ilog( "using avx512 multi-buffer sha512 kernel" );
+               return;
+            }
+            elog( "avx512 multi-buffer sha512 kernel failed self test" );
+         }
+         if( __builtin_cpu_supports( "avx2" ) )
+         {
+            if( sha512_multi_self_test( &sha512_multi_avx2 ) )
+            {
+               kernel = sha512_avx2_kernel;
+               lanes  = 4;
+               hash   = &sha512_multi_avx2;
+               ilog( "using avx2 multi-buffer sha512 kernel" );
+               return;
+            }
+            elog( "avx2 multi-buffer sha512 kernel failed self test" );
+         }
+      #endif
+         wlog( "using scalar sha512 for multi-buffer hashing" );
+      }
+
+      sha512_multi_kernel kernel;
+      uint32_t            lanes;
+      sha512_multi_func   hash;
+   };
+
+   const sha512_multi_dispatch& get_sha512_multi_dispatch()
+   {
+      static sha512_multi_dispatch d;
+      return d;
+   }
+} // namespace detail
+
+void sha512_multi( const char* const* msgs, size_t len, uint32_t n, fc::sha512* out )
+{
+   FC_ASSERT( n > 0 && n <= sha512_max_lanes );
+   detail::get_sha512_multi_dispatch().hash( msgs, len, n, out );
+}
+
+uint32_t sha512_multi_lanes()
+{
+   return detail::get_sha512_multi_dispatch().lanes;
+}
+
+sha512_multi_kernel get_sha512_multi_kernel()
+{
+   return detail::get_sha512_multi_dispatch().kernel;
+}
+
+} // namespace bts
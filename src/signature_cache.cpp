@@ -0,0 +1,104 @@
+#include <bts/signature_cache.hpp>
+#include <bts/flat_hash.hpp>
+#include <fc/crypto/sha224.hpp>
+#include <mutex>
+#include <random>
+#include <vector>
+
+namespace bts {
+
+  namespace detail
+  {
+     class signature_cache_impl
+     {
+        public:
+          signature_cache_impl( uint32_t max )
+          :_max(max),_next(0)
+          {
+             std::random_device rd;
+             for( uint32_t i = 0; i < sizeof(_salt)/sizeof(uint32_t); ++i ) ((uint32_t*)_salt)[i] = rd();
+          }
+
+          fc::sha224 key( const fc::sha256& digest, const fc::ecc::compact_signature& sig )const
+          {
+             fc::sha224::encoder enc;
+             enc.write( _salt, sizeof(_salt) );
+             enc.write( (const char*)&digest, sizeof(digest) );
+             enc.write( (const char*)sig.data, sizeof(sig.data) );
+             return enc.result();
+          }
+
+          char                              _salt[32];
+          uint32_t                          _max;
+          mutable std::mutex                _mutex;
+          flat_hash_map<fc::sha224,address> _entries;
+          /** keys in insertion order, _next is the oldest once it is full */
+          std::vector<fc::sha224>           _ring;
+          uint32_t                          _next;
+     };
+  }
+
+  signature_cache::signature_cache( uint32_t max_entries )
+  :my( new detail::signature_cache_impl( max_entries ) ){}
+
+  signature_cache::~signature_cache(){}
+
+  fc::optional<address> signature_cache::fetch( const fc::sha256& digest, const fc::ecc::compact_signature& sig )const
+  {
+     fc::optional<address> result;
+     auto k = my->key( digest, sig );
+
+     std::unique_lock<std::mutex> lock( my->_mutex );
+     auto itr = my->_entries.find( k );
+     if( itr != my->_entries.end() ) result = itr->second;
+     return result;
+  }
+
+  void signature_cache::store( const fc::sha256& digest, const fc::ecc::compact_signature& sig, const address& a )
+  {
+     if( my->_max == 0 ) return;
+     auto k = my->key( digest, sig );
+
+     std::unique_lock<std::mutex> lock( my->_mutex );
+     if( !my->_entries.insert( std::make_pair( k, a ) ).second ) return;
+     if( my->_ring.size() < my->_max )
+     {
+        my->_ring.push_back( k );
+        return;
+     }
+     my->_entries.erase( my->_ring[my->_next] );
+     my->_ring[my->_next] = k;
+     my->_next = (my->_next + 1) % my->_max;
+  }
+
+  address signature_cache::recover( const fc::sha256& digest, const fc::ecc::compact_signature& sig )
+  {
+     auto cached = fetch( digest, sig );
+     if( cached ) return *cached;
+
+     address a( fc::ecc::public_key( sig, digest ) );
+     store( digest, sig, a );
+     return a;
+  }
+
+  uint32_t signature_cache::size()const
+  {
+     std::unique_lock<std::mutex> lock( my->_mutex );
+     return my->_entries.size();
+  }
+
+  void signature_cache::clear()
+  {
+     std::unique_lock<std::mutex> lock( my->_mutex );
+     my->_entries.clear();
+     my->_ring.clear();
+     my->_next = 0;
+  }
+
+  signature_cache& get_signature_cache()
+  {
+     static signature_cache cache;
+     return cache;
+  }
+
+} // namespace bts
@@ -0,0 +1,39 @@
+#include <bts/blockchain/transaction.hpp>
+#include <bts/blockchain/transaction_view.hpp>
+#include <fc/io/raw.hpp>
+#include <fc/reflect/variant.hpp>
+
+namespace bts {
+
+  cached_transaction::cached_transaction()
+  :_trx(),_id( calculate_id( _trx ) ){}
+
+  cached_transaction::cached_transaction( signed_transaction trx )
+  :_trx( std::move(trx) ),_id( calculate_id( _trx ) ){}
+
+  cached_transaction::cached_transaction( const transaction_view& trx )
+  :_trx( trx.unpack() ),_id( trx.calculate_id() ){}
+
+  fc::sha224 cached_transaction::calculate_id( const transaction& trx )
+  {
+     fc::sha224::encoder enc;
+     fc::raw::pack( enc, trx );
+     return enc.result();
+  }
+
+} // namespace bts
+
+namespace fc
+{
+  void to_variant( const bts::cached_transaction& t, variant& v )
+  {
+     to_variant( t.trx(), v );
+  }
+
+  void from_variant( const variant& v, bts::cached_transaction& t )
+  {
+     bts::signed_transaction trx;
+     from_variant( v, trx );
+     t = bts::cached_transaction( std::move(trx) );
+  }
+}
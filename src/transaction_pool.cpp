@@ -0,0 +1,351 @@
+#include <bts/blockchain/transaction_pool.hpp>
+#include <bts/flat_hash.hpp>
+#include <fc/io/raw.hpp>
+#include <fc/reflect/variant.hpp>
+#include <fc/log/logger.hpp>
+#include <algorithm>
+#include <queue>
+#include <set>
+
+namespace bts {
+
+  namespace detail
+  {
+     struct pool_entry
+     {
+        pool_entry():fee(0),size(0),fee_rate(0){}
+
+        cached_transaction            trx;
+        uint64_t                      fee;
+        uint32_t                      size;
+        uint64_t                      fee_rate; ///< fee per 1000 bytes
+        std::vector<output_reference> spends;
+        std::vector<fc::sha224>       parents;  ///< pooled transactions with outputs this one spends
+     };
+
+     /** lowest fee rate first, ties broken by id so that keys are unique */
+     typedef std::pair<uint64_t,fc::sha224> fee_key;
+     typedef std::pair<uint32_t,fc::sha224> expire_key;
+
+     class transaction_pool_impl
+     {
+        public:
+          transaction_pool_impl( uint64_t max )
+          :_max_bytes(max),_bytes(0){}
+
+          uint64_t                                                    _max_bytes;
+          uint64_t                                                    _bytes;
+          flat_hash_map<fc::sha224,pool_entry>                        _by_id;
+          std::set<fee_key>                                           _by_fee;
+          /** the entries of _by_fee without pooled parents */
+          std::set<fee_key>                                           _ready;
+          flat_hash_map<output_reference,fc::sha224,output_reference_hash> _by_input;
+          std::set<expire_key>                                        _by_expire;
+
+          static uint64_t fee_rate( uint64_t fee, uint32_t size )
+          {
+             return fee / size * 1000 + (fee % size) * 1000 / size;
+          }
+
+          /** @return the pooled transactions that spend an output of trx, without duplicates */
+          std::vector<fc::sha224> children( const fc::sha224& id, const cached_transaction& trx )const
+          {
+             std::vector<fc::sha224> result;
+             output_reference out;
+             out.trx_hash = id;
+             for( uint32_t i = 0; i < trx.trx().outputs.size(); ++i )
+             {
+                out.output_idx = i;
+                auto spender = _by_input.find( out );
+                if( spender == _by_input.end() ) continue;
+                if( std::find( result.begin(), result.end(), spender->second ) == result.end() )
+                {
+                   result.push_back( spender->second );
+                }
+             }
+             return result;
+          }
+
+          /** @return roots followed by every pooled transaction that depends on them, parents first */
+          std::vector<fc::sha224> with_descendants( const std::vector<fc::sha224>& roots )const
+          {
+             std::vector<fc::sha224>   result;
+             flat_hash_set<fc::sha224> seen;
+             for( auto itr = roots.begin(); itr != roots.end(); ++itr )
+             {
+                if( _by_id.find( *itr ) != _by_id.end() && seen.insert( *itr ).second ) result.push_back( *itr );
+             }
+             for( size_t i = 0; i < result.size(); ++i )
+             {
+                auto kids = children( result[i], _by_id.find( result[i] )->second.trx );
+                for( auto k = kids.begin(); k != kids.end(); ++k )
+                {
+                   if( seen.insert( *k ).second ) result.push_back( *k );
+                }
+             }
+             return result;
+          }
+
+          void insert( const fc::sha224& id, pool_entry&& e )
+          {
+             for( auto in = e.spends.begin(); in != e.spends.end(); ++in )
+             {
+                auto parent = _by_id.find( in->trx_hash );
+                if( parent == _by_id.end() || in->output_idx >= parent->second.trx.trx().outputs.size() ) continue;
+                if( std::find( e.parents.begin(), e.parents.end(), in->trx_hash ) == e.parents.end() )
+                {
+                   e.parents.push_back( in->trx_hash );
+                }
+             }
+
+             // children may have been pooled before their parent
+             auto kids = children( id, e.trx );
+             for( auto k = kids.begin(); k != kids.end(); ++k )
+             {
+                pool_entry& c = _by_id.find( *k )->second;
+                if( c.parents.empty() ) _ready.erase( fee_key( c.fee_rate, *k ) );
+                c.parents.push_back( id );
+             }
+
+             _bytes += e.size;
+             _by_fee.insert( fee_key( e.fee_rate, id ) );
+             if( e.parents.empty() ) _ready.insert( fee_key( e.fee_rate, id ) );
+             if( e.trx.trx().expire_block ) _by_expire.insert( expire_key( e.trx.trx().expire_block, id ) );
+             for( auto itr = e.spends.begin(); itr != e.spends.end(); ++itr ) _by_input[*itr] = id;
+             _by_id[id] = std::move(e);
+          }
+
+          /** removes id alone, its pooled children become ready */
+          void erase( const fc::sha224& id )
+          {
+             auto itr = _by_id.find( id );
+             if( itr == _by_id.end() ) return;
+
+             const pool_entry& e = itr->second;
+             auto kids = children( id, e.trx );
+             for( auto k = kids.begin(); k != kids.end(); ++k )
+             {
+                pool_entry& c = _by_id.find( *k )->second;
+                c.parents.erase( std::remove( c.parents.begin(), c.parents.end(), id ), c.parents.end() );
+                if( c.parents.empty() ) _ready.insert( fee_key( c.fee_rate, *k ) );
+             }
+
+             _bytes -= e.size;
+             _by_fee.erase( fee_key( e.fee_rate, id ) );
+             _ready.erase( fee_key( e.fee_rate, id ) );
+             _by_expire.erase( expire_key( e.trx.trx().expire_block, id ) );
+             for( auto in = e.spends.begin(); in != e.spends.end(); ++in ) _by_input.erase( *in );
+             _by_id.erase( itr );
+          }
+
+          /**
+           *  Removes roots and their descendants, which spend outputs that
+           *  will never exist.
+           *
+           *  @return the number of transactions removed
+           */
+          uint32_t erase_with_descendants( const std::vector<fc::sha224>& roots )
+          {
+             auto doomed = with_descendants( roots );
+             for( auto itr = doomed.rbegin(); itr != doomed.rend(); ++itr ) erase( *itr );
+             return doomed.size();
+          }
+     };
+
+     std::vector<output_reference> get_spends( const signed_transaction& trx )
+     {
+        std::vector<output_reference> spends;
+        spends.reserve( trx.inputs.size() );
+        for( auto itr = trx.inputs.begin(); itr != trx.inputs.end(); ++itr )
+        {
+           // every input type starts with the trx_input it derives from
+           spends.push_back( fc::raw::unpack<trx_input>( itr->data ).output_ref );
+        }
+        return spends;
+     }
+  } // namespace detail
+
+  transaction_pool::transaction_pool( uint64_t max_bytes )
+  :my( new detail::transaction_pool_impl( max_bytes ) ){}
+
+  transaction_pool::~transaction_pool(){}
+
+  bool transaction_pool::add( const cached_transaction& trx, uint64_t fee )
+  {
+     const fc::sha224& id = trx.id();
+     if( contains( id ) ) return false;
+
+     detail::pool_entry e;
+     e.trx      = trx;
+     e.fee      = fee;
+     e.size     = fc::raw::pack_size( trx.trx() );
+     e.fee_rate = my->fee_rate( fee, e.size );
+     e.spends   = detail::get_spends( trx );
+     if( e.size > my->_max_bytes ) return false;
+
+     // replace by fee: beat every conflict on rate and the conflicts and
+     // their descendants, which go with them, on total fee
+     std::vector<fc::sha224> conflicts;
+     for( auto in = e.spends.begin(); in != e.spends.end(); ++in )
+     {
+        auto spender = my->_by_input.find( *in );
+        if( spender == my->_by_input.end() ) continue;
+        if( std::find( conflicts.begin(), conflicts.end(), spender->second ) != conflicts.end() ) continue;
+
+        const detail::pool_entry& c = my->_by_id.find( spender->second )->second;
+        if( c.fee_rate >= e.fee_rate ) return false;
+        conflicts.push_back( spender->second );
+     }
+
+     std::vector<fc::sha224>   doomed = my->with_descendants( conflicts );
+     flat_hash_set<fc::sha224> removed;
+     uint64_t                  bytes  = my->_bytes + e.size;
+     uint64_t                  replaced_fees = 0;
+     for( auto itr = doomed.begin(); itr != doomed.end(); ++itr )
+     {
+        const detail::pool_entry& c = my->_by_id.find( *itr )->second;
+        removed.insert( *itr );
+        replaced_fees += c.fee;
+        bytes         -= c.size;
+     }
+     if( conflicts.size() && e.fee <= replaced_fees ) return false;
+     uint32_t replaced = doomed.size();
+
+     // find the cheapest transactions to evict before changing anything
+     for( auto itr = my->_by_fee.begin(); bytes > my->_max_bytes && itr != my->_by_fee.end(); ++itr )
+     {
+        if( removed.find( itr->second ) != removed.end() ) continue;
+        if( itr->first >= e.fee_rate ) return false; // the pool is full of better transactions
+
+        auto evicted = my->with_descendants( std::vector<fc::sha224>( 1, itr->second ) );
+        for( auto ev = evicted.begin(); ev != evicted.end(); ++ev )
+        {
+           if( !removed.insert( *ev ).second ) continue;
+           doomed.push_back( *ev );
+           bytes -= my->_by_id.find( *ev )->second.size;
+        }
+     }
+
+     // do not take out a transaction that trx spends from
+     for( auto in = e.spends.begin(); in != e.spends.end(); ++in )
+     {
+        if( removed.find( in->trx_hash ) != removed.end() ) return false;
+     }
+
+     for( auto itr = doomed.rbegin(); itr != doomed.rend(); ++itr ) my->erase( *itr );
+     if( doomed.size() )
+     {
+        ilog( "transaction ${id} replaced ${c} and evicted ${e} transactions",
+              ("id",id)("c",replaced)("e",doomed.size() - replaced) );
+     }
+
+     my->insert( id, std::move(e) );
+     return true;
+  }
+
+  void transaction_pool::remove( const fc::sha224& trx_id )
+  {
+     my->erase_with_descendants( std::vector<fc::sha224>( 1, trx_id ) );
+  }
+
+  void transaction_pool::remove_included( const std::vector<cached_transaction>& trxs )
+  {
+     for( auto itr = trxs.begin(); itr != trxs.end(); ++itr )
+     {
+        my->erase( itr->id() );
+        auto spends = detail::get_spends( *itr );
+        std::vector<fc::sha224> double_spends;
+        for( auto in = spends.begin(); in != spends.end(); ++in )
+        {
+           auto spender = my->_by_input.find( *in );
+           if( spender != my->_by_input.end() ) double_spends.push_back( spender->second );
+        }
+        my->erase_with_descendants( double_spends );
+     }
+  }
+
+  uint32_t transaction_pool::expire( uint32_t block_num )
+  {
+     uint32_t removed = 0;
+     while( my->_by_expire.size() && my->_by_expire.begin()->first < block_num )
+     {
+        removed += my->erase_with_descendants( std::vector<fc::sha224>( 1, my->_by_expire.begin()->second ) );
+     }
+     return removed;
+  }
+
+  std::vector<cached_transaction> transaction_pool::select( uint64_t max_bytes )const
+  {
+     std::vector<cached_transaction>     result;
+     flat_hash_map<fc::sha224,uint32_t>  unpicked_parents;
+     std::priority_queue<detail::fee_key> unlocked; // children whose parents were all picked
+
+     auto next = my->_ready.rbegin();
+     while( max_bytes > 0 )
+     {
+        detail::fee_key key;
+        if( unlocked.size() && ( next == my->_ready.rend() || *next < unlocked.top() ) )
+        {
+           key = unlocked.top();
+           unlocked.pop();
+        }
+        else if( next != my->_ready.rend() )
+        {
+           key = *next++;
+        }
+        else break;
+
+        // children of a transaction that does not fit stay locked
+        const detail::pool_entry& e = my->_by_id.find( key.second )->second;
+        if( e.size > max_bytes ) continue;
+
+        result.push_back( e.trx );
+        max_bytes -= e.size;
+
+        auto kids = my->children( key.second, e.trx );
+        for( auto k = kids.begin(); k != kids.end(); ++k )
+        {
+           const detail::pool_entry& c = my->_by_id.find( *k )->second;
+           auto waiting = unpicked_parents.find( *k );
+           if( waiting == unpicked_parents.end() )
+           {
+              waiting = unpicked_parents.insert( std::make_pair( *k, uint32_t(c.parents.size()) ) ).first;
+           }
+           if( --waiting->second == 0 ) unlocked.push( detail::fee_key( c.fee_rate, *k ) );
+        }
+     }
+     return result;
+  }
+
+  fc::optional<cached_transaction> transaction_pool::get( const fc::sha224& trx_id )const
+  {
+     fc::optional<cached_transaction> result;
+     auto itr = my->_by_id.find( trx_id );
+     if( itr != my->_by_id.end() ) result = itr->second.trx;
+     return result;
+  }
+
+  bool transaction_pool::contains( const fc::sha224& trx_id )const
+  {
+     return my->_by_id.find( trx_id ) != my->_by_id.end();
+  }
+
+  fc::optional<fc::sha224> transaction_pool::get_spender( const output_reference& out )const
+  {
+     fc::optional<fc::sha224> result;
+     auto itr = my->_by_input.find( out );
+     if( itr != my->_by_input.end() ) result = itr->second;
+     return result;
+  }
+
+  uint32_t transaction_pool::size()const
+  {
+     return my->_by_id.size();
+  }
+
+  uint64_t transaction_pool::bytes()const
+  {
+     return my->_bytes;
+  }
+
+} // namespace bts
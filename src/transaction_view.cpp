@@ -0,0 +1,178 @@
+#include <bts/blockchain/transaction_view.hpp>
+#include <fc/exception/exception.hpp>
+#include <string.h>
+
+namespace bts {
+
+  namespace detail
+  {
+     uint32_t read_packed_size( const char*& pos, const char* end )
+     {
+        uint64_t v  = 0;
+        uint32_t by = 0;
+        uint8_t  b  = 0;
+        do
+        {
+           if( pos == end )
+           {
+              FC_THROW_EXCEPTION( exception, "packed size runs past the end of the buffer" );
+           }
+           if( by > 28 )
+           {
+              FC_THROW_EXCEPTION( exception, "packed size does not fit in 32 bits" );
+           }
+           b   = uint8_t(*pos++);
+           v  |= uint64_t(b & 0x7f) << by;
+           by += 7;
+        } while( b & 0x80 );
+
+        if( v > 0xffffffff )
+        {
+           FC_THROW_EXCEPTION( exception, "packed size does not fit in 32 bits" );
+        }
+        return uint32_t(v);
+     }
+
+     packed_range read_packed_bytes( const char*& pos, const char* end )
+     {
+        uint32_t size = read_packed_size( pos, end );
+        if( size > uint64_t(end - pos) )
+        {
+           FC_THROW_EXCEPTION( exception, "${size} bytes run past the end of the buffer", ("size",size) );
+        }
+        packed_range r( pos, size );
+        pos += size;
+        return r;
+     }
+
+     /**
+      *  Checks a section of count generic_trx_in or generic_trx_out, which
+      *  pack as a type byte and a std::vector<char>.
+      */
+     const char* skip_fields( const char* pos, const char* end, uint32_t count )
+     {
+        for( uint32_t i = 0; i < count; ++i )
+        {
+           if( pos == end )
+           {
+              FC_THROW_EXCEPTION( exception, "field ${i} of ${n} runs past the end of the buffer", ("i",i)("n",count) );
+           }
+           ++pos;
+           read_packed_bytes( pos, end );
+        }
+        return pos;
+     }
+  } // namespace detail
+
+  output_reference trx_input_view::output_ref()const
+  {
+     output_reference r;
+     FC_ASSERT( data.size >= sizeof(r.trx_hash) + sizeof(r.output_idx) );
+     memcpy( &r.trx_hash, data.data, sizeof(r.trx_hash) );
+     r.output_idx = uint8_t(data.data[sizeof(r.trx_hash)]);
+     return r;
+  }
+
+  uint64_t trx_output_view::amount()const
+  {
+     uint64_t a;
+     FC_ASSERT( data.size >= sizeof(a) );
+     memcpy( &a, data.data, sizeof(a) );
+     return a;
+  }
+
+  transaction_view::transaction_view()
+  :_begin(nullptr),_num_inputs(0),_inputs(nullptr),_inputs_end(nullptr),
+   _num_outputs(0),_outputs(nullptr),_outputs_end(nullptr),_num_sigs(0),_sigs(nullptr),_end(nullptr){}
+
+  transaction_view::transaction_view( const char* data, size_t size )
+  {
+     const char* end = data + size;
+     if( size < sizeof(uint16_t) + sizeof(uint32_t) )
+     {
+        FC_THROW_EXCEPTION( exception, "${size} bytes is too short for a transaction", ("size",size) );
+     }
+     _begin = data;
+
+     const char* pos = data + sizeof(uint16_t) + sizeof(uint32_t);
+     _num_inputs   = detail::read_packed_size( pos, end );
+     _inputs       = pos;
+     _inputs_end   = pos = detail::skip_fields( pos, end, _num_inputs );
+
+     _num_outputs  = detail::read_packed_size( pos, end );
+     _outputs      = pos;
+     _outputs_end  = pos = detail::skip_fields( pos, end, _num_outputs );
+
+     _num_sigs     = detail::read_packed_size( pos, end );
+     _sigs         = pos;
+     if( uint64_t(_num_sigs) * sizeof(fc::ecc::compact_signature) > uint64_t(end - pos) )
+     {
+        FC_THROW_EXCEPTION( exception, "${n} signatures run past the end of the buffer", ("n",_num_sigs) );
+     }
+     _end = _sigs + _num_sigs * sizeof(fc::ecc::compact_signature);
+  }
+
+  uint16_t transaction_view::version()const
+  {
+     uint16_t v;
+     memcpy( &v, _begin, sizeof(v) );
+     return v;
+  }
+
+  uint32_t transaction_view::expire_block()const
+  {
+     uint32_t b;
+     memcpy( &b, _begin + sizeof(uint16_t), sizeof(b) );
+     return b;
+  }
+
+  packed_fields<trx_input_view> transaction_view::inputs()const
+  {
+     return packed_fields<trx_input_view>( _num_inputs, _inputs, _inputs_end );
+  }
+
+  packed_fields<trx_output_view> transaction_view::outputs()const
+  {
+     return packed_fields<trx_output_view>( _num_outputs, _outputs, _outputs_end );
+  }
+
+  uint32_t transaction_view::num_signatures()const
+  {
+     return _num_sigs;
+  }
+
+  fc::ecc::compact_signature transaction_view::signature( uint32_t i )const
+  {
+     if( i >= _num_sigs )
+     {
+        FC_THROW_EXCEPTION( out_of_range_exception, "signature ${i} of ${n}", ("i",i)("n",_num_sigs) );
+     }
+     fc::ecc::compact_signature sig;
+     memcpy( (char*)&sig, _sigs + i * sizeof(sig), sizeof(sig) );
+     return sig;
+  }
+
+  packed_range transaction_view::bytes()const
+  {
+     return packed_range( _begin, _end - _begin );
+  }
+
+  packed_range transaction_view::unsigned_bytes()const
+  {
+     return packed_range( _begin, _outputs_end - _begin );
+  }
+
+  fc::sha224 transaction_view::calculate_id()const
+  {
+     return fc::sha224::hash( _begin, _outputs_end - _begin );
+  }
+
+  signed_transaction transaction_view::unpack()const
+  {
+     fc::datastream<const char*> ds( _begin, _end - _begin );
+     signed_transaction trx;
+     fc::raw::unpack( ds, trx );
+     return trx;
+  }
+
+} // namespace bts
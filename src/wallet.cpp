@@ -22,9 +22,10 @@ namespace bts
       fc::thread t("stretch_seed");
       return t.async( [=]() {
           fc::sha256 last = seed;
+          pow_buffer buf; // reuse one leased buffer for every round
           for( uint32_t i = 0; i < 10; ++i )
           {
-              auto p = proof_of_work( last );  
+              auto p = proof_of_work( last, buf.data() );  
               last = fc::sha256::hash( (char*)&p, sizeof(p) );
           }
           return last; 
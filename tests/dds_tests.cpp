@@ -7,9 +7,30 @@
 #include <bts/bitmessage.hpp>
 #include <bts/bitchat_message.hpp>
 #include <bts/mini_pow.hpp>
+#include <bts/uint256.hpp>
+#include <bts/config.hpp>
+#include <bts/network/channel_pow_stats.hpp>
+#include <bts/sha512_multi.hpp>
+#include <bts/duty_cycle.hpp>
+#include <bts/flat_hash.hpp>
+#include <bts/block_log.hpp>
+#include <bts/merkle_tree.hpp>
+#include <bts/signature_cache.hpp>
+#include <bts/blockchain/transaction_pool.hpp>
+#include <bts/blockchain/block_view.hpp>
+#include <bts/blockchain/output_pool.hpp>
+#include "../src/chain_state.hpp"
+#include "../src/api.hpp"
+#include "../src/account.hpp"
+#include "../src/miner.hpp"
+#include <fc/crypto/sha512.hpp>
+#include <fc/crypto/bigint.hpp>
 #include <bts/dds/mmap_array.hpp>
 #include <fc/io/json.hpp>
 #include <fc/io/raw.hpp>
+#include <unordered_map>
+#include <random>
+#include <unistd.h>
 
 using namespace bts;
 BOOST_AUTO_TEST_CASE( mini_pow_test )
@@ -42,6 +63,251 @@ BOOST_AUTO_TEST_CASE( mini_pow_test )
 
 }
 
+/**
+ *  The original bigint based implementation of mini_pow_hash( sha512 )
+ */
+mini_pow mini_pow_hash_bigint( const fc::sha512& h1 )
+{
+  auto h2 = fc::sha512::hash( (char*)&h1, sizeof(h1) );
+  mini_pow p;
+  fc::bigint  h3( (char*)&h2, sizeof(h2) );
+  int64_t lz = 512 - h3.log2();
+  h3 <<= lz;
+  std::vector<char> bige = h3;
+  bige[0] = 255-lz;
+  memcpy( p.data, bige.data(), sizeof(p) );
+  return p;
+}
+
+BOOST_AUTO_TEST_CASE( mini_pow_matches_bigint )
+{
+  uint64_t seed[2] = { 0, 0 };
+  for( uint32_t i = 0; i < 2*1000*1000; ++i )
+  {
+     seed[0] = i;
+     auto h1 = fc::sha512::hash( (char*)seed, sizeof(seed) );
+     if( !(bts::mini_pow_hash( h1 ) == mini_pow_hash_bigint( h1 )) )
+     {
+        elog( "mismatch for ${i}", ("i",i) );
+        BOOST_REQUIRE( bts::mini_pow_hash( h1 ) == mini_pow_hash_bigint( h1 ) );
+     }
+  }
+}
+
+BOOST_AUTO_TEST_CASE( mini_pow_batch_matches_single )
+{
+  // 70 bytes is the size of a packed name_header with a key
+  char data[sha512_max_lanes][70];
+  const char* msgs[sha512_max_lanes];
+  for( uint32_t l = 0; l < sha512_max_lanes; ++l )
+  {
+     memset( data[l], 0x5a, sizeof(data[l]) );
+     msgs[l] = data[l];
+  }
+
+  for( uint32_t i = 0; i < 100*1000; i += sha512_max_lanes )
+  {
+     for( uint32_t l = 0; l < sha512_max_lanes; ++l )
+     {
+        uint32_t nonce = i + l;
+        memcpy( data[l], &nonce, sizeof(nonce) );
+     }
+     uint32_t n = 1 + i % sha512_max_lanes;
+
+     mini_pow out[sha512_max_lanes];
+     bts::mini_pow_hash( msgs, sizeof(data[0]), n, out );
+     for( uint32_t l = 0; l < n; ++l )
+     {
+        BOOST_REQUIRE( out[l] == bts::mini_pow_hash( msgs[l], sizeof(data[l]) ) );
+     }
+  }
+}
+
+fc::bigint to_bigint( const uint256& v )
+{
+  char bige[32];
+  for( uint32_t i = 0; i < sizeof(bige); ++i )
+  {
+     uint32_t byte = sizeof(bige) - 1 - i;
+     bige[i] = char( v.limbs[byte/4] >> (8*(byte%4)) );
+  }
+  return fc::bigint( bige, sizeof(bige) );
+}
+
+/** the low 256 bits of b, uint256 arithmetic wraps modulo 2^256 */
+uint256 to_uint256( const fc::bigint& b )
+{
+  std::vector<char> bige = b;
+  uint256 r;
+  for( uint32_t byte = 0; byte < bige.size() && byte < 32; ++byte )
+  {
+     r.limbs[byte/4] |= uint32_t(uint8_t(bige[bige.size() - 1 - byte])) << (8*(byte%4));
+  }
+  return r;
+}
+
+/** n significant limbs, each random, all zero bits or all one bits to exercise carries */
+uint256 random_uint256( std::mt19937& gen, uint32_t n )
+{
+  uint256 r;
+  for( uint32_t i = 0; i < n; ++i )
+  {
+     switch( gen() % 4 )
+     {
+        case 0:  r.limbs[i] = 0;          break;
+        case 1:  r.limbs[i] = 0xffffffff; break;
+        default: r.limbs[i] = gen();
+     }
+  }
+  if( n ) r.limbs[n-1] |= 1u << (gen() % 32);
+  return r;
+}
+
+BOOST_AUTO_TEST_CASE( uint256_matches_bigint )
+{
+  std::mt19937 gen( 1 );
+  for( uint32_t i = 0; i < 100*1000; ++i )
+  {
+     uint256 a = random_uint256( gen, gen() % (uint256::num_limbs + 1) );
+     uint256 b = random_uint256( gen, 1 + gen() % uint256::num_limbs );
+     fc::bigint ba = to_bigint( a );
+     fc::bigint bb = to_bigint( b );
+
+     BOOST_REQUIRE( a + b == to_uint256( ba + bb ) );
+     BOOST_REQUIRE( a * b == to_uint256( ba * bb ) );
+     BOOST_REQUIRE( a / b == to_uint256( ba / bb ) );
+     if( !(a < b) ) BOOST_REQUIRE( a - b == to_uint256( ba - bb ) );
+     BOOST_REQUIRE( (a < b) == (ba < bb) );
+
+     uint32_t s = gen() % 300;
+     fc::bigint shifted = ba;
+     shifted <<= s;
+     BOOST_REQUIRE( (a << s) == to_uint256( shifted ) );
+     shifted = ba;
+     shifted >>= s;
+     BOOST_REQUIRE( (a >> s) == to_uint256( shifted ) );
+  }
+
+  // a divisor of one limb takes the single pass, one of every limb shifts and subtracts
+  uint256 max = uint256() - uint256(1);
+  for( uint32_t n = 1; n <= uint256::num_limbs; ++n )
+  {
+     uint256 d = random_uint256( gen, n );
+     BOOST_REQUIRE( max / d == to_uint256( to_bigint( max ) / to_bigint( d ) ) );
+     BOOST_REQUIRE( d / d == uint256(1) );
+  }
+  BOOST_CHECK( max / max == uint256(1) );
+  BOOST_CHECK( uint256(7) / max == uint256() );
+  BOOST_CHECK( max / uint256(1) == max );
+}
+
+BOOST_AUTO_TEST_CASE( channel_pow_stats_retarget )
+{
+  bts::network::channel_pow_stats stats;
+  memset( stats.average_pow.data, 0, sizeof(stats.average_pow) );
+  stats.average_pow.data[1] = 0x40;
+
+  mini_pow msg;
+  memset( msg.data, 0, sizeof(msg) );
+  msg.data[1] = 0x20;
+  msg.data[5] = 0x33;
+
+  // the last message is older than the window so it counts as 1/32 of it
+  const uint64_t window  = BITCHAT_BANDWIDTH_WINDOW_US;
+  const uint64_t elapsed = window / 32;
+  auto expected_avg = [&]( const mini_pow& avg, uint64_t bytes )
+  {
+     return (to_bigint( avg ) * fc::bigint( window ) + to_bigint( msg ) * fc::bigint( bytes/1024 + 1 ) * fc::bigint( elapsed ))
+            / fc::bigint( window + elapsed );
+  };
+
+  // over the target rate the new target is 1% below the average
+  stats.last_recv = fc::time_point::now() - fc::seconds( 3600 );
+  auto avg = expected_avg( stats.average_pow, 4096 );
+  BOOST_REQUIRE( stats.update_bpus_avg( 4096, msg ) );
+  BOOST_CHECK( stats.average_pow == bts::to_mini_pow( avg ) );
+  BOOST_CHECK( stats.target_pow  == bts::to_mini_pow( avg * fc::bigint( 990000 ) / fc::bigint( 1000000 ) ) );
+  BOOST_CHECK( stats.avg_bits_per_usec == 8 * 4096 * elapsed / (window + elapsed) );
+
+  // under the target rate it is 1% above the average
+  stats.target_bits_per_usec = uint64_t(-1);
+  stats.last_recv = fc::time_point::now() - fc::seconds( 3600 );
+  avg = expected_avg( stats.average_pow, 1024 );
+  BOOST_REQUIRE( stats.update_bpus_avg( 1024, msg ) );
+  BOOST_CHECK( stats.average_pow == bts::to_mini_pow( avg ) );
+  BOOST_CHECK( stats.target_pow  == bts::to_mini_pow( avg * fc::bigint( 1010000 ) / fc::bigint( 1000000 ) ) );
+
+  // work above the target is refused and leaves the averages alone
+  auto target = stats.target_pow;
+  mini_pow easy;
+  memset( easy.data, 0xff, sizeof(easy) );
+  BOOST_CHECK( !stats.update_bpus_avg( 1024, easy ) );
+  BOOST_CHECK( stats.target_pow == target );
+}
+
+BOOST_AUTO_TEST_CASE( duty_cycle_test )
+{
+  duty_cycle d( fc::seconds(2) );
+  auto t = fc::time_point::now();
+  BOOST_CHECK( d.idle_time( 0.25, t ).count() == 0 );
+
+  // 5 ms busy at 25% effort must be followed by 15 ms idle
+  d.record( t, t + fc::milliseconds(5), 100 );
+  t += fc::milliseconds(5);
+  BOOST_CHECK( d.idle_time( 0.25, t ).count() == 15000 );
+  BOOST_CHECK( d.idle_time( 1, t ).count() == 0 );
+
+  // follow the controller for ten seconds of simulated time
+  for( uint32_t i = 0; i < 2000; ++i )
+  {
+     t += d.idle_time( 0.25, t );
+     d.record( t, t + fc::milliseconds(5), 100 );
+     t += fc::milliseconds(5);
+  }
+  BOOST_CHECK( fabs( d.utilization( t ) - 0.25 ) < 0.01 );
+  BOOST_CHECK( fabs( d.rate( t ) - 5000 ) < 100 ); // 100 per 20 ms
+}
+
+BOOST_AUTO_TEST_CASE( flat_hash_map_test )
+{
+  // random inserts, overwrites and erases must leave the same contents as
+  // std::unordered_map, including after tombstones force rehashes
+  flat_hash_map<fc::sha224,uint32_t>      f;
+  std::unordered_map<fc::sha224,uint32_t> u;
+  for( uint32_t i = 0; i < 20000; ++i )
+  {
+     auto k = fc::sha224::hash( (char*)&i, sizeof(i) );
+     uint32_t j = (i * 7919) % (i + 1);
+     auto e = fc::sha224::hash( (char*)&j, sizeof(j) );
+     if( i % 3 == 2 )
+     {
+        BOOST_CHECK( f.erase( e ) == u.erase( e ) );
+     }
+     else
+     {
+        f[k] = i;
+        u[k] = i;
+     }
+  }
+  BOOST_CHECK( f.size() == u.size() );
+
+  uint32_t n = 0;
+  for( auto itr = f.begin(); itr != f.end(); ++itr, ++n )
+  {
+     auto m = u.find( itr->first );
+     BOOST_REQUIRE( m != u.end() );
+     BOOST_CHECK( m->second == itr->second );
+  }
+  BOOST_CHECK( n == u.size() );
+
+  flat_hash_set<fc::sha224> s;
+  BOOST_CHECK( s.find( fc::sha224() ) == s.end() );
+  BOOST_CHECK( s.insert( fc::sha224() ).second );
+  BOOST_CHECK( !s.insert( fc::sha224() ).second );
+  auto copy = s;
+  BOOST_CHECK( s.erase( fc::sha224() ) == 1 && s.size() == 0 && copy.size() == 1 );
+}
+
 BOOST_AUTO_TEST_CASE( mmap_array_test )
 {
   try {
@@ -70,6 +336,328 @@ BOOST_AUTO_TEST_CASE( mmap_array_test )
 
 
 
+BOOST_AUTO_TEST_CASE( block_log_test )
+{
+  try {
+    fc::temp_directory temp_dir;
+    auto file = temp_dir.path() / "blocks.log";
+
+    std::vector<pow_hash> ids(3);
+    std::vector< std::vector<char> > blocks(3);
+    {
+       block_log log;
+       log.open( file );
+       for( uint32_t i = 0; i < 3; ++i )
+       {
+          ids[i].data[0] = i + 1;
+          blocks[i].resize( 100 + i, char(i) );
+          log.append( ids[i], i ? ids[i-1] : pow_hash(), i, blocks[i] );
+       }
+       log.append( ids[2], ids[1], 2, blocks[2] ); // already stored
+       BOOST_CHECK( log.size() == 3 );
+    }
+
+    // tear the last record as if the process died while writing it
+    BOOST_REQUIRE( truncate( file.generic_string().c_str(), fc::file_size( file ) - 5 ) == 0 );
+
+    block_log log;
+    log.open( file );
+    BOOST_CHECK( log.size() == 2 );
+    BOOST_CHECK( !log.find( ids[2] ) );
+    BOOST_CHECK( *log.fetch( ids[1] ) == blocks[1] );
+    BOOST_CHECK( log.at_height(1).size() == 1 && log.at_height(1)[0].prev == ids[0] );
+
+    log.append( ids[2], ids[1], 2, blocks[2] );
+    log.close();
+    log.open( file );
+    BOOST_CHECK( log.size() == 3 );
+    BOOST_CHECK( *log.fetch( ids[2] ) == blocks[2] );
+  } catch ( fc::exception& e )
+  {
+     elog( "${e}", ("e",e.to_detail_string() ) );
+     throw;
+  }
+}
+
+BOOST_AUTO_TEST_CASE( merkle_tree_test )
+{
+  // the incrementally updated root must match a tree built from scratch
+  merkle_tree t;
+  std::vector<fc::sha224> leaves;
+  for( uint32_t round = 0; round < 100; ++round )
+  {
+     if( round % 10 == 0 )
+     {
+        leaves.resize( (round * 37) % 200 + 1 );
+        t.resize( leaves.size() );
+     }
+     for( uint32_t k = 0; k < 5; ++k )
+     {
+        uint32_t i = (round * 31 + k * 17) % leaves.size();
+        leaves[i] = fc::sha224::hash( (char*)&round, sizeof(round) );
+        t.set( i, leaves[i] );
+     }
+
+     merkle_tree full;
+     full.resize( leaves.size() );
+     for( uint32_t i = 0; i < leaves.size(); ++i ) full.set( i, leaves[i] );
+     BOOST_REQUIRE( t.update_root() == full.update_root() );
+
+     auto b = t.get_branch( round % leaves.size() );
+     BOOST_CHECK( b.mid_states[0] == leaves[round % leaves.size()] );
+     BOOST_CHECK( b.calculate_root() == t.mroot );
+  }
+}
+
+BOOST_AUTO_TEST_CASE( signature_cache_test )
+{
+  signature_cache cache( 2 );
+  auto key    = fc::ecc::private_key::generate();
+  std::vector<fc::sha256> digests;
+  std::vector<fc::ecc::compact_signature> sigs;
+  for( uint32_t i = 0; i < 3; ++i )
+  {
+     digests.push_back( fc::sha256::hash( (char*)&i, sizeof(i) ) );
+     sigs.push_back( key.sign_compact( digests.back() ) );
+  }
+
+  BOOST_CHECK( !cache.fetch( digests[0], sigs[0] ) );
+  BOOST_CHECK( cache.recover( digests[0], sigs[0] ) == address( key.get_public_key() ) );
+  BOOST_CHECK( cache.fetch( digests[0], sigs[0] ) );
+  BOOST_CHECK( !cache.fetch( digests[1], sigs[0] ) );
+
+  cache.recover( digests[1], sigs[1] );
+  cache.recover( digests[2], sigs[2] ); // evicts the oldest
+  BOOST_CHECK( cache.size() == 2 );
+  BOOST_CHECK( !cache.fetch( digests[0], sigs[0] ) );
+  BOOST_CHECK( *cache.fetch( digests[2], sigs[2] ) == address( key.get_public_key() ) );
+}
+
+static signed_transaction spending_trx( uint32_t out, uint32_t expire_block = 0 )
+{
+  trx_input in;
+  in.output_ref.trx_hash = fc::sha224::hash( (char*)&out, sizeof(out) );
+
+  signed_transaction trx;
+  trx.version      = 0;
+  trx.expire_block = expire_block;
+  trx.inputs.resize(1);
+  trx.inputs[0].in_type = claim_by_address;
+  trx.inputs[0].data    = fc::raw::pack( in );
+  return trx;
+}
+
+BOOST_AUTO_TEST_CASE( cached_transaction_test )
+{
+  cached_transaction trx( spending_trx( 1 ) );
+  BOOST_CHECK( trx.id() == cached_transaction::calculate_id( spending_trx( 1 ) ) );
+
+  // signatures are not part of the id
+  auto id = trx.id();
+  trx.add_signature( fc::ecc::compact_signature() );
+  BOOST_CHECK( trx.id() == id );
+
+  trx.mutate( []( signed_transaction& t ){ t.version = 1; } );
+  BOOST_CHECK( trx.id() != id );
+  BOOST_CHECK( trx.id() == cached_transaction::calculate_id( trx.trx() ) );
+
+  // expire_block is packed, so it is covered by the id and the signatures
+  id = trx.id();
+  trx.mutate( []( signed_transaction& t ){ t.expire_block += 1; } );
+  BOOST_CHECK( trx.id() != id );
+
+  auto packed = fc::raw::pack( trx );
+  BOOST_CHECK( packed == fc::raw::pack( trx.trx() ) );
+  auto copy = fc::raw::unpack<cached_transaction>( packed );
+  BOOST_CHECK( copy.id() == trx.id() );
+  BOOST_CHECK( copy.trx().sigs.size() == 1 );
+}
+
+BOOST_AUTO_TEST_CASE( transaction_pool_test )
+{
+  auto trx     = spending_trx( 1 );
+  uint32_t sz  = fc::raw::pack_size( trx );
+  transaction_pool pool( 3 * sz );
+
+  BOOST_CHECK( pool.add( trx, 100 ) );
+  BOOST_CHECK( !pool.add( trx, 100 ) );
+
+  // a double spend must pay more to replace it
+  auto dbl = spending_trx( 1 );
+  dbl.version = 1;
+  BOOST_CHECK( !pool.add( dbl, 100 ) );
+  BOOST_CHECK( pool.add( dbl, 200 ) );
+  BOOST_CHECK( !pool.contains( cached_transaction::calculate_id( trx ) ) );
+  BOOST_CHECK( pool.size() == 1 );
+
+  // once full the lowest fees are evicted
+  BOOST_CHECK( pool.add( spending_trx( 2 ), 50 ) );
+  BOOST_CHECK( pool.add( spending_trx( 3, 10 ), 70 ) );
+  BOOST_CHECK( !pool.add( spending_trx( 4 ), 40 ) );
+  BOOST_CHECK( pool.add( spending_trx( 5 ), 60 ) );
+  BOOST_CHECK( !pool.contains( cached_transaction::calculate_id( spending_trx( 2 ) ) ) );
+  BOOST_CHECK( pool.bytes() == 3 * sz );
+
+  auto picked = pool.select( 2 * sz );
+  BOOST_REQUIRE( picked.size() == 2 );
+  BOOST_CHECK( picked[0].id() == cached_transaction::calculate_id( dbl ) );
+  BOOST_CHECK( picked[1].id() == cached_transaction::calculate_id( spending_trx( 3, 10 ) ) );
+
+  BOOST_CHECK( pool.expire( 11 ) == 1 );
+  pool.remove_included( std::vector<cached_transaction>( 1, spending_trx( 1 ) ) );
+  BOOST_CHECK( pool.size() == 1 );
+}
+
+/** spends output idx of trx_hash and has two outputs of its own */
+static signed_transaction child_trx( const fc::sha224& trx_hash, uint8_t idx )
+{
+  trx_input in;
+  in.output_ref.trx_hash   = trx_hash;
+  in.output_ref.output_idx = idx;
+
+  signed_transaction trx;
+  trx.version      = 0;
+  trx.expire_block = 0;
+  trx.inputs.resize(1);
+  trx.inputs[0].in_type = claim_by_address;
+  trx.inputs[0].data    = fc::raw::pack( in );
+  trx.outputs.resize(2);
+  return trx;
+}
+
+BOOST_AUTO_TEST_CASE( transaction_pool_descendants )
+{
+  auto parent = spending_trx( 1 );
+  parent.outputs.resize(2);
+  auto pid    = cached_transaction::calculate_id( parent );
+  auto a      = child_trx( pid, 0 );
+  auto g      = child_trx( cached_transaction::calculate_id( a ), 0 );
+  auto b      = child_trx( pid, 1 );
+
+  // children arriving before their parent are linked to it
+  transaction_pool pool( 1 << 20 );
+  BOOST_CHECK( pool.add( g, 1000 ) );
+  BOOST_CHECK( pool.add( a, 1000 ) );
+  BOOST_CHECK( pool.add( b, 10 ) );
+  BOOST_CHECK( pool.select( 1 << 20 ).size() == 3 );
+  BOOST_CHECK( pool.add( parent, 100 ) );
+
+  auto picked = pool.select( 1 << 20 );
+  BOOST_REQUIRE( picked.size() == 4 );
+  BOOST_CHECK( picked[0].id() == pid );
+  BOOST_CHECK( picked[1].id() == cached_transaction::calculate_id( a ) );
+  BOOST_CHECK( picked[2].id() == cached_transaction::calculate_id( g ) );
+  BOOST_CHECK( picked[3].id() == cached_transaction::calculate_id( b ) );
+
+  // children of a transaction that does not fit are not picked either
+  BOOST_CHECK( pool.select( fc::raw::pack_size( parent ) - 1 ).empty() );
+
+  // a replacement has to outbid the descendants that go with the conflict
+  auto dbl = spending_trx( 1 );
+  dbl.version = 1;
+  BOOST_CHECK( !pool.add( dbl, 2000 ) );
+  BOOST_CHECK( pool.add( dbl, 3000 ) );
+  BOOST_CHECK( pool.size() == 1 );
+
+  // an included parent leaves its children ready, a removed one takes them
+  transaction_pool included( 1 << 20 );
+  BOOST_CHECK( included.add( parent, 100 ) );
+  BOOST_CHECK( included.add( a, 1000 ) );
+  BOOST_CHECK( included.add( g, 1000 ) );
+  included.remove_included( std::vector<cached_transaction>( 1, parent ) );
+  BOOST_CHECK( included.size() == 2 );
+  BOOST_CHECK( included.select( 1 << 20 ).size() == 2 );
+  included.remove( cached_transaction::calculate_id( a ) );
+  BOOST_CHECK( included.size() == 0 );
+}
+
+BOOST_AUTO_TEST_CASE( transaction_view_test )
+{
+  trx_input_by_address in;
+  in.output_ref.trx_hash   = fc::sha224::hash( "in", 2 );
+  in.output_ref.output_idx = 3;
+
+  signed_transaction trx;
+  trx.version = 1;
+  trx.inputs.resize(1);
+  trx.inputs[0].in_type = claim_by_address;
+  trx.inputs[0].data    = fc::raw::pack( in );
+  for( uint64_t amount = 10; amount <= 20; amount += 10 )
+  {
+     trx_output_by_address out;
+     out.amount = amount;
+     trx.outputs.resize( trx.outputs.size() + 1 );
+     trx.outputs.back().out_type = claim_by_address;
+     trx.outputs.back().data     = fc::raw::pack( out );
+  }
+  trx.sigs.resize(2);
+
+  auto packed = fc::raw::pack( trx );
+  transaction_view view( packed.data(), packed.size() );
+  BOOST_CHECK( view.version() == 1 );
+  BOOST_CHECK( view.bytes().size == packed.size() );
+  BOOST_CHECK( view.calculate_id() == cached_transaction::calculate_id( trx ) );
+  BOOST_CHECK( view.num_signatures() == 2 );
+
+  BOOST_REQUIRE( view.inputs().size() == 1 );
+  BOOST_CHECK( view.inputs().begin()->output_ref() == in.output_ref );
+  BOOST_CHECK( view.inputs().begin()->as<trx_input_by_address>().output_ref == in.output_ref );
+
+  uint64_t total = 0;
+  for( auto itr = view.outputs().begin(); itr != view.outputs().end(); ++itr ) total += itr->amount();
+  BOOST_CHECK( total == 30 );
+  BOOST_CHECK( cached_transaction( view ).id() == view.calculate_id() );
+
+  BOOST_CHECK_THROW( transaction_view( packed.data(), packed.size() - 1 ), fc::exception );
+
+  block b;
+  b.state.transactions.push_back( trx );
+  b.state.transactions.push_back( trx );
+  b.state.output_indexes.resize(4);
+  auto packed_block = fc::raw::pack( b );
+  block_view bview( packed_block.data(), packed_block.size() );
+  BOOST_CHECK( bview.bytes().size == packed_block.size() );
+  BOOST_REQUIRE( bview.num_transactions() == 2 );
+  for( auto itr = bview.transactions_begin(); itr != bview.transactions_end(); ++itr )
+  {
+     BOOST_CHECK( itr->calculate_id() == b.state.transactions[0].id() );
+  }
+  BOOST_CHECK_THROW( block_view( packed_block.data(), packed_block.size() - 1 ), fc::exception );
+}
+
+BOOST_AUTO_TEST_CASE( output_pool_test )
+{
+  output_pools pools;
+  std::vector<output_pools::handle> handles;
+  const uint32_t n = output_pool<trx_output_by_address>::slab_records + 5;
+  for( uint32_t i = 0; i < n; ++i )
+  {
+     trx_output_by_address out;
+     out.amount = i;
+     generic_trx_out g;
+     g.out_type = claim_by_address;
+     g.data     = fc::raw::pack( out );
+     handles.push_back( pools.store( g ) );
+  }
+  BOOST_CHECK( pools.size() == n );
+
+  // erasing moves the last record into the hole, handles stay valid
+  pools.erase( handles[3] );
+  BOOST_CHECK( !pools.contains( handles[3] ) );
+  BOOST_CHECK( pools.by_address().get( handles[n-1].index ).amount == n-1 );
+  BOOST_CHECK( fc::raw::unpack<trx_output_by_address>( pools.get( handles[7] ).data ).amount == 7 );
+
+  uint64_t total = 0;
+  uint32_t count = 0;
+  pools.by_address().for_each( [&]( uint32_t h, const trx_output_by_address& o ){ total += o.amount; ++count; } );
+  BOOST_CHECK( count == n - 1 );
+  BOOST_CHECK( total == uint64_t(n) * (n-1) / 2 - 3 );
+
+  generic_trx_out unknown;
+  unknown.out_type = null_claim_type;
+  BOOST_CHECK_THROW( pools.store( unknown ), fc::exception );
+}
+
 BOOST_AUTO_TEST_CASE( wallet_test )
 {
 /* TODO: this test is slow...
@@ -165,3 +753,258 @@ BOOST_AUTO_TEST_CASE( bitchat_message_test )
   }
 }
 */
+
+BOOST_AUTO_TEST_CASE( chain_state_commit_undo )
+{
+   chain_state cs;
+   std::vector<bts::output_reference> refs;
+   std::vector<bts::generic_trx_out>  records;
+   std::vector<fc::sha224>            outs;
+   for( uint32_t i = 0; i < 8; ++i ) 
+   {
+      refs.push_back( bts::output_reference() );
+      refs.back().trx_hash   = fc::sha224::hash( (char*)&i, sizeof(i) );
+      refs.back().output_idx = i % 3;
+      outs.push_back( chain_state::output_id( refs.back() ) );
+
+      bts::trx_output_by_address o;
+      o.amount           = 1000 + i;
+      o.claim_address.addr.data[0] = char(i % 2);
+      records.push_back( bts::generic_trx_out() );
+      records.back().out_type = bts::claim_by_address;
+      records.back().data     = fc::raw::pack( o );
+   }
+   bts::address odd;
+   odd.addr.data[0] = 1;
+
+   chain_state_transaction b1(cs);
+   for( uint32_t i = 0; i < 6; ++i ) b1.add_output( refs[i], records[i], 1 );
+   BOOST_REQUIRE( b1.get_output( refs[3] ).output.data == records[3].data );
+   b1.commit();
+   auto s1 = cs.get_state();
+   BOOST_REQUIRE( b1.initial_condition() == fc::sha224() );
+   BOOST_REQUIRE( b1.final_condition() == s1 );
+
+   // frees a middle slot and pops the last one, then refills the free slot
+   chain_state_transaction b2(cs);
+   b2.remove_output( outs[2] );
+   b2.remove_output( outs[5] );
+   BOOST_REQUIRE( !b2.contains( outs[2] ) );
+   BOOST_REQUIRE( cs.contains( outs[2] ) );
+   b2.add_output( refs[6], records[6], 2 );
+   b2.add_output( refs[7], records[7], 2 );
+   BOOST_REQUIRE( b2.contains( outs[7] ) );
+   BOOST_CHECK_THROW( b2.get_output( refs[2] ), fc::key_not_found_exception );
+   BOOST_CHECK_THROW( b2.remove_output( outs[5] ), fc::exception );
+   b2.commit();
+   BOOST_REQUIRE( !cs.contains( outs[5] ) );
+   BOOST_REQUIRE( cs.contains( outs[7] ) );
+   BOOST_REQUIRE( b2.changes().size() == 4 );
+   BOOST_REQUIRE( cs.get_output( refs[7] ).block_num == 2 );
+   BOOST_REQUIRE( cs.get_output( refs[7] ).output.data == records[7].data );
+   BOOST_REQUIRE( cs.get_outputs_for_address( odd ).size() == 3 ); // 1, 3 and 7
+   BOOST_REQUIRE( cs.get_outputs_for_address( bts::address() ).size() == 3 ); // 0, 4 and 6
+
+   // the journal survives a round trip through the block db
+   auto journal = b2.pack();
+   chain_state_transaction loaded(cs);
+   loaded.unpack( journal.data(), journal.size() );
+   BOOST_REQUIRE( loaded.final_condition() == cs.get_state() );
+   loaded.undo();
+
+   BOOST_REQUIRE( cs.get_state() == s1 );
+   BOOST_REQUIRE( cs.contains( outs[2] ) && cs.contains( outs[5] ) );
+   BOOST_REQUIRE( !cs.contains( outs[6] ) && !cs.contains( outs[7] ) );
+   BOOST_REQUIRE( cs.get_output( refs[5] ).output.data == records[5].data );
+   BOOST_REQUIRE( cs.get_outputs_for_address( odd ).size() == 3 ); // 1, 3 and 5
+   BOOST_REQUIRE( cs.get_outputs_for_address( bts::address() ).size() == 3 ); // 0, 2 and 4
+
+   // redoing the block lands on the same state
+   chain_state_transaction redo(cs);
+   redo.remove_output( outs[2] );
+   redo.remove_output( outs[5] );
+   redo.add_output( refs[6], records[6], 2 );
+   redo.add_output( refs[7], records[7], 2 );
+   redo.commit();
+   BOOST_REQUIRE( redo.final_condition() == b2.final_condition() );
+
+   b2.undo();
+   b1.undo();
+   BOOST_REQUIRE( cs.get_state() == fc::sha224() );
+   BOOST_REQUIRE( !cs.contains( outs[0] ) );
+   BOOST_REQUIRE( cs.get_outputs_for_address( odd ).empty() );
+}
+
+static signed_transaction signed_transfer( const fc::ecc::private_key& key, const output_reference& ref,
+                                           uint64_t amount, const address& to )
+{
+  trx_input_by_address in;
+  in.output_ref = ref;
+  trx_output_by_address out;
+  out.amount        = amount;
+  out.claim_address = to;
+
+  signed_transaction trx;
+  trx.version      = 0;
+  trx.expire_block = 0;
+  trx.inputs.resize(1);
+  trx.inputs[0].in_type   = claim_by_address;
+  trx.inputs[0].data      = fc::raw::pack( in );
+  trx.outputs.resize(1);
+  trx.outputs[0].out_type = claim_by_address;
+  trx.outputs[0].data     = fc::raw::pack( out );
+
+  auto id = cached_transaction::calculate_id( trx );
+  trx.sigs.push_back( key.sign_compact( fc::sha256::hash( (char*)&id, sizeof(id) ) ) );
+  return trx;
+}
+
+static uint64_t chain_balance( const block_chain& chain, const address& a )
+{
+  uint64_t total = 0;
+  auto outs = chain.get_outputs_for_address( a );
+  for( auto itr = outs.begin(); itr != outs.end(); ++itr )
+  {
+     total += fc::raw::unpack<trx_output_by_address>( itr->output.data ).amount;
+  }
+  return total;
+}
+
+BOOST_AUTO_TEST_CASE( block_header_format )
+{
+  // version, prev (the pow_hash of the previous block), block_num, timestamp, state_hash
+  BOOST_CHECK( sizeof(pow_hash) == 10 );
+  BOOST_CHECK( fc::raw::pack( block_header() ).size() == 2 + 10 + 4 + 4 + 28 );
+}
+
+BOOST_AUTO_TEST_CASE( block_chain_pool_template )
+{
+  try {
+    fc::temp_directory temp_dir;
+    auto key   = fc::ecc::private_key::generate();
+    auto key2  = fc::ecc::private_key::generate();
+    address owner( key.get_public_key() );
+    address mid( key2.get_public_key() );
+    address dest;  dest.addr.data[0]  = 7;
+    address miner; miner.addr.data[0] = 8;
+
+    block_chain chain;
+    chain.load( temp_dir.path() );
+    chain.add_block( chain.generate_next_block( owner ) );
+    auto outs = chain.get_outputs_for_address( owner );
+    BOOST_REQUIRE( outs.size() == 1 );
+    uint64_t amount = fc::raw::unpack<trx_output_by_address>( outs[0].output.data ).amount;
+
+    // a signature that does not recover does not hide the owner's
+    auto t1 = signed_transfer( key, outs[0].ref, amount - 10, mid );
+    t1.sigs.insert( t1.sigs.begin(), fc::ecc::compact_signature() );
+    BOOST_CHECK( chain.add_transaction( t1 ) );
+    BOOST_CHECK( !chain.add_transaction( t1 ) );
+
+    // spends the pooled t1, so both go in the same block
+    output_reference r1;
+    r1.trx_hash = cached_transaction::calculate_id( t1 );
+    BOOST_CHECK( chain.add_transaction( signed_transfer( key2, r1, amount - 25, dest ) ) );
+    std::vector<fc::sha224> announced( 1, r1.trx_hash );
+    announced.push_back( fc::sha224::hash( "unknown", 7 ) );
+    auto missing = chain.get_missing_transactions( announced );
+    BOOST_REQUIRE( missing.size() == 1 );
+    BOOST_CHECK( missing[0] == announced[1] );
+    BOOST_CHECK_THROW( chain.add_transaction( signed_transfer( key2, outs[0].ref, amount - 50, dest ) ), fc::exception );
+
+    auto b2 = chain.generate_next_block( miner );
+    BOOST_REQUIRE( b2.state.transactions.size() == 3 );
+    BOOST_CHECK( b2.state.transactions[1].id() == r1.trx_hash );
+    chain.add_block( b2 );
+    BOOST_CHECK( chain_balance( chain, dest ) == amount - 25 );
+    BOOST_CHECK( chain_balance( chain, miner ) == uint64_t(block_chain::get_reward_for_height(2)) + 25 );
+    BOOST_CHECK( !chain.get_transaction( r1.trx_hash ) );
+    BOOST_CHECK( chain.generate_next_block( miner ).state.transactions.size() == 1 );
+  } catch ( fc::exception& e )
+  {
+     elog( "${e}", ("e",e.to_detail_string() ) );
+     throw;
+  }
+}
+
+BOOST_AUTO_TEST_CASE( block_chain_invalid_block )
+{
+  try {
+    fc::temp_directory a_dir;
+    fc::temp_directory b_dir;
+    address a; a.addr.data[0] = 1;
+    address b; b.addr.data[0] = 2;
+    const uint64_t a_balance = block_chain::get_reward_for_height(1) + block_chain::get_reward_for_height(2);
+
+    block_chain ca;
+    ca.load( a_dir.path() );
+    auto c1 = ca.generate_next_block( a );
+    ca.add_block( c1 );
+    auto c2 = ca.generate_next_block( a );
+    ca.add_block( c2 );
+    auto c3 = ca.generate_next_block( a );
+    c3.state_hash = fc::sha224();
+
+    {
+       block_chain cb;
+       cb.load( b_dir.path() );
+       cb.add_block( cb.generate_next_block( b ) );
+
+       // c3 fails once its parents arrive, the switch to c2 stands
+       cb.add_block( c3 );
+       cb.add_block( c2 );
+       cb.add_block( c1 );
+       BOOST_CHECK( cb.get_validation_stats().rejected_transactions == 1 );
+       BOOST_CHECK( chain_balance( cb, a ) == a_balance );
+       BOOST_CHECK( chain_balance( cb, b ) == 0 );
+       BOOST_CHECK_THROW( cb.add_block( c3 ), fc::exception );
+    }
+
+    // the invalid mark survives a restart, c3 is not applied again
+    block_chain cb;
+    cb.load( b_dir.path() );
+    BOOST_CHECK( cb.get_validation_stats().rejected_transactions == 0 );
+    BOOST_CHECK( chain_balance( cb, a ) == a_balance );
+    BOOST_CHECK( cb.generate_next_block( b ).block_num == 3 );
+    BOOST_CHECK_THROW( cb.add_block( c3 ), fc::exception );
+  } catch ( fc::exception& e )
+  {
+     elog( "${e}", ("e",e.to_detail_string() ) );
+     throw;
+  }
+}
+
+BOOST_AUTO_TEST_CASE( miner_finds_block )
+{
+  try {
+    fc::temp_directory temp_dir;
+    block_chain chain;
+    chain.load( temp_dir.path() / "chain" );
+    BOOST_REQUIRE( chain.current_difficulty() == 1 );
+
+    account acnt;
+    acnt.load( temp_dir.path() / "account" );
+    acnt.load_wallet( "miner_finds_block" );
+
+    mining_pool::config cfg;
+    cfg.threads = 1;
+    miner m( chain, acnt, std::make_shared<mining_pool>( cfg ) );
+    m.start();
+
+    // found blocks are added on this thread while it sleeps
+    uint64_t mined = 0;
+    for( uint32_t i = 0; i < 600 && mined == 0; ++i )
+    {
+       fc::usleep( fc::milliseconds( 100 ) );
+       auto addrs = acnt.get_addresses();
+       for( auto itr = addrs.begin(); itr != addrs.end(); ++itr ) mined += chain_balance( chain, *itr );
+    }
+    m.stop();
+    BOOST_CHECK( mined >= uint64_t(block_chain::get_reward_for_height(1)) );
+    BOOST_CHECK( m.hashes_per_sec() >= 0 );
+  } catch ( fc::exception& e )
+  {
+     elog( "${e}", ("e",e.to_detail_string() ) );
+     throw;
+  }
+}
@@ -0,0 +1,161 @@
+#include <bts/proof_of_work.hpp>
+#include <bts/sfmt_fill.hpp>
+#include <bts/mining_pool.hpp>
+#include <fc/io/json.hpp>
+#include <fc/io/stdio.hpp>
+#include <fc/reflect/variant.hpp>
+#include <fc/thread/thread.hpp>
+#include <fc/exception/exception.hpp>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ *  Average milliseconds spent in each phase of proof_of_work() per hash.
+ */
+struct phase_ms
+{
+   phase_ms():sfmt_fill(0),random_swaps(0),city_hash(0),final_hash(0),total(0){}
+
+   double sfmt_fill;
+   double random_swaps;
+   double city_hash;
+   double final_hash;
+   double total;
+};
+
+struct sweep_point
+{
+   sweep_point():threads(0),hashes(0),seconds(0),hashes_per_sec(0),fill_gb_per_sec(0){}
+
+   uint32_t threads;
+   uint64_t hashes;
+   double   seconds;
+   double   hashes_per_sec;
+   double   fill_gb_per_sec; ///< 128 MB per hash over the average fill time, all threads combined
+   phase_ms per_hash;
+};
+
+struct bench_report
+{
+   std::string              memory_mode;
+   std::string              sfmt_kernel;
+   uint32_t                 cores;
+   bool                     pinned;
+   uint32_t                 hashes_per_thread;
+   std::vector<sweep_point> sweep;
+};
+
+FC_REFLECT( phase_ms, (sfmt_fill)(random_swaps)(city_hash)(final_hash)(total) )
+FC_REFLECT( sweep_point, (threads)(hashes)(seconds)(hashes_per_sec)(fill_gb_per_sec)(per_hash) )
+FC_REFLECT( bench_report, (memory_mode)(sfmt_kernel)(cores)(pinned)(hashes_per_thread)(sweep) )
+
+static double to_ms( const fc::microseconds& us ) { return us.count() / 1000.0; }
+
+/**
+ *  Runs hashes_per_thread proof-of-work evaluations on each of the first
+ *  threads threads of the pool at the same time.
+ */
+sweep_point run_point( bts::mining_pool& pool, std::vector<bts::pow_buffer>& buffers,
+                       uint32_t threads, uint32_t hashes_per_thread )
+{
+   std::vector<fc::future<phase_ms> > ready;
+   auto start = fc::time_point::now();
+   for( uint32_t i = 0; i < threads; ++i )
+   {
+      unsigned char* buf = buffers[i].data();
+      ready.push_back( pool.at(i).async( [=]() -> phase_ms
+      {
+         phase_ms sum;
+         fc::sha256 in;
+         for( uint32_t x = 0; x < hashes_per_thread; ++x )
+         {
+            ((uint32_t*)&in)[0] = i;
+            ((uint32_t*)&in)[1] = x;
+
+            bts::pow_timings t;
+            bts::proof_of_work( in, buf, t );
+            sum.sfmt_fill    += to_ms( t.sfmt_fill );
+            sum.random_swaps += to_ms( t.random_swaps );
+            sum.city_hash    += to_ms( t.city_hash );
+            sum.final_hash   += to_ms( t.final_hash );
+         }
+         return sum;
+      }));
+   }
+
+   sweep_point p;
+   for( uint32_t i = 0; i < threads; ++i )
+   {
+      phase_ms s = ready[i].wait();
+      p.per_hash.sfmt_fill    += s.sfmt_fill;
+      p.per_hash.random_swaps += s.random_swaps;
+      p.per_hash.city_hash    += s.city_hash;
+      p.per_hash.final_hash   += s.final_hash;
+   }
+   auto end = fc::time_point::now();
+
+   p.threads        = threads;
+   p.hashes         = uint64_t(threads) * hashes_per_thread;
+   p.seconds        = (end - start).count() / 1000000.0;
+   p.hashes_per_sec = p.hashes / p.seconds;
+
+   p.per_hash.sfmt_fill    /= p.hashes;
+   p.per_hash.random_swaps /= p.hashes;
+   p.per_hash.city_hash    /= p.hashes;
+   p.per_hash.final_hash   /= p.hashes;
+   p.per_hash.total         = p.per_hash.sfmt_fill + p.per_hash.random_swaps +
+                              p.per_hash.city_hash + p.per_hash.final_hash;
+   p.fill_gb_per_sec        = threads * (128.0 / 1024) / (p.per_hash.sfmt_fill / 1000);
+   return p;
+}
+
+/**
+ *  Usage: pow_bench [hashes_per_thread] [max_threads] [pin]
+ *
+ *  Sweeps the number of concurrent proof-of-work threads from 1 to
+ *  max_threads (default: one per core) and prints a JSON report with the
+ *  throughput and per phase timings of each step on stdout.  Progress is
+ *  reported on stderr.
+ */
+int main( int argc, char** argv )
+{
+   try
+   {
+      bench_report report;
+      report.hashes_per_thread = argc > 1 ? atoi( argv[1] ) : 4;
+      report.cores             = bts::mining_pool::default_thread_count();
+      uint32_t max_threads     = argc > 2 ? atoi( argv[2] ) : report.cores;
+      report.pinned            = argc > 3 && strcmp( argv[3], "pin" ) == 0;
+
+      FC_ASSERT( report.hashes_per_thread > 0 && max_threads > 0 );
+
+      report.memory_mode = fc::reflector<bts::pow_memory_mode>::to_string( bts::get_pow_memory_mode() );
+      report.sfmt_kernel = fc::reflector<bts::sfmt_fill_kernel>::to_string( bts::get_sfmt_fill_kernel() );
+
+      bts::mining_pool::config cfg;
+      cfg.threads     = max_threads;
+      cfg.pin_threads = report.pinned;
+      bts::mining_pool pool( cfg );
+
+      // lease every buffer up front so that allocation is not timed
+      bts::set_max_pow_buffers( max_threads );
+      std::vector<bts::pow_buffer> buffers;
+      for( uint32_t i = 0; i < max_threads; ++i ) buffers.push_back( bts::pow_buffer() );
+
+      run_point( pool, buffers, max_threads, 1 ); // warm up, touches every page
+
+      for( uint32_t t = 1; t <= max_threads; ++t )
+      {
+         report.sweep.push_back( run_point( pool, buffers, t, report.hashes_per_thread ) );
+         fc::cerr << t << " threads: " << report.sweep.back().hashes_per_sec << " hash / sec\n";
+      }
+
+      fc::cout << fc::json::to_pretty_string( report ) << "\n";
+      return 0;
+   }
+   catch ( const fc::exception& e )
+   {
+      fc::cerr << e.to_detail_string() << "\n";
+      return -1;
+   }
+}
@@ -1,4 +1,6 @@
 #include <bts/proof_of_work.hpp>
+#include <bts/sfmt_fill.hpp>
+#include <bts/sha512_multi.hpp>
 #include <string.h>
 #include <fc/io/stdio.hpp>
 #include <fc/thread/thread.hpp>
@@ -6,6 +8,10 @@
 
 int main( int argc, char** argv )
 {
+   bts::set_max_pow_buffers( 8 );
+   fc::cerr<<"scratch memory mode: "<< fc::reflector<bts::pow_memory_mode>::to_string( bts::get_pow_memory_mode() ) <<"\n";
+   fc::cerr<<"sfmt fill kernel: "<< fc::reflector<bts::sfmt_fill_kernel>::to_string( bts::get_sfmt_fill_kernel() ) <<"\n";
+   fc::cerr<<"multi-buffer sha512 kernel: "<< fc::reflector<bts::sha512_multi_kernel>::to_string( bts::get_sha512_multi_kernel() ) <<"\n";
    fc::sha256 in;
    if( argc >= 2 )
       in = fc::sha256::hash(argv[1],strlen(argv[1]));
@@ -19,13 +25,12 @@ int main( int argc, char** argv )
      ready[i] = _threads[i].async( [=]()
      {
        auto tin = in;
-       unsigned char* tmp     = new unsigned char[128*1024*1024+512];
+       bts::pow_buffer tmp;
        for( int x = 0; x < 25; ++x )
        {
          ((uint16_t*)&tin)[i]++;
-         bts::proof_of_work( in, tmp );
+         bts::proof_of_work( in, tmp.data() );
        }
-       delete[] tmp;
      });
    }
    for( uint32_t i = 0; i < 8; ++i )
@@ -36,10 +41,8 @@ int main( int argc, char** argv )
 
    fc::cerr<<  (200.0 / ((end-start).count() / 1000000.0))  <<  " hash / sec\n";
 
-   unsigned char* tmp     = new unsigned char[128*1024*1024+512];
-   auto out = bts::proof_of_work( in, tmp );
+   auto out = bts::proof_of_work( in );
    ilog( "out: ${out}", ("out",out));
 
-   delete[] tmp;
    return -1;
 }
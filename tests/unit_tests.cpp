@@ -3,7 +3,6 @@
 #include <fc/crypto/elliptic.hpp>
 #include <fc/io/json.hpp>
 #include "../src/blockchain.hpp"
-#include "../src/chain_state.hpp"
 
 /**
  *  This test will validate that a transaction signed with a private
@@ -24,12 +23,3 @@ BOOST_AUTO_TEST_CASE( transaction_signing_and_verification )
     auto saddr = trx.get_signed_addresses();
     BOOST_REQUIRE( saddr[0] == address(dst.get_public_key()) );
 }
-
-
-
-BOOST_AUTO_TEST_CASE( chain_state_commit_undo )
-{
-   chain_state cs;
-
-
-}